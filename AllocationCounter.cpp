@@ -0,0 +1,66 @@
+#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef DUI_COUNT_ALLOCATIONS
+
+namespace {
+	// Per thread, so feed threads don't show up in the UI thread's frames
+	thread_local size_t t_allocations = 0;
+
+	void* CountedAlloc(size_t size)
+	{
+		++t_allocations;
+		void* p = malloc(size ? size : 1);
+		if(!p)
+			throw std::bad_alloc();
+		return p;
+	}
+}
+
+void* operator new(size_t size)
+{
+	return CountedAlloc(size);
+}
+
+void* operator new[](size_t size)
+{
+	return CountedAlloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+namespace tjm {
+namespace dash {
+
+size_t ThreadAllocationCount()
+{
+	return t_allocations;
+}
+
+} // end namespace dash
+} // end namespace tjm
+
+#else
+
+namespace tjm {
+namespace dash {
+
+size_t ThreadAllocationCount()
+{
+	return 0;
+}
+
+} // end namespace dash
+} // end namespace tjm
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <cstddef>
+
+namespace tjm {
+namespace dash {
+
+// Heap allocations made through operator new on the calling thread. Only
+// counted when built with DUI_COUNT_ALLOCATIONS; always zero otherwise.
+size_t ThreadAllocationCount();
+
+} // end namespace dash
+} // end namespace tjm
+
+#endif
@@ -1,9 +1,16 @@
 #include "DGui.h"
 #include "AnimatedVar.h"
 #include "utils.h"
+#include "AllocationCounter.h"
+#include "RenderThread.h"
 #include "windows.h"
 #include "Windowsx.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <exception>
+#include <memory>
+#include <string>
 #include <vector>
 #include <mutex>
 
@@ -26,6 +33,29 @@ private:
 	DashApplicationImpl* m_appImpl;
 };
 
+// One top-level window and what it draws. Everything else in the
+// application is shared between windows.
+struct DashWindow
+{
+	DashApplication* m_app;
+	Object* m_root;
+	std::wstring m_title;
+	HWND m_hwnd;
+	ID2D1HwndRenderTarget* m_pRenderTarget;
+	RenderContext m_renderContext;
+	tjm::dash::InputManager m_inputManager;
+	bool m_trackingMouse;
+	bool m_dirty;	// Drawn by the next OnRender
+	unsigned m_drawnVersion;	// The root's version when last laid out and drawn
+	std::unique_ptr<RenderThread> m_renderThread;
+
+	DashWindow(DashApplication* app, Object* root, const std::wstring& title);
+
+private:
+	DashWindow(const DashWindow&);
+	DashWindow& operator=(const DashWindow&);
+};
+
 struct DashApplicationImpl
 {
 	ApplicationCore* m_core;
@@ -33,23 +63,63 @@ struct DashApplicationImpl
 	
 	ChangeHandler m_ch;
 	tjm::animation::AnimationLibrary m_animLibrary;
-	tjm::dash::InputManager m_inputManager;
 
-	Object* m_root;
-    Object* m_focus;
-	HWND m_hwnd;
+	// SetRoot and the calls that take no window index act on the primary
+	std::vector<std::unique_ptr<DashWindow>> m_windows;
+	bool m_started;
 	ID2D1Factory* m_pDirect2dFactory;
-	ID2D1HwndRenderTarget* m_pRenderTarget;
+	// The primary's window, told when main thread tasks are queued from
+	// any thread
+	std::atomic<HWND> m_taskWindow;
 
     std::mutex m_mainThreadLock;
     std::vector<std::function<void()>> m_mainThreadQueue;
+    std::vector<std::function<void()>> m_runningTasks;   // Swapped with the queue, keeps its capacity
+
+    FrameAllocations m_frameAllocations;
+    bool m_staticFrameCheck;
+    double m_qualityTarget;
+
+    bool m_threaded;
+    SharedFrameSource m_sharedFrames;
+
+    LatencyStats m_inputLatency;
+    std::unique_ptr<InputReplay> m_replay;
+    DashWindow* m_replayWindow;
+    std::chrono::steady_clock::time_point m_replayStart;
 
 	DashApplicationImpl(DashApplication* app);
+	DashWindow& Primary();
+	void Invalidate(DashWindow& window);
+	void InvalidateChanged();
+	static void DiscardTarget(DashWindow& window);
 };
 
 void ChangeHandler::OnChange()
 {
-	::InvalidateRect(m_appImpl->m_hwnd, nullptr, FALSE);
+	// The animation clock is shared, so a tick may show in any window
+	for (auto& window : m_appImpl->m_windows)
+		m_appImpl->Invalidate(*window);
+}
+
+namespace {
+	// Length of the moves and fades the render thread runs by itself
+	const double c_compositorSeconds = 0.25;
+
+	// Posted to the primary window to run main thread tasks
+	const UINT c_runTasksMessage = WM_APP + 1;
+
+	UINT CurrentKeyModifiers()
+	{
+		UINT modifiers = 0;
+		if (GetKeyState(VK_SHIFT) < 0)
+			modifiers |= KeyModShift;
+		if (GetKeyState(VK_CONTROL) < 0)
+			modifiers |= KeyModControl;
+		if (GetKeyState(VK_MENU) < 0)
+			modifiers |= KeyModAlt;
+		return modifiers;
+	}
 }
 
 class SampleApplicationCore : public ApplicationCore
@@ -71,14 +141,78 @@ private:
 };
 
 
+DashWindow::DashWindow(DashApplication* app, Object* root, const std::wstring& title) :
+m_app(app),
+m_root(root),
+m_title(title),
+m_hwnd(nullptr),
+m_pRenderTarget(nullptr),
+m_trackingMouse(false),
+m_dirty(true),
+m_drawnVersion(0)
+{
+	m_inputManager.SetRoot(root);
+}
+
 DashApplicationImpl::DashApplicationImpl(DashApplication* app) :
 m_app(app),
 m_core(nullptr),
-m_root(nullptr),
 m_ch(this),
 m_animLibrary(&m_ch),
-m_pRenderTarget(nullptr)
+m_started(false),
+m_pDirect2dFactory(nullptr),
+m_taskWindow(nullptr),
+m_frameAllocations(),
+m_staticFrameCheck(false),
+m_qualityTarget(0),
+m_threaded(false),
+m_replayWindow(nullptr)
+{
+	m_windows.emplace_back(new DashWindow(app, nullptr, L"DashApplication"));
+}
+
+DashWindow& DashApplicationImpl::Primary()
+{
+	// The first window still open. Before Run, and once every window has
+	// closed, the first window.
+	for (auto& window : m_windows)
+	{
+		if (window->m_hwnd)
+			return *window;
+	}
+	return *m_windows.front();
+}
+
+void DashApplicationImpl::Invalidate(DashWindow& window)
+{
+	window.m_dirty = true;
+	if (window.m_hwnd)
+		::InvalidateRect(window.m_hwnd, nullptr, FALSE);
+}
+
+void DashApplicationImpl::InvalidateChanged()
 {
+	// Input and tasks only redraw the windows whose trees they touched
+	for (auto& window : m_windows)
+	{
+		Object* root = window->m_root;
+		if (!window->m_dirty && window->m_hwnd && root &&
+			(root->NeedsLayout() || root->GetVersion() != window->m_drawnVersion))
+		{
+			Invalidate(*window);
+		}
+	}
+}
+
+void DashApplicationImpl::DiscardTarget(DashWindow& window)
+{
+	window.m_renderContext.SetTarget(nullptr);
+	window.m_renderContext.ReleaseLayers();
+	if (window.m_pRenderTarget)
+	{
+		window.m_pRenderTarget->Release();
+		window.m_pRenderTarget = nullptr;
+	}
 }
 
 SampleApplicationCore::SampleApplicationCore() :
@@ -124,26 +258,30 @@ DashApplication::DashApplication()
 	m_pImpl = new DashApplicationImpl(this);
 }
 
-HRESULT DashApplication::CreateDeviceResources()
+HRESULT DashApplication::CreateDeviceResources(DashWindow& window)
 {
 	HRESULT hr = S_OK;
 
-	if (!m_pImpl->m_pRenderTarget)
+	if (!window.m_pRenderTarget)
 	{
 		RECT rc;
-		GetClientRect(m_pImpl->m_hwnd, &rc);
+		GetClientRect(window.m_hwnd, &rc);
 
 		D2D1_SIZE_U size = D2D1::SizeU(
 			rc.right - rc.left,
 			rc.bottom - rc.top
 			);
 
-		// Create a Direct2D render target.
+		// Create a Direct2D render target. Only the primary waits for
+		// vsync, so one frame loop paces every window.
 		hr = m_pImpl->m_pDirect2dFactory->CreateHwndRenderTarget(
 			D2D1::RenderTargetProperties(),
-			D2D1::HwndRenderTargetProperties(m_pImpl->m_hwnd, size),
-			&m_pImpl->m_pRenderTarget
+			D2D1::HwndRenderTargetProperties(window.m_hwnd, size,
+				&window == &m_pImpl->Primary() ? D2D1_PRESENT_OPTIONS_NONE : D2D1_PRESENT_OPTIONS_IMMEDIATELY),
+			&window.m_pRenderTarget
 			);
+
+		window.m_renderContext.SetTarget(window.m_pRenderTarget);
 	}
 
 	return hr;
@@ -151,48 +289,241 @@ HRESULT DashApplication::CreateDeviceResources()
 
 void DashApplication::OnRender()
 {
-    std::vector<std::function<void()>> pendingTasks;
+	FrameAllocations& allocations = m_pImpl->m_frameAllocations;
+
+	// Replayed input arrives at the start of the frame, as queued real input would
+	if (m_pImpl->m_replay)
+		m_pImpl->m_replay->Advance(std::chrono::duration<double>(std::chrono::steady_clock::now() - m_pImpl->m_replayStart).count());
+
+	size_t mark = ThreadAllocationCount();
+
+    std::vector<std::function<void()>>& pendingTasks = m_pImpl->m_runningTasks;
     {
         std::lock_guard<std::mutex> g(m_pImpl->m_mainThreadLock);
         pendingTasks.swap(m_pImpl->m_mainThreadQueue);
     }
+    bool ranTasks = !pendingTasks.empty();
     for (auto& f : pendingTasks) {
         f();
     }
+    pendingTasks.clear();
+
+	allocations.tasks = ThreadAllocationCount() - mark;
+	m_pImpl->InvalidateChanged();
+	allocations.layout = 0;
+	allocations.render = 0;
+	allocations.present = 0;
+	allocations.animations = 0;
 
 	m_pImpl->m_core->PreRender(this);
 
-	CORt(CreateDeviceResources());
+	// Every window waiting to be drawn is drawn in this one pass, so tasks,
+	// animations and the core's hooks run once per frame however many
+	// windows there are. Validated first, so a frame requested while
+	// drawing isn't lost.
+	bool needsLayout = false;
+	for (auto& window : m_pImpl->m_windows)
+	{
+		if (!window->m_hwnd || !window->m_dirty)
+			continue;
+		window->m_dirty = false;
+		ValidateRect(window->m_hwnd, NULL);
+		if (!window->m_root)
+			continue;
+		bool windowLayout = window->m_renderThread ? RecordWindow(*window) : RenderWindow(*window);
+		needsLayout = needsLayout || windowLayout;
+	}
 
-	m_pImpl->m_pRenderTarget->BeginDraw();
-	m_pImpl->m_pRenderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
-	m_pImpl->m_pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::White));
+	mark = ThreadAllocationCount();
+	m_pImpl->m_core->PostRender(this);
+	allocations.present += ThreadAllocationCount() - mark;
 
-	D2D1_SIZE_F rtSize = m_pImpl->m_pRenderTarget->GetSize();
+	if (m_pImpl->m_replay)
+	{
+		if (m_pImpl->m_replay->IsDone())
+			m_pImpl->m_replay.reset();
+		else
+			m_pImpl->Invalidate(*m_pImpl->m_replayWindow);
+	}
 
-	bool forceResize = m_pImpl->m_root->GetSize().height != rtSize.height || m_pImpl->m_root->GetSize().width != rtSize.width;
-	tjm::animation::AllInstant ai(forceResize);
-	m_pImpl->m_root->SetSize(rtSize);
-	m_pImpl->m_root->Layout();
+	// Nothing changed structurally, so the frame must not touch the heap
+	allocations.structural = ranTasks || needsLayout;
+	assert(m_pImpl->m_threaded || !m_pImpl->m_staticFrameCheck || allocations.structural ||
+		allocations.layout + allocations.render == 0);
+}
 
-	m_pImpl->m_root->Render(m_pImpl->m_pRenderTarget, m_pImpl->m_root->GetBoundingBox());
+bool DashApplication::RenderWindow(DashWindow& window)
+{
+	FrameAllocations& allocations = m_pImpl->m_frameAllocations;
+	Object* root = window.m_root;
 
-	CORt(m_pImpl->m_pRenderTarget->EndDraw());
+	CORt(CreateDeviceResources(window));
 
-	m_pImpl->m_core->PostRender(this);
+	window.m_pRenderTarget->BeginDraw();
+	window.m_pRenderTarget->SetTransform(D2D1::Matrix3x2F::Identity());
+	window.m_pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::White));
+
+	D2D1_SIZE_F rtSize = window.m_pRenderTarget->GetSize();
+
+	bool forceResize = root->GetSize().height != rtSize.height || root->GetSize().width != rtSize.width;
+	bool needsLayout = forceResize || root->NeedsLayout();
+	size_t animations = Object::GetAnimationsStarted();
+	size_t mark = ThreadAllocationCount();
+	tjm::animation::AllInstant ai(forceResize);
+	root->SetSize(rtSize);
+	root->Layout();
+	window.m_drawnVersion = root->GetVersion();
+	allocations.layout += ThreadAllocationCount() - mark;
+	allocations.animations += Object::GetAnimationsStarted() - animations;
+
+	mark = ThreadAllocationCount();
+	window.m_renderContext.BeginFrame();
+	root->Render(window.m_renderContext, root->GetBoundingBox());
+	window.m_renderContext.EndFrame();
+	if(window.m_renderContext.IsFrameRequested())
+		m_pImpl->Invalidate(window);
+	allocations.render += ThreadAllocationCount() - mark;
+
+	mark = ThreadAllocationCount();
+	CORt(window.m_pRenderTarget->EndDraw());
+	allocations.present += ThreadAllocationCount() - mark;
+
+	if (window.m_inputManager.HasPendingInput())
+		m_pImpl->m_inputLatency.AddSample(window.m_inputManager.InputPresented());
+
+	return needsLayout;
 }
 
-void DashApplication::OnResize(UINT width, UINT height)
+bool DashApplication::RecordWindow(DashWindow& window)
 {
-	CORt(CreateDeviceResources());
+	// The render thread owns the device; this thread only lays out and
+	// records what to draw
+	FrameAllocations& allocations = m_pImpl->m_frameAllocations;
+	Object* root = window.m_root;
+
+	RECT rc;
+	GetClientRect(window.m_hwnd, &rc);
+	D2D1_SIZE_U pixels = D2D1::SizeU(rc.right - rc.left, rc.bottom - rc.top);
+	FLOAT dpiX, dpiY;
+	m_pImpl->m_pDirect2dFactory->GetDesktopDpi(&dpiX, &dpiY);
+	D2D1_SIZE_F size = D2D1::SizeF(pixels.width * 96.0f / dpiX, pixels.height * 96.0f / dpiY);
+
+	bool forceResize = root->GetSize().height != size.height || root->GetSize().width != size.width;
+	bool needsLayout = forceResize || root->NeedsLayout();
+	size_t animations = Object::GetAnimationsStarted();
+	size_t mark = ThreadAllocationCount();
+	{
+		tjm::animation::AllInstant ai(forceResize);
+		root->SetSize(size);
+		root->Layout();
+	}
+	window.m_drawnVersion = root->GetVersion();
+	allocations.layout += ThreadAllocationCount() - mark;
+	allocations.animations += Object::GetAnimationsStarted() - animations;
+
+	mark = ThreadAllocationCount();
+	SceneSnapshot* snapshot = window.m_renderThread->AcquireSnapshot();
+	RenderContext& ctx = window.m_renderContext;
+	ctx.BeginRecording(snapshot);
+	ctx.BeginFrame();
+	root->Render(ctx, root->GetBoundingBox());
+	ctx.EndFrame();
+	ctx.EndRecording();
+	snapshot->m_pixelSize = pixels;
+	if (window.m_inputManager.HasPendingInput())
+		snapshot->m_inputAge = window.m_inputManager.InputPresented();
+	if (&window == &m_pImpl->Primary() && m_pImpl->m_sharedFrames.IsOpen())
+		m_pImpl->m_sharedFrames.Write(*snapshot);
+	window.m_renderThread->Publish();
+	allocations.render += ThreadAllocationCount() - mark;
+
+	window.m_renderThread->DrainLatencies(m_pImpl->m_inputLatency);
+	if (ctx.IsFrameRequested())
+		m_pImpl->Invalidate(window);
+
+	return needsLayout;
+}
+
+void DashApplication::OnResize(DashWindow& window, UINT width, UINT height)
+{
+	// The next recorded frame picks up the new size
+	if (window.m_renderThread)
+	{
+		m_pImpl->Invalidate(window);
+		return;
+	}
+	if (!window.m_root)
+		return;
+
+	CORt(CreateDeviceResources(window));
 
 	// Note: This method can fail, but it's okay to ignore the
 	// error here, because the error will be returned again
 	// the next time EndDraw is called.
-	m_pImpl->m_pRenderTarget->Resize(D2D1::SizeU(width, height));
+	window.m_pRenderTarget->Resize(D2D1::SizeU(width, height));
 	tjm::animation::AllInstant ai(true);
-	m_pImpl->m_root->SetSize(D2D1::SizeF((FLOAT)width, (FLOAT)height));
-	m_pImpl->m_root->Layout();
+	window.m_root->SetSize(D2D1::SizeF((FLOAT)width, (FLOAT)height));
+	window.m_root->Layout();
+}
+
+void DashApplication::CreateAppWindow(DashWindow& window)
+{
+	// Because the CreateWindow function takes its size in pixels,
+	// obtain the system DPI and use it to scale the window size.
+	FLOAT dpiX, dpiY;
+
+	// The factory returns the current system DPI. This is also the value it will use
+	// to create its own windows.
+	m_pImpl->m_pDirect2dFactory->GetDesktopDpi(&dpiX, &dpiY);
+
+	// Create the window.
+	window.m_hwnd = CreateWindow(
+		L"DashApplication",
+		window.m_title.c_str(),
+		WS_OVERLAPPEDWINDOW,
+		CW_USEDEFAULT,
+		CW_USEDEFAULT,
+		static_cast<UINT>(ceil(640.f * dpiX / 96.f)),
+		static_cast<UINT>(ceil(480.f * dpiY / 96.f)),
+		NULL,
+		NULL,
+		HINST_THISCOMPONENT,
+		&window
+		);
+	CORt(window.m_hwnd ? S_OK : E_FAIL);
+
+	if (m_pImpl->m_threaded)
+		window.m_renderThread.reset(new RenderThread(m_pImpl->m_pDirect2dFactory, window.m_hwnd));
+	m_pImpl->m_taskWindow = m_pImpl->Primary().m_hwnd;
+
+	window.m_root->SetVisible(true);
+	ShowWindow(window.m_hwnd, SW_SHOWNORMAL);
+	UpdateWindow(window.m_hwnd);
+}
+
+void DashApplication::DestroyAppWindow(DashWindow& window)
+{
+	// Device resources go with the window; its root and input stay
+	bool wasPrimary = &window == &m_pImpl->Primary();
+	window.m_renderThread.reset();
+	DashApplicationImpl::DiscardTarget(window);
+	window.m_hwnd = nullptr;
+
+	DashWindow& primary = m_pImpl->Primary();
+	m_pImpl->m_taskWindow = primary.m_hwnd;
+	if (!primary.m_hwnd)
+	{
+		PostQuitMessage(0);
+		return;
+	}
+
+	// The next window takes over waiting for vsync, so the frame loop
+	// stays paced; its target is made again with that on
+	if (wasPrimary)
+	{
+		DashApplicationImpl::DiscardTarget(primary);
+		m_pImpl->Invalidate(primary);
+	}
 }
 
 // The windows procedure.
@@ -203,30 +534,46 @@ LRESULT CALLBACK DashApplication::WndProc(HWND hwnd, UINT message, WPARAM wParam
 	if (message == WM_CREATE)
 	{
 		LPCREATESTRUCT pcs = (LPCREATESTRUCT)lParam;
-		DashApplication *pDemoApp = (DashApplication *)pcs->lpCreateParams;
-		::SetWindowLongPtrW(hwnd, GWLP_USERDATA, PtrToUlong(pDemoApp));
+		DashWindow *pWindow = (DashWindow *)pcs->lpCreateParams;
+		pWindow->m_hwnd = hwnd;
+		::SetWindowLongPtrW(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(pWindow));
 		result = 1;
 	}
 	else
 	{
-		DashApplication *pDemoApp = reinterpret_cast<DashApplication *>(static_cast<LONG_PTR>(::GetWindowLongPtrW(hwnd, GWLP_USERDATA)));
+		DashWindow *pWindow = reinterpret_cast<DashWindow *>(static_cast<LONG_PTR>(::GetWindowLongPtrW(hwnd, GWLP_USERDATA)));
 		bool wasHandled = false;
 
-		if (pDemoApp)
+		if (pWindow)
 		{
+			DashApplication *pDemoApp = pWindow->m_app;
 			switch (message)
 			{
+            case WM_KEYDOWN:
+            case WM_SYSKEYDOWN:
+            case WM_KEYUP:
+            case WM_SYSKEYUP:
             case WM_CHAR:
-                pDemoApp->m_pImpl->m_inputManager.OnKey((char)wParam);
+            case WM_SYSCHAR:
+            {
+                KeyEvent e;
+                e.type = message == WM_CHAR || message == WM_SYSCHAR ? KeyEventType::Char :
+                    message == WM_KEYDOWN || message == WM_SYSKEYDOWN ? KeyEventType::Down : KeyEventType::Up;
+                e.key = (UINT)wParam;
+                e.modifiers = CurrentKeyModifiers();
+                e.repeat = e.type == KeyEventType::Down && (lParam & (1 << 30)) != 0;
                 result = 0;
-                wasHandled = true;
-                break;
+                // Unhandled system keys still reach DefWindowProc, for Alt+F4 and the menu
+                wasHandled = pWindow->m_inputManager.OnKeyEvent(e) ||
+                    (message != WM_SYSKEYDOWN && message != WM_SYSKEYUP && message != WM_SYSCHAR);
+            }
+            break;
 
 			case WM_SIZE:
 			{
 				UINT width = LOWORD(lParam);
 				UINT height = HIWORD(lParam);
-				pDemoApp->OnResize(width, height);
+				pDemoApp->OnResize(*pWindow, width, height);
 			}
 			result = 0;
 			wasHandled = true;
@@ -240,10 +587,16 @@ LRESULT CALLBACK DashApplication::WndProc(HWND hwnd, UINT message, WPARAM wParam
 			wasHandled = true;
 			break;
 
+			case c_runTasksMessage:
+				pDemoApp->OnRender();
+				result = 0;
+				wasHandled = true;
+				break;
+
 			case WM_PAINT:
 			{
+				pWindow->m_dirty = true;
 				pDemoApp->OnRender();
-				ValidateRect(hwnd, NULL);
 			}
 			result = 0;
 			wasHandled = true;
@@ -251,7 +604,7 @@ LRESULT CALLBACK DashApplication::WndProc(HWND hwnd, UINT message, WPARAM wParam
 
 			case WM_DESTROY:
 			{
-				PostQuitMessage(0);
+				pDemoApp->DestroyAppWindow(*pWindow);
 			}
 			result = 1;
 			wasHandled = true;
@@ -261,25 +614,43 @@ LRESULT CALLBACK DashApplication::WndProc(HWND hwnd, UINT message, WPARAM wParam
 				xPos = GET_X_LPARAM(lParam);
 				yPos = GET_Y_LPARAM(lParam);
 				result = 0;
-				wasHandled = pDemoApp->m_pImpl->m_inputManager.StartTouch(D2D1::Point2F((FLOAT)xPos, (FLOAT)yPos));
+				wasHandled = pWindow->m_inputManager.StartTouch(D2D1::Point2F((FLOAT)xPos, (FLOAT)yPos), (DWORD)GetMessageTime() / 1000.0);
 				break;
 
 			case WM_LBUTTONUP:
 				xPos = GET_X_LPARAM(lParam);
 				yPos = GET_Y_LPARAM(lParam);
 				result = 0;
-				wasHandled = pDemoApp->m_pImpl->m_inputManager.EndTouch(D2D1::Point2F((FLOAT)xPos, (FLOAT)yPos));
+				wasHandled = pWindow->m_inputManager.EndTouch(D2D1::Point2F((FLOAT)xPos, (FLOAT)yPos));
 				break;
 
 			case WM_MOUSEMOVE:
+				xPos = GET_X_LPARAM(lParam);
+				yPos = GET_Y_LPARAM(lParam);
+				result = 0;
 				if (wParam & MK_LBUTTON)
 				{
-					xPos = GET_X_LPARAM(lParam);
-					yPos = GET_Y_LPARAM(lParam);
-					result = 0;
-					wasHandled = pDemoApp->m_pImpl->m_inputManager.ContinueTouch(D2D1::Point2F((FLOAT)xPos, (FLOAT)yPos));
+					wasHandled = pWindow->m_inputManager.ContinueTouch(D2D1::Point2F((FLOAT)xPos, (FLOAT)yPos), (DWORD)GetMessageTime() / 1000.0);
+				}
+				else
+				{
+					// Ask for WM_MOUSELEAVE so hover ends when the pointer leaves
+					if (!pWindow->m_trackingMouse)
+					{
+						TRACKMOUSEEVENT tme = { sizeof(TRACKMOUSEEVENT), TME_LEAVE, hwnd, 0 };
+						pWindow->m_trackingMouse = TrackMouseEvent(&tme) != FALSE;
+					}
+					pWindow->m_inputManager.Hover(D2D1::Point2F((FLOAT)xPos, (FLOAT)yPos));
+					wasHandled = true;
 				}
 				break;
+
+			case WM_MOUSELEAVE:
+				pWindow->m_trackingMouse = false;
+				pWindow->m_inputManager.EndHover();
+				result = 0;
+				wasHandled = true;
+				break;
 			}
 		}
 
@@ -294,9 +665,14 @@ LRESULT CALLBACK DashApplication::WndProc(HWND hwnd, UINT message, WPARAM wParam
 
 void DashApplication::OnMainThread(std::function<void()> func)
 {
-    std::lock_guard<std::mutex> g(m_pImpl->m_mainThreadLock);
-    m_pImpl->m_mainThreadQueue.push_back(func);
-    Refresh();
+    {
+        std::lock_guard<std::mutex> g(m_pImpl->m_mainThreadLock);
+        m_pImpl->m_mainThreadQueue.push_back(func);
+    }
+    // Only windows whose trees the task touches get drawn
+    HWND hwnd = m_pImpl->m_taskWindow;
+    if (hwnd)
+        PostMessage(hwnd, c_runTasksMessage, 0, 0);
 }
 
 // Creates resources that are not bound to a particular device.
@@ -306,12 +682,30 @@ HRESULT DashApplication::CreateDeviceIndependentResources()
 {
 	HRESULT hr = S_OK;
 
-	// Create a Direct2D factory.
-	hr = D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &m_pImpl->m_pDirect2dFactory);
+	// Create a Direct2D factory. A render thread shares it with this one.
+	hr = D2D1CreateFactory(m_pImpl->m_threaded ? D2D1_FACTORY_TYPE_MULTI_THREADED : D2D1_FACTORY_TYPE_SINGLE_THREADED,
+		&m_pImpl->m_pDirect2dFactory);
 
 	return hr;
 }
 
+const FrameAllocations& DashApplication::GetFrameAllocations() const
+{
+    return m_pImpl->m_frameAllocations;
+}
+
+void DashApplication::SetStaticFrameCheck(bool check)
+{
+    m_pImpl->m_staticFrameCheck = check;
+}
+
+void DashApplication::SetQualityTarget(double seconds)
+{
+    m_pImpl->m_qualityTarget = seconds;
+    for (auto& window : m_pImpl->m_windows)
+        window->m_renderContext.SetQualityTarget(seconds);
+}
+
 void DashApplication::Refresh()
 {
     m_pImpl->m_ch.OnChange();
@@ -344,33 +738,10 @@ void DashApplication::Run(ApplicationCore* core)
 
 	RegisterClassEx(&wcex);
 
-	// Because the CreateWindow function takes its size in pixels,
-	// obtain the system DPI and use it to scale the window size.
-	FLOAT dpiX, dpiY;
-
-	// The factory returns the current system DPI. This is also the value it will use
-	// to create its own windows.
-	m_pImpl->m_pDirect2dFactory->GetDesktopDpi(&dpiX, &dpiY);
-
-	// Create the window.
-	m_pImpl->m_hwnd = CreateWindow(
-		L"DashApplication",
-		L"DashApplication",
-		WS_OVERLAPPEDWINDOW,
-		CW_USEDEFAULT,
-		CW_USEDEFAULT,
-		static_cast<UINT>(ceil(640.f * dpiX / 96.f)),
-		static_cast<UINT>(ceil(480.f * dpiY / 96.f)),
-		NULL,
-		NULL,
-		HINST_THISCOMPONENT,
-		this
-		);
-	CORt(m_pImpl->m_hwnd ? S_OK : E_FAIL);
-
-	m_pImpl->m_root->SetVisible(true);
-	ShowWindow(m_pImpl->m_hwnd, SW_SHOWNORMAL);
-	UpdateWindow(m_pImpl->m_hwnd);
+	// Windows added before Run open now, later ones as they are added
+	m_pImpl->m_started = true;
+	for (size_t i = 0; i < m_pImpl->m_windows.size(); ++i)
+		CreateAppWindow(*m_pImpl->m_windows[i]);
 
 	MSG msg;
 
@@ -379,20 +750,130 @@ void DashApplication::Run(ApplicationCore* core)
 		m_pImpl->m_animLibrary.Update();
 		TranslateMessage(&msg);
 		DispatchMessage(&msg);
+		m_pImpl->InvalidateChanged();
 		m_pImpl->m_animLibrary.Kick();
 	}
     m_pImpl->m_core = nullptr;
+    m_pImpl->m_started = false;
 }
 
 void DashApplication::SetRoot(Object* root)
 {
-	m_pImpl->m_root = root;
-	m_pImpl->m_inputManager.SetRoot(root);
+	m_pImpl->Primary().m_root = root;
+	m_pImpl->Primary().m_inputManager.SetRoot(root);
 }
 
 Object* DashApplication::GetRoot() const
 {
-    return m_pImpl->m_root;
+    return m_pImpl->Primary().m_root;
+}
+
+size_t DashApplication::AddWindow(Object* root, const std::wstring& title)
+{
+    m_pImpl->m_windows.emplace_back(new DashWindow(this, root, title));
+    m_pImpl->m_windows.back()->m_renderContext.SetQualityTarget(m_pImpl->m_qualityTarget);
+    if (m_pImpl->m_started)
+        CreateAppWindow(*m_pImpl->m_windows.back());
+    return m_pImpl->m_windows.size() - 1;
+}
+
+size_t DashApplication::GetWindowCount() const
+{
+    return m_pImpl->m_windows.size();
+}
+
+Object* DashApplication::GetRoot(size_t window) const
+{
+    return m_pImpl->m_windows[window]->m_root;
+}
+
+InputManager& DashApplication::GetInputManager(size_t window)
+{
+    return m_pImpl->m_windows[window]->m_inputManager;
+}
+
+WindowMemory DashApplication::GetWindowMemory(size_t window) const
+{
+    const DashWindow& w = *m_pImpl->m_windows[window];
+    WindowMemory memory = {};
+    if (w.m_hwnd)
+    {
+        // A 32-bit back buffer for the client area
+        RECT rc;
+        GetClientRect(w.m_hwnd, &rc);
+        memory.targetBytes = (size_t)(rc.right - rc.left) * (rc.bottom - rc.top) * 4;
+    }
+    memory.layerBytes = w.m_renderContext.GetLayerBytes();
+    return memory;
+}
+
+void DashApplication::SetFocus(Object* focus)
+{
+    m_pImpl->Primary().m_inputManager.SetFocus(focus);
+}
+
+Object* DashApplication::GetFocus() const
+{
+    return m_pImpl->Primary().m_inputManager.GetFocus();
+}
+
+void DashApplication::AddAccelerator(UINT key, UINT modifiers, std::function<void()> action)
+{
+    m_pImpl->Primary().m_inputManager.AddAccelerator(key, modifiers, std::move(action));
+}
+
+void DashApplication::RemoveAccelerator(UINT key, UINT modifiers)
+{
+    m_pImpl->Primary().m_inputManager.RemoveAccelerator(key, modifiers);
+}
+
+InputManager& DashApplication::GetInputManager()
+{
+    return m_pImpl->Primary().m_inputManager;
+}
+
+LatencyStats& DashApplication::GetInputLatency()
+{
+    return m_pImpl->m_inputLatency;
+}
+
+void DashApplication::Replay(const InputRecording& recording, double speed)
+{
+    m_pImpl->m_replayWindow = &m_pImpl->Primary();
+    m_pImpl->m_replay.reset(new InputReplay(recording, m_pImpl->m_replayWindow->m_inputManager, speed));
+    m_pImpl->m_replayStart = std::chrono::steady_clock::now();
+    m_pImpl->Invalidate(*m_pImpl->m_replayWindow);
+}
+
+void DashApplication::SetThreadedRendering(bool threaded)
+{
+    m_pImpl->m_threaded = threaded;
+    Object::SetCompositorAnimation(threaded ? c_compositorSeconds : 0);
+    if (!threaded)
+        m_pImpl->m_sharedFrames.Close();
+}
+
+bool DashApplication::GetThreadedRendering() const
+{
+    return m_pImpl->m_threaded;
+}
+
+bool DashApplication::ShareFrames(const std::string& name, size_t slotBytes)
+{
+    // Only recorded frames can be shared
+    if (!m_pImpl->m_threaded)
+        return false;
+    return m_pImpl->m_sharedFrames.Create(name, slotBytes);
+}
+
+const SharedFrameStats& DashApplication::GetSharedFrameStats() const
+{
+    return m_pImpl->m_sharedFrames.GetStats();
+}
+
+bool DashApplication::IsReplaying() const
+{
+    return m_pImpl->m_replay != nullptr;
 }
 
 }
@@ -3,21 +3,293 @@
 #include <dwrite.h>
 #include "utils.h"
 #include "AnimatedVar.h"
+#include "RenderContextImpl.h"
+#include "StackLayout.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 #include <atlbase.h>
 
 namespace tjm {
 namespace dash {
 
+struct InputManagerImpl;
+
+namespace {
+	// Bumped when children are added, removed or reordered, or an object is
+	// moved or resized, so cached hit paths know their overlap checks are stale
+	UINT64 s_treeGeneration = 1;
+
+	// Input managers with a hover path, told when a hovered object dies
+	std::vector<InputManagerImpl*> s_hoverTrackers;
+
+	// Drag predictions awaiting a score; a horizon of a few frames needs
+	// only a handful
+	const size_t c_maxPendingPredictions = 16;
+}
+
+// One level of the hover path. The origin is the object's local (0, 0) in
+// root coordinates.
+struct HoverEntry
+{
+	Object* m_object;
+	D2D1_POINT_2F m_origin;
+	bool m_overlapped;		// A sibling drawn above it shares some of its bounds
+};
+
+struct InputManagerImpl
+{
+	// Keyed by modifiers in the high word and the virtual key in the low
+	std::unordered_map<UINT, std::function<void()>> m_accelerators;
+
+	std::vector<HoverEntry> m_hoverPath;
+	std::vector<Object*> m_lastHoverPath;
+	UINT64 m_hoverGeneration;
+	HoverStats m_hoverStats;
+
+	// Last three drag samples, newest last, and the motion fitted to them
+	struct TouchSample
+	{
+		double m_time;
+		D2D1_POINT_2F m_point;
+	};
+	TouchSample m_touchSamples[3];
+	size_t m_numTouchSamples;
+	// Predictions waiting for the touch to reach the time they were made
+	// for, oldest first, with the sample that was real when each was made
+	struct PendingPrediction
+	{
+		double m_due;
+		D2D1_POINT_2F m_predicted;
+		D2D1_POINT_2F m_real;
+	};
+	PendingPrediction m_pending[c_maxPendingPredictions];
+	size_t m_firstPending;
+	size_t m_numPending;
+	D2D1_POINT_2F m_velocity;
+	D2D1_POINT_2F m_acceleration;
+	double m_predictionHorizon;
+	D2D1_POINT_2F m_predicted;
+	D2D1_POINT_2F m_previousPredicted;
+	TouchPredictionStats m_predictionStats;
+
+	InputRecording* m_recording;
+	std::chrono::steady_clock::time_point m_recordStart;
+	std::chrono::steady_clock::time_point m_arrival;
+	bool m_inputPending;
+	// The input being handled, and the root's state before it
+	std::chrono::steady_clock::time_point m_candidate;
+	unsigned m_rootVersion;
+	bool m_rootDirty;
+
+	InputManagerImpl();
+	~InputManagerImpl();
+
+	static UINT AcceleratorKey(UINT key, UINT modifiers) { return (modifiers << 16) | (key & 0xFFFF); }
+	static double Now() { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+
+	size_t ValidHoverLevels(const D2D1_POINT_2F& point);
+	void DescendHover(const D2D1_POINT_2F& point);
+	void Forget(Object* obj);
+	void NoteInput(Object* root, InputEventType type, const D2D1_POINT_2F& point, const KeyEvent* key);
+	void InputHandled(Object* root);
+	void StartPrediction(const D2D1_POINT_2F& point, double time);
+	void AddTouchSample(const D2D1_POINT_2F& point, double time);
+	void ScorePredictions(const TouchSample& previous, const D2D1_POINT_2F& point, double time);
+	D2D1_POINT_2F Extrapolate(double seconds) const;
+};
+
+InputManagerImpl::InputManagerImpl() :
+m_hoverGeneration(0),
+m_hoverStats(),
+m_numTouchSamples(0),
+m_firstPending(0),
+m_numPending(0),
+m_velocity(D2D1::Point2F(0, 0)),
+m_acceleration(D2D1::Point2F(0, 0)),
+m_predictionHorizon(0),
+m_predicted(D2D1::Point2F(0, 0)),
+m_previousPredicted(D2D1::Point2F(0, 0)),
+m_predictionStats(),
+m_recording(nullptr),
+m_inputPending(false),
+m_rootVersion(0),
+m_rootDirty(false)
+{
+	s_hoverTrackers.push_back(this);
+}
+
+InputManagerImpl::~InputManagerImpl()
+{
+	s_hoverTrackers.erase(std::remove(s_hoverTrackers.begin(), s_hoverTrackers.end(), this), s_hoverTrackers.end());
+}
+
+namespace {
+	// Notes an input call on the way in and whether it changed the tree on
+	// the way out
+	class InputScope
+	{
+	public:
+		InputScope(InputManagerImpl* impl, Object* root, InputEventType type, const D2D1_POINT_2F& point, const KeyEvent* key) :
+		m_impl(impl),
+		m_root(root)
+		{
+			impl->NoteInput(root, type, point, key);
+		}
+
+		~InputScope()
+		{
+			m_impl->InputHandled(m_root);
+		}
+
+	private:
+		InputScope(const InputScope&);
+		InputScope& operator=(const InputScope&);
+
+		InputManagerImpl* m_impl;
+		Object* m_root;
+	};
+}
+
+void InputManagerImpl::StartPrediction(const D2D1_POINT_2F& point, double time)
+{
+	m_touchSamples[0].m_time = time;
+	m_touchSamples[0].m_point = point;
+	m_numTouchSamples = 1;
+	m_numPending = 0;
+	m_velocity = m_acceleration = D2D1::Point2F(0, 0);
+	m_predicted = m_previousPredicted = point;
+}
+
+void InputManagerImpl::ScorePredictions(const TouchSample& previous, const D2D1_POINT_2F& point, double time)
+{
+	// Each prediction is checked against where the touch was at the time it
+	// was made for, between the two real samples either side of it
+	while(m_numPending > 0 && m_pending[m_firstPending].m_due <= time)
+	{
+		const PendingPrediction& pending = m_pending[m_firstPending];
+		double span = time - previous.m_time;
+		FLOAT t = span > 0 ? (FLOAT)((pending.m_due - previous.m_time) / span) : 1.0f;
+		t = t < 0 ? 0 : t;
+		D2D1_POINT_2F actual = D2D1::Point2F(previous.m_point.x + (point.x - previous.m_point.x) * t,
+			previous.m_point.y + (point.y - previous.m_point.y) * t);
+
+		double ex = pending.m_predicted.x - actual.x, ey = pending.m_predicted.y - actual.y;
+		double lx = pending.m_real.x - actual.x, ly = pending.m_real.y - actual.y;
+		double error = sqrt(ex * ex + ey * ey);
+		TouchPredictionStats& stats = m_predictionStats;
+		++stats.predictions;
+		stats.totalError += error;
+		stats.totalLag += sqrt(lx * lx + ly * ly);
+		if(error > stats.maxError)
+			stats.maxError = error;
+		if(stats.totalLag > 0)
+			stats.latencyReduction = m_predictionHorizon * (1.0 - stats.totalError / stats.totalLag);
+
+		m_firstPending = (m_firstPending + 1) % c_maxPendingPredictions;
+		--m_numPending;
+	}
+}
+
+void InputManagerImpl::AddTouchSample(const D2D1_POINT_2F& point, double time)
+{
+	TouchSample& newest = m_touchSamples[m_numTouchSamples - 1];
+	double dt = time - newest.m_time;
+	ScorePredictions(newest, point, time);
+
+	// Samples closer together than this say more about noise than motion
+	if(dt < 0.001)
+	{
+		newest.m_point = point;
+	}
+	else
+	{
+		if(m_numTouchSamples == 3)
+		{
+			m_touchSamples[0] = m_touchSamples[1];
+			m_touchSamples[1] = m_touchSamples[2];
+			--m_numTouchSamples;
+		}
+		m_touchSamples[m_numTouchSamples].m_time = time;
+		m_touchSamples[m_numTouchSamples].m_point = point;
+		++m_numTouchSamples;
+	}
+
+	// Finite differences over the last two intervals
+	const TouchSample& s2 = m_touchSamples[m_numTouchSamples - 1];
+	m_velocity = m_acceleration = D2D1::Point2F(0, 0);
+	if(m_numTouchSamples >= 2)
+	{
+		const TouchSample& s1 = m_touchSamples[m_numTouchSamples - 2];
+		double dt2 = s2.m_time - s1.m_time;
+		m_velocity = D2D1::Point2F((FLOAT)((s2.m_point.x - s1.m_point.x) / dt2), (FLOAT)((s2.m_point.y - s1.m_point.y) / dt2));
+		if(m_numTouchSamples == 3)
+		{
+			const TouchSample& s0 = m_touchSamples[0];
+			double dt1 = s1.m_time - s0.m_time;
+			double vx1 = (s1.m_point.x - s0.m_point.x) / dt1;
+			double vy1 = (s1.m_point.y - s0.m_point.y) / dt1;
+			double span = (dt1 + dt2) / 2;
+			m_acceleration = D2D1::Point2F((FLOAT)((m_velocity.x - vx1) / span), (FLOAT)((m_velocity.y - vy1) / span));
+		}
+	}
+
+	m_previousPredicted = m_predicted;
+	m_predicted = m_predictionHorizon > 0 ? Extrapolate(m_predictionHorizon) : point;
+
+	if(m_predictionHorizon > 0 && m_numTouchSamples > 1)
+	{
+		// A full queue drops its oldest guess unscored
+		if(m_numPending == c_maxPendingPredictions)
+		{
+			m_firstPending = (m_firstPending + 1) % c_maxPendingPredictions;
+			--m_numPending;
+		}
+		PendingPrediction& pending = m_pending[(m_firstPending + m_numPending) % c_maxPendingPredictions];
+		pending.m_due = time + m_predictionHorizon;
+		pending.m_predicted = m_predicted;
+		pending.m_real = point;
+		++m_numPending;
+	}
+}
+
+D2D1_POINT_2F InputManagerImpl::Extrapolate(double seconds) const
+{
+	const TouchSample& newest = m_touchSamples[m_numTouchSamples - 1];
+	double axis[2] = { m_velocity.x, m_velocity.y };
+	double accel[2] = { m_acceleration.x, m_acceleration.y };
+	double out[2];
+	for(int i = 0; i < 2; ++i)
+	{
+		// Acceleration may slow the guess down but never turn it around,
+		// which is where extrapolation overshoots worst
+		double move = axis[i] * seconds;
+		double bend = 0.5 * accel[i] * seconds * seconds;
+		if(move * bend < 0 && fabs(bend) > fabs(move))
+			bend = -move;
+		out[i] = move + bend;
+	}
+	return D2D1::Point2F(newest.m_point.x + (FLOAT)out[0], newest.m_point.y + (FLOAT)out[1]);
+}
+
 InputManager::InputManager() :
-m_root(nullptr)
+m_root(nullptr),
+m_focus(nullptr),
+m_pImpl(new InputManagerImpl)
 {
 	m_info.owner = nullptr;
 }
 
+InputManager::~InputManager()
+{
+	delete m_pImpl;
+}
+
 void InputManager::SetRoot(Object* root)
 {
 	m_root = root;
@@ -28,37 +300,77 @@ void InputManager::SetFocus(Object* focus)
     m_focus = focus;
 }
 
+Object* InputManager::GetFocus() const
+{
+	return m_focus;
+}
+
+bool InputManager::OnKeyEvent(const KeyEvent& e)
+{
+	InputScope scope(m_pImpl, m_root, InputEventType::Key, D2D1::Point2F(0, 0), &e);
+
+	// Only the focus chain is visited, so the cost follows its depth rather
+	// than the size of the tree
+	Object* target = m_focus ? m_focus : m_root;
+	for (; target; target = target->GetParent())
+	{
+		if (target->Key(e))
+			return true;
+	}
+
+	if (e.type != KeyEventType::Down)
+		return false;
+
+	auto accelerator = m_pImpl->m_accelerators.find(InputManagerImpl::AcceleratorKey(e.key, e.modifiers));
+	if (accelerator == m_pImpl->m_accelerators.end())
+		return false;
+
+	accelerator->second();
+	return true;
+}
+
 void InputManager::OnKey(char key)
 {
-    bool handled = false;
+	KeyEvent e = { KeyEventType::Char, (UINT)(unsigned char)key, 0, false };
+	OnKeyEvent(e);
+}
 
-    if (m_focus)
-        handled = m_focus->Key(key);
+void InputManager::AddAccelerator(UINT key, UINT modifiers, std::function<void()> action)
+{
+	m_pImpl->m_accelerators[InputManagerImpl::AcceleratorKey(key, modifiers)] = std::move(action);
+}
 
-    if (!handled)
-        handled = m_root->Key(key);
+void InputManager::RemoveAccelerator(UINT key, UINT modifiers)
+{
+	m_pImpl->m_accelerators.erase(InputManagerImpl::AcceleratorKey(key, modifiers));
 }
 
-bool InputManager::StartTouch(const D2D1_POINT_2F& point)
+bool InputManager::StartTouch(const D2D1_POINT_2F& point, double time)
 {
+	InputScope scope(m_pImpl, m_root, InputEventType::TouchStart, point, nullptr);
+
     if (m_focus)
         m_info.owner = m_focus->Touch(point);
 
     if (!m_info.owner)
 	    m_info.owner = m_root->Touch(point);
 	m_info.originalTouch = point;
+	m_info.previousTouch = point;
 	m_info.currentTouch = point;
+	m_pImpl->StartPrediction(point, time >= 0 ? time : InputManagerImpl::Now());
 
 	return m_info.owner != nullptr;
 }
 
-bool InputManager::ContinueTouch(const D2D1_POINT_2F& point)
+bool InputManager::ContinueTouch(const D2D1_POINT_2F& point, double time)
 {
+	InputScope scope(m_pImpl, m_root, InputEventType::TouchMove, point, nullptr);
 	if(!m_info.owner)
 		return false;
 
 	m_info.previousTouch = m_info.currentTouch;
 	m_info.currentTouch = point;
+	m_pImpl->AddTouchSample(point, time >= 0 ? time : InputManagerImpl::Now());
 	
 	TouchInfo ownerLocal = TranslateToObjLocal(m_info.owner);
 	if(!m_info.owner->TouchContinue(ownerLocal))
@@ -72,6 +384,7 @@ bool InputManager::ContinueTouch(const D2D1_POINT_2F& point)
 				m_info.owner = potentialOwner;
 				return true;
 			}
+			potentialOwner = potentialOwner->GetParent();
 		}
 		m_info.owner = nullptr;
 		return false;
@@ -79,17 +392,154 @@ bool InputManager::ContinueTouch(const D2D1_POINT_2F& point)
 	return true;
 }
 
-bool InputManager::EndTouch(const D2D1_POINT_2F&)
+bool InputManager::EndTouch(const D2D1_POINT_2F& point)
 {
+	InputScope scope(m_pImpl, m_root, InputEventType::TouchEnd, point, nullptr);
 	if(!m_info.owner)
 		return false;
 
+	// The last guess gets corrected to the real position
+	m_pImpl->m_previousPredicted = m_pImpl->m_predicted;
+	m_pImpl->m_predicted = m_info.currentTouch;
 	TouchInfo ownerLocal = TranslateToObjLocal(m_info.owner);
 	m_info.owner->TouchFinish(ownerLocal);
 	m_info.owner = nullptr;
 	return true;
 }
 
+void InputManager::SetPredictionHorizon(double seconds)
+{
+	m_pImpl->m_predictionHorizon = seconds > 0 ? seconds : 0;
+}
+
+double InputManager::GetPredictionHorizon() const
+{
+	return m_pImpl->m_predictionHorizon;
+}
+
+const TouchPredictionStats& InputManager::GetPredictionStats() const
+{
+	return m_pImpl->m_predictionStats;
+}
+
+bool InputManager::Hover(const D2D1_POINT_2F& point)
+{
+	InputScope scope(m_pImpl, m_root, InputEventType::Hover, point, nullptr);
+	if(!m_root)
+		return false;
+
+	std::vector<HoverEntry>& path = m_pImpl->m_hoverPath;
+	std::vector<Object*>& last = m_pImpl->m_lastHoverPath;
+	++m_pImpl->m_hoverStats.moves;
+
+	last.clear();
+	for(auto& entry : path)
+		last.push_back(entry.m_object);
+
+	// Keep what is still under the point, then walk down from there. A move
+	// within the cached leaf only looks at the leaf's own children.
+	size_t valid = 0;
+	if(!path.empty() && path[0].m_object == m_root && m_pImpl->m_hoverGeneration == s_treeGeneration)
+		valid = m_pImpl->ValidHoverLevels(point);
+	if(valid == 0)
+	{
+		path.clear();
+		HoverEntry root = { m_root, D2D1::Point2F(0, 0), false };
+		path.push_back(root);
+		valid = 1;
+	}
+	path.resize(valid);
+	if(valid == last.size())
+		++m_pImpl->m_hoverStats.cachedMoves;
+
+	m_pImpl->DescendHover(point);
+	m_pImpl->m_hoverGeneration = s_treeGeneration;
+
+	size_t common = 0;
+	while(common < last.size() && common < path.size() && last[common] == path[common].m_object)
+		++common;
+	for(size_t i = last.size(); i-- > common;)
+		last[i]->HoverLeave();
+	for(size_t i = common; i < path.size(); ++i)
+		path[i].m_object->HoverEnter();
+
+	for(size_t i = path.size(); i-- > 0;)
+	{
+		const D2D1_POINT_2F& origin = path[i].m_origin;
+		if(path[i].m_object->Hover(D2D1::Point2F(point.x - origin.x, point.y - origin.y)))
+			return true;
+	}
+	return false;
+}
+
+void InputManager::EndHover()
+{
+	InputScope scope(m_pImpl, m_root, InputEventType::HoverEnd, D2D1::Point2F(0, 0), nullptr);
+	std::vector<HoverEntry>& path = m_pImpl->m_hoverPath;
+	while(!path.empty())
+	{
+		Object* obj = path.back().m_object;
+		path.pop_back();
+		obj->HoverLeave();
+	}
+}
+
+Object* InputManager::GetHovered() const
+{
+	return m_pImpl->m_hoverPath.empty() ? nullptr : m_pImpl->m_hoverPath.back().m_object;
+}
+
+const HoverStats& InputManager::GetHoverStats() const
+{
+	return m_pImpl->m_hoverStats;
+}
+
+bool InputManager::Dispatch(const InputEvent& e)
+{
+	switch(e.type)
+	{
+	case InputEventType::TouchStart:
+		return StartTouch(e.point, e.time);
+	case InputEventType::TouchMove:
+		return ContinueTouch(e.point, e.time);
+	case InputEventType::TouchEnd:
+		return EndTouch(e.point);
+	case InputEventType::Hover:
+		return Hover(e.point);
+	case InputEventType::HoverEnd:
+		EndHover();
+		return true;
+	case InputEventType::Key:
+		return OnKeyEvent(e.key);
+	}
+	return false;
+}
+
+void InputManager::StartRecording(InputRecording* recording)
+{
+	m_pImpl->m_recording = recording;
+	m_pImpl->m_recordStart = std::chrono::steady_clock::now();
+}
+
+void InputManager::StopRecording()
+{
+	m_pImpl->m_recording = nullptr;
+}
+
+bool InputManager::HasPendingInput() const
+{
+	return m_pImpl->m_inputPending;
+}
+
+double InputManager::InputPresented()
+{
+	if(!m_pImpl->m_inputPending)
+		return 0;
+
+	m_pImpl->m_inputPending = false;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_pImpl->m_arrival).count();
+}
+
 TouchInfo InputManager::TranslateToObjLocal(Object* obj)
 {
 	TouchInfo ti;
@@ -97,13 +547,85 @@ TouchInfo InputManager::TranslateToObjLocal(Object* obj)
 	ti.currentTouch = obj->WorldToLocal(m_info.currentTouch);
 	ti.originalTouch = obj->WorldToLocal(m_info.originalTouch);
 	ti.previousTouch = obj->WorldToLocal(m_info.previousTouch);
+	if(obj->GetTouchPrediction())
+	{
+		ti.previousPredictedTouch = obj->WorldToLocal(m_pImpl->m_previousPredicted);
+		ti.predictedTouch = obj->WorldToLocal(m_pImpl->m_predicted);
+	}
+	else
+	{
+		ti.previousPredictedTouch = ti.previousTouch;
+		ti.predictedTouch = ti.currentTouch;
+	}
 
 	return ti;
 }
 
+namespace {
+	// Auto layers stay cached for this many frames after the last change in
+	// opacity, translation or clipping.
+	const int c_autoLayerFrames = 30;
+
+	// Fainter objects aren't drawn at all at interactive quality
+	const DOUBLE c_interactiveMinOpacity = 0.05;
+
+	// Occluders tracked per level, inherited ones included. Keeps the
+	// occlusion tests linear in the number of children.
+	const size_t c_maxOccluders = 16;
+
+	std::atomic<UINT64> s_nextObjectId(1);
+
+	// Nesting of Layout calls; the outermost one owns the pass's storyboard
+	int s_layoutDepth = 0;
+	size_t s_animationsStarted = 0;
+
+	// Seconds for animations run by the compositor; zero leaves them to AnimatedVar
+	double s_compositorDuration = 0;
+
+	struct LayoutPassScope
+	{
+		LayoutPassScope() { ++s_layoutDepth; }
+		~LayoutPassScope() { --s_layoutDepth; }
+	};
+
+	bool IsVarAnimating(const tjm::animation::AnimatedVar& var)
+	{
+		return (double)var != var.GetFinalValue();
+	}
+
+	bool SameRect(const D2D1_RECT_F& a, const D2D1_RECT_F& b)
+	{
+		return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+	}
+
+	bool IsEmpty(const D2D1_RECT_F& rect)
+	{
+		return rect.right <= rect.left || rect.bottom <= rect.top;
+	}
+
+	bool Contains(const D2D1_RECT_F& outer, const D2D1_RECT_F& inner)
+	{
+		return inner.left >= outer.left && inner.top >= outer.top &&
+			inner.right <= outer.right && inner.bottom <= outer.bottom;
+	}
+
+	D2D1_RECT_F Offset(const D2D1_RECT_F& rect, FLOAT x, FLOAT y)
+	{
+		return D2D1::RectF(rect.left + x, rect.top + y, rect.right + x, rect.bottom + y);
+	}
+
+	// Unlike Intersects, rects that only share an edge don't overlap
+	bool Overlaps(const D2D1_RECT_F& a, const D2D1_RECT_F& b)
+	{
+		return a.left < b.right && b.left < a.right && a.top < b.bottom && b.top < a.bottom;
+	}
+}
+
 struct ObjectImpl
 {
 	Object* m_parent;
+	UINT64 m_id;
+	unsigned m_version;
 
 	tjm::animation::AnimatedVar m_width;
 	tjm::animation::AnimatedVar m_height;
@@ -129,12 +651,76 @@ struct ObjectImpl
 	bool m_dirtyChild;
 	std::vector<Object*> m_children;
 
+	LayerCaching m_caching;
+	int m_autoLayerFrames;
+	double m_lastXTrans;
+	double m_lastYTrans;
+	D2D1_RECT_F m_lastClip;
+	bool m_lastHasClip;
+	D2D1_SIZE_F m_layerStretch;
+
+	// Results of the parent's occlusion pre-pass
+	bool m_occluded;
+	size_t m_occludersAbove;
+
+	RenderContext* m_renderContext;
+	bool m_batched;
+
+	bool m_hovered;
+	bool m_touchPrediction;
+
+	// A move or fade handed to the compositor, relative to where the object
+	// has already been put
+	bool m_composited;
+	CompositorAnimation m_composite;
+
+	// Owns a drag in progress
+	bool m_touching;
+
 	ObjectImpl();
+	void SetPair(tjm::animation::AnimatedVar& a, double aValue, tjm::animation::AnimatedVar& b, double bValue, bool instant);
+	bool SetVar(tjm::animation::AnimatedVar& var, double value);
 	void TrustZ();
+	bool IsAnimating() const;
+	bool WantsLayer();
+	D2D1_RECT_F LayerExtent() const;
+
+	// Where the object is showing, compositor animation included
+	D2D1_POINT_2F ShownPlacement(std::chrono::steady_clock::time_point now) const;
+	FLOAT ShownOpacity(std::chrono::steady_clock::time_point now) const;
+	void HandOff(std::chrono::steady_clock::time_point now, const D2D1_POINT_2F& shown, FLOAT shownOpacity);
+};
+
+// Hands whatever a setter starts animating over to the compositor, which
+// animates from where the object was showing before the change
+struct HandOffScope
+{
+	ObjectImpl* m_impl;
+	D2D1_POINT_2F m_shown;
+	FLOAT m_shownOpacity;
+
+	HandOffScope(ObjectImpl* impl) :
+	m_impl(s_compositorDuration > 0 ? impl : nullptr)
+	{
+		if(m_impl)
+		{
+			auto now = std::chrono::steady_clock::now();
+			m_shown = m_impl->ShownPlacement(now);
+			m_shownOpacity = m_impl->ShownOpacity(now);
+		}
+	}
+
+	~HandOffScope()
+	{
+		if(m_impl)
+			m_impl->HandOff(std::chrono::steady_clock::now(), m_shown, m_shownOpacity);
+	}
 };
 
 ObjectImpl::ObjectImpl() :
 m_parent(nullptr),
+m_id(s_nextObjectId++),
+m_version(0),
 m_leftMargin(0),
 m_topMargin(0),
 m_rightMargin(0),
@@ -145,82 +731,329 @@ m_maxHeight(0),
 m_zTrusted(false),
 m_dirtyLayout(true),
 m_dirtyChild(false),
-m_hasClippingRect(false)
-{
+m_hasClippingRect(false),
+m_caching(LayerCaching::None),
+m_autoLayerFrames(0),
+m_lastXTrans(0),
+m_lastYTrans(0),
+m_lastHasClip(false),
+m_layerStretch(D2D1::SizeF(0, 0)),
+m_occluded(false),
+m_occludersAbove(0),
+m_renderContext(nullptr),
+m_batched(false),
+m_hovered(false),
+m_touchPrediction(false),
+m_composited(false),
+m_touching(false)
+{
+}
+
+void InputManagerImpl::NoteInput(Object* root, InputEventType type, const D2D1_POINT_2F& point, const KeyEvent* key)
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	m_candidate = now;
+	m_rootVersion = root ? root->m_pImpl->m_version : 0;
+	m_rootDirty = root && root->NeedsLayout();
+
+	if(!m_recording)
+		return;
+
+	InputEvent e = {};
+	e.type = type;
+	e.time = std::chrono::duration<double>(now - m_recordStart).count();
+	e.point = point;
+	if(key)
+		e.key = *key;
+	m_recording->Append(e);
 }
 
-void ObjectImpl::TrustZ()
+void InputManagerImpl::InputHandled(Object* root)
 {
-	if(!m_zTrusted)
-	{	
-		std::sort(m_children.begin(), m_children.end(), [](const Object* left, const Object* right) {
-			return left->GetZOrder() < right->GetZOrder();
-		});
-		m_zTrusted = true;
+	// Only input that changed something waits on a frame. A hover over
+	// nothing that reacts, or a key nobody takes, isn't latency.
+	if(m_inputPending || !root)
+		return;
+	if(root->m_pImpl->m_version != m_rootVersion || (!m_rootDirty && root->NeedsLayout()))
+	{
+		m_arrival = m_candidate;
+		m_inputPending = true;
 	}
 }
 
-Object::Object() :
-m_pImpl(new ObjectImpl)
+size_t InputManagerImpl::ValidHoverLevels(const D2D1_POINT_2F& point)
 {
+	// Levels are rechecked against live positions, so animation and
+	// scrolling since the last move are accounted for
+	for(size_t i = 1; i < m_hoverPath.size(); ++i)
+	{
+		HoverEntry& entry = m_hoverPath[i];
+		const HoverEntry& parentEntry = m_hoverPath[i - 1];
+		ObjectImpl* parent = parentEntry.m_object->m_pImpl;
+		Object* obj = entry.m_object;
+		if(entry.m_overlapped || obj->GetParent() != parentEntry.m_object || !obj->GetVisible())
+			return i;
+
+		D2D1_POINT_2F local = D2D1::Point2F(point.x - parentEntry.m_origin.x, point.y - parentEntry.m_origin.y);
+		if(parent->m_hasClippingRect && !Intersects(parent->m_clippingRect, local))
+			return i;
+
+		FLOAT xTrans = (FLOAT)parent->m_xTrans;
+		FLOAT yTrans = (FLOAT)parent->m_yTrans;
+		++m_hoverStats.objectsTested;
+		if(!Intersects(obj, D2D1::Point2F(local.x - xTrans, local.y - yTrans)))
+			return i;
+
+		D2D1_POINT_2F pos = obj->GetPosition();
+		entry.m_origin = D2D1::Point2F(parentEntry.m_origin.x + xTrans + pos.x, parentEntry.m_origin.y + yTrans + pos.y);
+	}
+	return m_hoverPath.size();
 }
 
-Object* Object::GetParent() const
+void InputManagerImpl::DescendHover(const D2D1_POINT_2F& point)
 {
-	return m_pImpl->m_parent;
+	for(;;)
+	{
+		HoverEntry parent = m_hoverPath.back();
+		bool overlapped = false;
+		Object* child = parent.m_object->HoverChild(D2D1::Point2F(point.x - parent.m_origin.x, point.y - parent.m_origin.y),
+			overlapped, m_hoverStats.objectsTested);
+		if(!child)
+			return;
+
+		D2D1_POINT_2F pos = child->GetPosition();
+		HoverEntry entry = { child,
+			D2D1::Point2F(parent.m_origin.x + (FLOAT)parent.m_object->m_pImpl->m_xTrans + pos.x,
+				parent.m_origin.y + (FLOAT)parent.m_object->m_pImpl->m_yTrans + pos.y),
+			overlapped };
+		m_hoverPath.push_back(entry);
+	}
 }
 
-Object* Object::SetParent(Object* parent)
+void InputManagerImpl::Forget(Object* obj)
 {
-	Object* oldParent = GetParent();
-	m_pImpl->m_parent = parent;
-	return oldParent;
-}
+	size_t i = 0;
+	while(i < m_hoverPath.size() && m_hoverPath[i].m_object != obj)
+		++i;
+	if(i == m_hoverPath.size())
+		return;
 
-void Object::DirtyParentLayout()
-{
-	if(GetParent())
+	// Anything below it is still alive, or it would have been forgotten first
+	while(m_hoverPath.size() > i + 1)
 	{
-		GetParent()->DirtyLayout();
+		Object* below = m_hoverPath.back().m_object;
+		m_hoverPath.pop_back();
+		below->HoverLeave();
 	}
+	m_hoverPath.pop_back();
 }
 
-void Object::SetMargins(FLOAT left, FLOAT top, FLOAT right, FLOAT bottom)
+void ObjectImpl::SetPair(tjm::animation::AnimatedVar& a, double aValue, tjm::animation::AnimatedVar& b, double bValue, bool instant)
 {
-	m_pImpl->m_leftMargin = left;
-	m_pImpl->m_topMargin = top;
-	m_pImpl->m_rightMargin = right;
-	m_pImpl->m_bottomMargin = bottom;
-	DirtyParentLayout();
+	// Callers have already checked something changed. Inside a layout pass
+	// the change joins the pass's storyboard rather than starting its own.
+	s_animationsStarted += (a.GetFinalValue() != aValue) + (b.GetFinalValue() != bValue);
+	if(instant)
+	{
+		tjm::animation::InstantChange ic(a, true);
+		tjm::animation::InstantChange ic2(b, true);
+		a = aValue;
+		b = bValue;
+	}
+	else if(s_layoutDepth > 0)
+	{
+		a = aValue;
+		b = bValue;
+	}
+	else
+	{
+		tjm::animation::StoryBoard sb;
+		a = aValue;
+		b = bValue;
+	}
 }
 
-void Object::SetMarginLeft(FLOAT margin)
+bool ObjectImpl::SetVar(tjm::animation::AnimatedVar& var, double value)
 {
-	m_pImpl->m_leftMargin = margin;
-	DirtyParentLayout();
-}
+	if(var.GetFinalValue() == value)
+		return false;
 
-void Object::SetMarginTop(FLOAT margin)
-{
-	m_pImpl->m_topMargin = margin;
-	DirtyParentLayout();
+	++s_animationsStarted;
+	var = value;
+	return true;
 }
 
-void Object::SetMarginRight(FLOAT margin)
+void ObjectImpl::TrustZ()
 {
-	m_pImpl->m_rightMargin = margin;
-	DirtyParentLayout();
+	if(!m_zTrusted)
+	{	
+		std::sort(m_children.begin(), m_children.end(), [](const Object* left, const Object* right) {
+			return left->GetZOrder() < right->GetZOrder();
+		});
+		m_zTrusted = true;
+	}
 }
 
-void Object::SetMarginBottom(FLOAT margin)
+bool ObjectImpl::IsAnimating() const
 {
-	m_pImpl->m_bottomMargin = margin;
-	DirtyParentLayout();
+	return IsVarAnimating(m_x) || IsVarAnimating(m_y) ||
+		IsVarAnimating(m_width) || IsVarAnimating(m_height) ||
+		IsVarAnimating(m_opacity) ||
+		IsVarAnimating(m_xTrans) || IsVarAnimating(m_yTrans);
 }
 
-void Object::DirtyParentZ()
+bool ObjectImpl::WantsLayer()
 {
-	if(GetParent())
+	if(m_caching != LayerCaching::Auto)
+		return m_caching == LayerCaching::Always;
+
+	// Auto: a layer only pays off while the object is being recomposited
+	// without its content changing, i.e. fading, panning or being clipped.
+	bool clipChanged = m_hasClippingRect != m_lastHasClip ||
+		(m_hasClippingRect && !SameRect(m_clippingRect, m_lastClip));
+	if(clipChanged || (double)m_xTrans != m_lastXTrans || (double)m_yTrans != m_lastYTrans ||
+		IsVarAnimating(m_opacity) || (double)m_opacity < 1.0)
+	{
+		m_autoLayerFrames = c_autoLayerFrames;
+	}
+
+	m_lastXTrans = m_xTrans;
+	m_lastYTrans = m_yTrans;
+	m_lastClip = m_clippingRect;
+	m_lastHasClip = m_hasClippingRect;
+
+	if(m_autoLayerFrames > 0)
+	{
+		--m_autoLayerFrames;
+		return true;
+	}
+	return false;
+}
+
+D2D1_RECT_F ObjectImpl::LayerExtent() const
+{
+	D2D1_RECT_F extent = D2D1::RectF(0, 0, (FLOAT)m_width, (FLOAT)m_height);
+	for(auto& obj : m_children)
+	{
+		D2D1_RECT_F child = obj->GetBoundingBox();
+		extent.left = min(extent.left, child.left);
+		extent.top = min(extent.top, child.top);
+		extent.right = max(extent.right, child.right);
+		extent.bottom = max(extent.bottom, child.bottom);
+	}
+
+	// Snap to whole DIPs so the composited bitmap lands on the same pixels
+	extent.left = floor(extent.left);
+	extent.top = floor(extent.top);
+	extent.right = ceil(extent.right);
+	extent.bottom = ceil(extent.bottom);
+	return extent;
+}
+
+D2D1_POINT_2F ObjectImpl::ShownPlacement(std::chrono::steady_clock::time_point now) const
+{
+	D2D1_POINT_2F offset = m_composited ? m_composite.Offset(now) : D2D1::Point2F(0, 0);
+	return D2D1::Point2F((FLOAT)((double)m_x + m_xTrans) + offset.x, (FLOAT)((double)m_y + m_yTrans) + offset.y);
+}
+
+FLOAT ObjectImpl::ShownOpacity(std::chrono::steady_clock::time_point now) const
+{
+	return m_composited ? m_composite.Opacity(now) : (FLOAT)(double)m_opacity;
+}
+
+void ObjectImpl::HandOff(std::chrono::steady_clock::time_point now, const D2D1_POINT_2F& shown, FLOAT shownOpacity)
+{
+	// Changes made instantly, or with the compositor off, stay as they are
+	if(s_compositorDuration <= 0 ||
+		!(IsVarAnimating(m_x) || IsVarAnimating(m_y) || IsVarAnimating(m_xTrans) || IsVarAnimating(m_yTrans) || IsVarAnimating(m_opacity)))
+	{
+		return;
+	}
+
+	{
+		tjm::animation::InstantChange ix(m_x, true);
+		tjm::animation::InstantChange iy(m_y, true);
+		tjm::animation::InstantChange ixt(m_xTrans, true);
+		tjm::animation::InstantChange iyt(m_yTrans, true);
+		tjm::animation::InstantChange io(m_opacity, true);
+		m_x = m_x.GetFinalValue();
+		m_y = m_y.GetFinalValue();
+		m_xTrans = m_xTrans.GetFinalValue();
+		m_yTrans = m_yTrans.GetFinalValue();
+		m_opacity = m_opacity.GetFinalValue();
+	}
+
+	m_composited = false;
+	D2D1_POINT_2F placed = ShownPlacement(now);
+	m_composite.m_start = now;
+	m_composite.m_duration = s_compositorDuration;
+	m_composite.m_fromOffset = D2D1::Point2F(shown.x - placed.x, shown.y - placed.y);
+	m_composite.m_fromOpacity = shownOpacity;
+	m_composite.m_toOpacity = (FLOAT)(double)m_opacity;
+	m_composited = true;
+}
+
+Object::Object() :
+m_pImpl(new ObjectImpl)
+{
+}
+
+Object* Object::GetParent() const
+{
+	return m_pImpl->m_parent;
+}
+
+Object* Object::SetParent(Object* parent)
+{
+	Object* oldParent = GetParent();
+	m_pImpl->m_parent = parent;
+	return oldParent;
+}
+
+void Object::DirtyParentLayout()
+{
+	if(GetParent())
+	{
+		GetParent()->DirtyLayout();
+	}
+}
+
+void Object::SetMargins(FLOAT left, FLOAT top, FLOAT right, FLOAT bottom)
+{
+	m_pImpl->m_leftMargin = left;
+	m_pImpl->m_topMargin = top;
+	m_pImpl->m_rightMargin = right;
+	m_pImpl->m_bottomMargin = bottom;
+	DirtyParentLayout();
+}
+
+void Object::SetMarginLeft(FLOAT margin)
+{
+	m_pImpl->m_leftMargin = margin;
+	DirtyParentLayout();
+}
+
+void Object::SetMarginTop(FLOAT margin)
+{
+	m_pImpl->m_topMargin = margin;
+	DirtyParentLayout();
+}
+
+void Object::SetMarginRight(FLOAT margin)
+{
+	m_pImpl->m_rightMargin = margin;
+	DirtyParentLayout();
+}
+
+void Object::SetMarginBottom(FLOAT margin)
+{
+	m_pImpl->m_bottomMargin = margin;
+	DirtyParentLayout();
+}
+
+void Object::DirtyParentZ()
+{
+	if(GetParent())
 	{
 		GetParent()->DirtyZ();
 	}
@@ -256,6 +1089,11 @@ FLOAT Object::GetMarginBottom() const
 
 Object::~Object()
 {
+	if(m_pImpl->m_hovered)
+	{
+		for(auto tracker : s_hoverTrackers)
+			tracker->Forget(this);
+	}
 	delete m_pImpl;
 }
 
@@ -287,14 +1125,15 @@ void Object::DirtyZ()
 
 void Object::SetSize(D2D1_SIZE_F newSize)
 {
-	if (m_pImpl->m_height != newSize.height || m_pImpl->m_width != newSize.width)
+	// Compared against where the size is heading, so re-requesting the
+	// target of a running animation costs nothing
+	if (m_pImpl->m_height.GetFinalValue() != newSize.height || m_pImpl->m_width.GetFinalValue() != newSize.width)
 	{
-		tjm::animation::StoryBoard b;
-		tjm::animation::InstantChange ic(m_pImpl->m_height, !GetVisible());
-		tjm::animation::InstantChange ic2(m_pImpl->m_width, !GetVisible());
-		m_pImpl->m_height = newSize.height;
-		m_pImpl->m_width = newSize.width;
+		// A new size can change which siblings overlap a cached hover path
+		++s_treeGeneration;
+		m_pImpl->SetPair(m_pImpl->m_height, newSize.height, m_pImpl->m_width, newSize.width, !GetVisible());
 		DirtyLayout();
+		Invalidate();
 	}
 }
 
@@ -308,219 +1147,781 @@ DOUBLE Object::GetOpacity() const
 	return m_pImpl->m_opacity;
 }
 
-void Object::SetVisible(bool visible)
-{
-	if(GetVisible() != visible)
+void Object::SetVisible(bool visible)
+{
+	if(GetVisible() != visible)
+	{
+		HandOffScope handOff(m_pImpl);
+		m_pImpl->SetVar(m_pImpl->m_opacity, visible ? 1.0 : 0.0);
+		InvalidateParent();
+		OnVisibilityChange(visible);
+	}
+}
+
+void Object::SetOpacity(DOUBLE opacity)
+{
+	bool oldVisibility = GetVisible();
+
+	{
+		HandOffScope handOff(m_pImpl);
+		if(!m_pImpl->SetVar(m_pImpl->m_opacity, opacity))
+			return;
+	}
+	InvalidateParent();
+
+	if(GetVisible() != oldVisibility)
+	{
+		OnVisibilityChange(GetVisible());
+	}
+}
+
+size_t Object::NumChildren() const
+{
+	return m_pImpl->m_children.size();
+}
+
+Object* Object::GetChild(size_t i)
+{
+	return m_pImpl->m_children[i];
+}
+
+const Object* Object::GetChild(size_t i) const
+{
+	return m_pImpl->m_children[i];
+}
+
+void Object::AddChild(Object* child)
+{
+	child->SetParent(this);
+	m_pImpl->m_children.push_back(child);
+	++s_treeGeneration;
+	child->DirtyLayout();
+	DirtyLayout();
+	DirtyZ();
+	Invalidate();
+}
+
+void Object::InsertChild(Object * child, size_t i)
+{
+    child->SetParent(this);
+    m_pImpl->m_children.insert(m_pImpl->m_children.begin()+i, child);
+    ++s_treeGeneration;
+    child->DirtyLayout();
+    DirtyLayout();
+    DirtyZ();
+    Invalidate();
+}
+
+void Object::RemoveChild(Object* child)
+{
+	if(child)
+	{
+		child->SetParent(nullptr);
+		std::vector<Object*>& v = m_pImpl->m_children;
+		v.erase(std::remove(v.begin(), v.end(), child), v.end());
+		++s_treeGeneration;
+		DirtyLayout();
+		Invalidate();
+	}
+}
+	
+D2D1_SIZE_F Object::GetSize() const 
+{ 
+	return D2D1::SizeF((FLOAT)m_pImpl->m_width, (FLOAT)m_pImpl->m_height); 
+}
+
+D2D1_SIZE_F Object::GetFinalSize() const 
+{ 
+	return D2D1::SizeF((FLOAT)m_pImpl->m_width.GetFinalValue(), (FLOAT)m_pImpl->m_height.GetFinalValue()); 
+}
+
+void Object::SetPosition(D2D1_POINT_2F newPos)
+{
+	if(m_pImpl->m_x.GetFinalValue() == newPos.x && m_pImpl->m_y.GetFinalValue() == newPos.y)
+		return;
+
+	++s_treeGeneration;
+	InvalidateParent();
+	HandOffScope handOff(m_pImpl);
+	m_pImpl->SetPair(m_pImpl->m_x, newPos.x, m_pImpl->m_y, newPos.y, !GetVisible());
+}
+
+D2D1_POINT_2F Object::GetPosition() const 
+{ 
+	return D2D1::Point2F((FLOAT)m_pImpl->m_x, (FLOAT)m_pImpl->m_y); 
+}
+
+D2D1_POINT_2F Object::GetFinalPosition() const 
+{ 
+	return D2D1::Point2F((FLOAT)m_pImpl->m_x.GetFinalValue(), (FLOAT)m_pImpl->m_y.GetFinalValue()); 
+}
+
+void Object::SetZOrder(int z) 
+{ 
+	if(GetZOrder() != z)
+	{
+		m_pImpl->m_z = z; 
+		++s_treeGeneration;
+		DirtyParentZ();
+		InvalidateParent();
+	}
+}
+
+int Object::GetZOrder() const 
+{ 
+	return m_pImpl->m_z; 
+}
+
+void Object::SetTranslationX(double newX)
+{
+	HandOffScope handOff(m_pImpl);
+	if(m_pImpl->SetVar(m_pImpl->m_xTrans, newX))
+		InvalidateParent();
+}
+
+void Object::SetTranslationY(double newY)
+{
+	HandOffScope handOff(m_pImpl);
+	if(m_pImpl->SetVar(m_pImpl->m_yTrans, newY))
+		InvalidateParent();
+}
+
+void Object::SetTranslationXDelta(double xdelta)
+{
+	SetTranslationX(m_pImpl->m_xTrans.GetFinalValue() + xdelta);
+}
+
+void Object::SetTranslationYDelta(double ydelta)
+{
+	SetTranslationY(m_pImpl->m_yTrans.GetFinalValue() + ydelta);
+}
+
+D2D1_RECT_F Object::GetBoundingBox() const
+{
+	return D2D1::RectF(	(FLOAT)m_pImpl->m_x, 
+						(FLOAT)m_pImpl->m_y, 
+						(FLOAT)(m_pImpl->m_x + m_pImpl->m_width),
+						(FLOAT)(m_pImpl->m_y + m_pImpl->m_height)
+						);
+}
+
+void Object::Layout()
+{
+	if(!NeedsLayout())
+		return;
+
+	// Everything one pass moves animates as a single group
+	if(s_layoutDepth == 0)
+	{
+		tjm::animation::StoryBoard b;
+		LayoutPassScope pass;
+		Layout();
+		return;
+	}
+
+	if(m_pImpl->m_dirtyLayout)
+	{
+		OnLayout();
+		m_pImpl->m_dirtyLayout = false;
+	}
+
+	if(m_pImpl->m_dirtyChild)
+	{
+		std::vector<Object*>& v = m_pImpl->m_children;
+		for(auto& obj : v)
+		{
+			obj->Layout();
+		}
+		m_pImpl->m_dirtyChild = false;
+	}
+}
+
+size_t Object::GetAnimationsStarted()
+{
+	return s_animationsStarted;
+}
+
+void Object::SetCompositorAnimation(double seconds)
+{
+	s_compositorDuration = seconds > 0 ? seconds : 0;
+}
+
+double Object::GetCompositorAnimation()
+{
+	return s_compositorDuration;
+}
+
+bool Object::NeedsLayout() const
+{
+	return m_pImpl->m_dirtyLayout || m_pImpl->m_dirtyChild;
+}
+
+void Object::OnLayout()
+{
+    std::vector<Object*>& v = m_pImpl->m_children;
+    for (auto& obj : v)
+    {
+        obj->SetPosition({ 0,0 });
+        obj->SetSize(GetSize());
+    }
+}
+
+void Object::Render(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& box, DOUBLE baseOpacity)
+{
+	// Without a persistent context there is nowhere to keep layers
+	RenderContext ctx;
+	ctx.SetLayerBudget(0);
+	ctx.SetTarget(pTarget);
+	ctx.BeginFrame();
+
+	// Start from whatever transform the caller has set up
+	D2D1::Matrix3x2F transform;
+	pTarget->GetTransform(&transform);
+	ctx.m_pImpl->SetTransform(transform);
+
+	Render(ctx, box, baseOpacity);
+	ctx.EndFrame();
+}
+
+void Object::Render(RenderContext& ctx, const D2D1_RECT_F& box, DOUBLE baseOpacity)
+{
+	RenderContextImpl* ctxImpl = ctx.m_pImpl;
+	D2D1::Matrix3x2F outerTrans = ctxImpl->GetTransform();
+	D2D1_RECT_F visible(box);
+
+	if(m_pImpl->m_composited || m_pImpl->IsAnimating() || IsContentAnimating())
+		++ctxImpl->m_stats.objectsAnimating;
+
+	// Catches animations started where no setter could hand them off, such
+	// as inside a layout pass's storyboard
+	auto now = std::chrono::steady_clock::now();
+	if(s_compositorDuration > 0)
+		m_pImpl->HandOff(now, m_pImpl->ShownPlacement(now), m_pImpl->ShownOpacity(now));
+
+	// A compositor animation is recorded as a group for Replay to animate,
+	// or applied here when drawing straight to the target
+	bool group = false;
+	DOUBLE effectiveOpacity = GetOpacity() * baseOpacity;
+	if(m_pImpl->m_composited)
+	{
+		const CompositorAnimation& anim = m_pImpl->m_composite;
+		if(anim.IsDone(now))
+		{
+			m_pImpl->m_composited = false;
+		}
+		else if(ctxImpl->m_recording)
+		{
+			group = true;
+			effectiveOpacity = baseOpacity * max(anim.m_fromOpacity, anim.m_toOpacity);
+		}
+		else
+		{
+			D2D1_POINT_2F offset = anim.Offset(now);
+			ctxImpl->SetTransform(outerTrans * D2D1::Matrix3x2F::Translation(offset.x, offset.y));
+			visible = Offset(box, -offset.x, -offset.y);
+			effectiveOpacity = baseOpacity * anim.Opacity(now);
+			ctxImpl->m_frameRequested = true;
+		}
+	}
+
+	// Opacity culling. At interactive quality the faint ends of fades go too.
+	DOUBLE minOpacity = ctxImpl->Quality() == RenderQuality::Interactive ? c_interactiveMinOpacity : 0.001;
+	if(effectiveOpacity < minOpacity)
+	{
+		ctxImpl->SetTransform(outerTrans);
+		++ctxImpl->m_stats.objectsCulled;
+		return;
+	}
+
+	if(group)
+	{
+		// All of the content is recorded, since it may move into view, at
+		// full opacity; the compositor fades it as a whole
+		D2D1_RECT_F extent = Offset(m_pImpl->LayerExtent(), (FLOAT)m_pImpl->m_xTrans, (FLOAT)m_pImpl->m_yTrans);
+		if(HasClippingRect())
+			Clip(extent, GetClippingRect());
+		ctxImpl->BeginGroup(m_pImpl->m_id, extent, m_pImpl->m_composite, (FLOAT)baseOpacity);
+		visible = extent;
+		effectiveOpacity = 1.0;
+	}
+
+	// Clip culling. Everything below only needs to cover what is left
+	// of the box after our clipping rect is applied.
+	if(HasClippingRect())
+	{
+		Clip(visible, GetClippingRect());
+		if(visible.right <= visible.left || visible.bottom <= visible.top)
+		{
+			if(group)
+				ctxImpl->EndGroup();
+			ctxImpl->SetTransform(outerTrans);
+			++ctxImpl->m_stats.objectsCulled;
+			return;
+		}
+		ctxImpl->PushClip(GetClippingRect());
+	}
+
+	++ctxImpl->m_stats.objectsRendered;
+
+	// Only a drag or an animation that is actually on screen makes this
+	// frame part of an interaction. Content that is merely volatile, or a
+	// compositor animation that has just finished, doesn't.
+	if(m_pImpl->m_touching || m_pImpl->m_composited || m_pImpl->IsAnimating() || IsContentAnimating())
+		ctxImpl->m_interacting = true;
+
+	D2D1::Matrix3x2F preTrans = ctxImpl->GetTransform();
+
+	// Content moving on its own keeps frames and layout passes coming
+	if(IsContentAnimating())
+	{
+		ctxImpl->m_frameRequested = true;
+		DirtyLayout();
+	}
+
+	// Layers live on the device, which a recording context doesn't have
+	bool layered = false;
+	if(ctxImpl->m_recording)
+		layered = false;
+	else if(m_pImpl->m_caching == LayerCaching::Scroll)
+		layered = RenderScrollLayer(ctx, visible, effectiveOpacity);
+	else if(m_pImpl->WantsLayer())
+		layered = RenderLayer(ctx, visible, effectiveOpacity);
+
+	if(!layered)
+		RenderContent(ctx, visible, effectiveOpacity);
+
+	ctxImpl->SetTransform(preTrans);
+
+	if(HasClippingRect())
+		ctxImpl->PopClip();
+
+	if(group)
+		ctxImpl->EndGroup();
+	ctxImpl->SetTransform(outerTrans);
+}
+
+void Object::RenderContent(RenderContext& ctx, const D2D1_RECT_F& box, DOUBLE effectiveOpacity)
+{
+	RenderContextImpl* ctxImpl = ctx.m_pImpl;
+	bool batched = m_pImpl->m_batched;
+	// Hooks that want the device can't be recorded
+	bool hooks = batched || !ctxImpl->m_recording;
+	if(!hooks)
+		++ctxImpl->m_stats.objectsNotRecorded;
+
+	D2D1::Matrix3x2F preTrans = ctxImpl->GetTransform();
+
+	// Set local translation, and move the visible box into the translated space
+	FLOAT xTrans = (FLOAT)m_pImpl->m_xTrans;
+	FLOAT yTrans = (FLOAT)m_pImpl->m_yTrans;
+	D2D1::Matrix3x2F postTrans = preTrans * D2D1::Matrix3x2F::Translation(xTrans, yTrans);
+	ctxImpl->SetTransform(postTrans);
+	D2D1_RECT_F contentBox = D2D1::RectF(box.left - xTrans, box.top - yTrans, box.right - xTrans, box.bottom - yTrans);
+
+	m_pImpl->m_renderContext = &ctx;
+	if(hooks)
+	{
+		OnRenderBackground(ctxImpl->BeginHook(batched), contentBox, effectiveOpacity);
+		ctxImpl->EndHook(batched);
+	}
+	
+	m_pImpl->TrustZ();
+
+	size_t levelBegin = ctxImpl->m_occluders.size();
+	size_t activeBegin = ctxImpl->m_activeOccluderBegin;
+	size_t activeEnd = ctxImpl->m_activeOccluderEnd;
+	OcclusionPrePass(ctx, contentBox, effectiveOpacity, D2D1::Point2F(postTrans._31, postTrans._32));
+
+	for(auto& obj : m_pImpl->m_children)
+	{
+		if(obj->m_pImpl->m_occluded)
+		{
+			++ctxImpl->m_stats.objectsOccluded;
+		}
+		else if(obj->m_pImpl->m_composited || Intersects(obj, contentBox)) 
+		{
+			// The child only sees occluders from our ancestors and from siblings above it
+			ctxImpl->m_activeOccluderBegin = levelBegin;
+			ctxImpl->m_activeOccluderEnd = obj->m_pImpl->m_occludersAbove;
+
+			// Anything moving inside a layer means the layer has to be redrawn next frame
+			if(ctxImpl->m_rasterDepth > 0 && (obj->m_pImpl->IsAnimating() || obj->m_pImpl->m_composited || obj->IsContentVolatile()))
+				ctxImpl->m_volatile = true;
+
+			D2D1_RECT_F transBox(contentBox);
+			transBox.left -= obj->GetPosition().x;
+			transBox.right -= obj->GetPosition().x;
+			transBox.bottom -= obj->GetPosition().y;
+			transBox.top -= obj->GetPosition().y;
+
+			ctxImpl->SetTransform(postTrans * D2D1::Matrix3x2F::Translation(obj->GetPosition().x, obj->GetPosition().y));
+			obj->Render(ctx, transBox, effectiveOpacity);
+		}
+		else
+		{
+			++ctxImpl->m_stats.objectsCulled;
+		}
+	}
+
+	ctxImpl->m_occluders.resize(levelBegin);
+	ctxImpl->m_activeOccluderBegin = activeBegin;
+	ctxImpl->m_activeOccluderEnd = activeEnd;
+
+	ctxImpl->SetTransform(postTrans);
+
+	m_pImpl->m_renderContext = &ctx;
+	if(hooks)
+	{
+		OnRenderForeground(ctxImpl->BeginHook(batched), contentBox, effectiveOpacity);
+		ctxImpl->EndHook(batched);
+	}
+	m_pImpl->m_renderContext = nullptr;
+}
+
+void Object::OcclusionPrePass(RenderContext& ctx, const D2D1_RECT_F& contentBox, DOUBLE effectiveOpacity, D2D1_POINT_2F world)
+{
+	// Walks the children front to back, marking the ones whose visible part
+	// is entirely covered by opaque content drawn above them. Occluders are
+	// kept in target space so they carry down into grandchildren; this
+	// assumes the transforms in play are translations only, as they are
+	// for everything Object sets up.
+	RenderContextImpl* ctxImpl = ctx.m_pImpl;
+	std::vector<D2D1_RECT_F>& occluders = ctxImpl->m_occluders;
+
+	// Start this level with the occluders inherited from above
+	for(size_t i = ctxImpl->m_activeOccluderBegin; i < ctxImpl->m_activeOccluderEnd; ++i)
+	{
+		D2D1_RECT_F inherited = occluders[i];
+		occluders.push_back(inherited);
+	}
+	size_t levelBegin = occluders.size() - (ctxImpl->m_activeOccluderEnd - ctxImpl->m_activeOccluderBegin);
+
+	std::vector<Object*>& v = m_pImpl->m_children;
+	for(auto it = v.rbegin(); it != v.rend(); ++it)
+	{
+		Object* obj = *it;
+		ObjectImpl* child = obj->m_pImpl;
+		child->m_occluded = false;
+		child->m_occludersAbove = occluders.size();
+
+		// Somewhere between where it was and where it is going
+		if(child->m_composited)
+			continue;
+
+		// Where the child can draw: its box, before and after its own translation
+		D2D1_RECT_F bounds = obj->GetBoundingBox();
+		FLOAT xTrans = (FLOAT)child->m_xTrans;
+		FLOAT yTrans = (FLOAT)child->m_yTrans;
+		D2D1_RECT_F drawn = D2D1::RectF(
+			bounds.left + min(xTrans, 0.0f), bounds.top + min(yTrans, 0.0f),
+			bounds.right + max(xTrans, 0.0f), bounds.bottom + max(yTrans, 0.0f));
+		Clip(drawn, contentBox);
+		if(IsEmpty(drawn))
+			continue;
+
+		drawn = Offset(drawn, world.x, world.y);
+		for(size_t i = levelBegin; i < occluders.size(); ++i)
+		{
+			if(Contains(occluders[i], drawn))
+			{
+				child->m_occluded = true;
+				ctxImpl->m_stats.occludedArea += (drawn.right - drawn.left) * (drawn.bottom - drawn.top);
+				break;
+			}
+		}
+
+		if(child->m_occluded || occluders.size() - levelBegin >= c_maxOccluders)
+			continue;
+
+		if(obj->IsOpaque() && effectiveOpacity * obj->GetOpacity() >= 0.999)
+		{
+			// Opaque content is drawn in the child's translated space and cut by
+			// its clip and by everything clipping us
+			D2D1_RECT_F cover = Offset(bounds, xTrans, yTrans);
+			if(obj->HasClippingRect())
+				Clip(cover, Offset(obj->GetClippingRect(), bounds.left, bounds.top));
+			Clip(cover, contentBox);
+			if(!IsEmpty(cover))
+				occluders.push_back(Offset(cover, world.x, world.y));
+		}
+	}
+}
+
+bool Object::RenderLayer(RenderContext& ctx, const D2D1_RECT_F& /*box*/, DOUBLE effectiveOpacity)
+{
+	RenderContextImpl* ctxImpl = ctx.m_pImpl;
+
+	D2D1_RECT_F extent = m_pImpl->LayerExtent();
+	FLOAT width = extent.right - extent.left;
+	FLOAT height = extent.bottom - extent.top;
+	if(width <= 0 || height <= 0 || width > c_maxLayerExtent || height > c_maxLayerExtent)
+		return false;
+
+	LayerEntry* layer = ctxImpl->FindLayer(m_pImpl->m_id);
+	if(!layer || !SameRect(layer->m_extent, extent))
+	{
+		layer = ctxImpl->CreateLayer(m_pImpl->m_id, extent);
+		if(!layer)
+			return false;
+	}
+
+	if(!layer->m_valid || layer->m_version != m_pImpl->m_version)
+	{
+		// Rasterize the content at full opacity and without our translation;
+		// both are applied when compositing.
+		bool outerVolatile = ctxImpl->m_volatile;
+		ctxImpl->m_volatile = IsVarAnimating(m_pImpl->m_width) || IsVarAnimating(m_pImpl->m_height) || IsContentVolatile();
+		++ctxImpl->m_rasterDepth;
+
+		// Layers hold their full content regardless of what covers them now
+		size_t activeBegin = ctxImpl->m_activeOccluderBegin;
+		size_t activeEnd = ctxImpl->m_activeOccluderEnd;
+		ctxImpl->m_activeOccluderBegin = ctxImpl->m_activeOccluderEnd = 0;
+
+		ID2D1BitmapRenderTarget* pLayerTarget = layer->m_target;
+		ctxImpl->PushTarget(pLayerTarget);
+		pLayerTarget->BeginDraw();
+		pLayerTarget->Clear(D2D1::ColorF(0, 0, 0, 0));
+
+		// RenderContent applies our translation, so cancel it out here. The
+		// whole extent is drawn; clipping happens when compositing.
+		FLOAT xTrans = (FLOAT)m_pImpl->m_xTrans;
+		FLOAT yTrans = (FLOAT)m_pImpl->m_yTrans;
+		ctxImpl->SetTransform(D2D1::Matrix3x2F::Translation(-extent.left - xTrans, -extent.top - yTrans));
+		RenderContent(ctx, D2D1::RectF(extent.left + xTrans, extent.top + yTrans, extent.right + xTrans, extent.bottom + yTrans), 1.0);
+
+		// Popping flushes whatever is still queued for the layer
+		ctxImpl->PopTarget();
+		HRESULT hr = pLayerTarget->EndDraw();
+		ctxImpl->m_activeOccluderBegin = activeBegin;
+		ctxImpl->m_activeOccluderEnd = activeEnd;
+
+		--ctxImpl->m_rasterDepth;
+		++ctxImpl->m_stats.layersRasterized;
+		layer->m_version = m_pImpl->m_version;
+		layer->m_valid = SUCCEEDED(hr) && !ctxImpl->m_volatile;
+
+		// A changing layer makes any layer it is drawn into change too
+		ctxImpl->m_volatile = outerVolatile || ctxImpl->m_volatile;
+
+		if(!SUCCEEDED(hr))
+			return false;
+	}
+
+	CComPtr<ID2D1Bitmap> bitmap;
+	if(!SUCCEEDED(layer->m_target->GetBitmap(&bitmap)))
+		return false;
+
+	// A stretched layer stands in for the object at a size it hasn't been laid out at yet
+	D2D1_RECT_F dest = extent;
+	D2D1_SIZE_F stretch = m_pImpl->m_layerStretch;
+	if(stretch.width > 0 && stretch.height > 0 && (double)m_pImpl->m_width > 0 && (double)m_pImpl->m_height > 0)
 	{
-		m_pImpl->m_opacity = visible ? 1.0 : 0.0;
-		OnVisibilityChange(visible);
+		FLOAT sx = stretch.width / (FLOAT)m_pImpl->m_width;
+		FLOAT sy = stretch.height / (FLOAT)m_pImpl->m_height;
+		dest = D2D1::RectF(extent.left * sx, extent.top * sy, extent.right * sx, extent.bottom * sy);
 	}
+
+	D2D1::Matrix3x2F preTrans = ctxImpl->GetTransform();
+	ctxImpl->SetTransform(preTrans * D2D1::Matrix3x2F::Translation((FLOAT)m_pImpl->m_xTrans, (FLOAT)m_pImpl->m_yTrans));
+	ctxImpl->Device()->DrawBitmap(bitmap, dest, (FLOAT)effectiveOpacity, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR);
+	++ctxImpl->m_stats.layersComposited;
+	ctxImpl->SetTransform(preTrans);
+	return true;
 }
 
-void Object::SetOpacity(DOUBLE opacity)
+bool Object::RenderScrollLayer(RenderContext& ctx, const D2D1_RECT_F& /*box*/, DOUBLE effectiveOpacity)
 {
-	bool oldVisibility = GetVisible();
+	// The layer holds what is in view after translation, so a scroll only
+	// has to move the bitmap and draw the strips that came into view.
+	RenderContextImpl* ctxImpl = ctx.m_pImpl;
 
-	m_pImpl->m_opacity = opacity;
+	FLOAT width = (FLOAT)m_pImpl->m_width;
+	FLOAT height = (FLOAT)m_pImpl->m_height;
+	D2D1_RECT_F extent = D2D1::RectF(0, 0, width, height);
+	if(width <= 0 || height <= 0 || width > c_maxLayerExtent || height > c_maxLayerExtent)
+		return false;
 
-	if(GetVisible() != oldVisibility)
+	LayerEntry* layer = ctxImpl->FindLayer(m_pImpl->m_id);
+	if(!layer || !SameRect(layer->m_extent, extent))
 	{
-		OnVisibilityChange(GetVisible());
+		layer = ctxImpl->CreateLayer(m_pImpl->m_id, extent);
+		if(!layer)
+			return false;
 	}
-}
 
-size_t Object::NumChildren() const
-{
-	return m_pImpl->m_children.size();
-}
+	CComPtr<ID2D1Bitmap> bitmap;
+	if(!SUCCEEDED(layer->m_target->GetBitmap(&bitmap)))
+		return false;
 
-Object* Object::GetChild(size_t i)
-{
-	return m_pImpl->m_children[i];
-}
+	FLOAT xTrans = (FLOAT)m_pImpl->m_xTrans;
+	FLOAT yTrans = (FLOAT)m_pImpl->m_yTrans;
+	FLOAT dx = xTrans - layer->m_xTrans;
+	FLOAT dy = yTrans - layer->m_yTrans;
+	bool current = layer->m_valid && layer->m_version == m_pImpl->m_version;
 
-const Object* Object::GetChild(size_t i) const
-{
-	return m_pImpl->m_children[i];
-}
+	D2D1_RECT_F strips[2];
+	size_t numStrips = 0;
+	if(current && (dx != 0 || dy != 0))
+	{
+		// Only whole pixel shifts can be copied without resampling
+		FLOAT dpiX, dpiY;
+		layer->m_target->GetDpi(&dpiX, &dpiY);
+		D2D1_SIZE_U pixels = layer->m_target->GetPixelSize();
+		FLOAT pdx = dx * dpiX / 96.0f;
+		FLOAT pdy = dy * dpiY / 96.0f;
+		INT px = (INT)floor(pdx + 0.5f);
+		INT py = (INT)floor(pdy + 0.5f);
+		current = fabs(pdx - px) < 0.01f && fabs(pdy - py) < 0.01f &&
+			abs(px) < (INT)pixels.width && abs(py) < (INT)pixels.height;
+
+		if(current && !layer->m_scratch)
+		{
+			current = SUCCEEDED(layer->m_target->CreateBitmap(pixels, nullptr, 0,
+				D2D1::BitmapProperties(layer->m_target->GetPixelFormat(), dpiX, dpiY), &layer->m_scratch));
+			if(current)
+			{
+				ctxImpl->m_layerBytes += layer->m_bytes;
+				layer->m_bytes *= 2;
+			}
+		}
 
-void Object::AddChild(Object* child)
-{
-	child->SetParent(this);
-	m_pImpl->m_children.push_back(child);
-	child->DirtyLayout();
-	DirtyLayout();
-	DirtyZ();
-}
+		if(current)
+		{
+			UINT32 ax = (UINT32)abs(px);
+			UINT32 ay = (UINT32)abs(py);
+			D2D1_POINT_2U dest = D2D1::Point2U(px > 0 ? ax : 0, py > 0 ? ay : 0);
+			D2D1_RECT_U src = D2D1::RectU(px > 0 ? 0 : ax, py > 0 ? 0 : ay,
+				px > 0 ? pixels.width - ax : pixels.width, py > 0 ? pixels.height - ay : pixels.height);
+			current = SUCCEEDED(layer->m_scratch->CopyFromBitmap(nullptr, bitmap, nullptr)) &&
+				SUCCEEDED(bitmap->CopyFromBitmap(&dest, layer->m_scratch, &src));
+		}
 
-void Object::InsertChild(Object * child, size_t i)
-{
-    child->SetParent(this);
-    m_pImpl->m_children.insert(m_pImpl->m_children.begin()+i, child);
-    child->DirtyLayout();
-    DirtyLayout();
-    DirtyZ();
-}
+		if(current)
+		{
+			if(dx > 0)
+				strips[numStrips++] = D2D1::RectF(0, 0, dx, height);
+			else if(dx < 0)
+				strips[numStrips++] = D2D1::RectF(width + dx, 0, width, height);
+			if(dy > 0)
+				strips[numStrips++] = D2D1::RectF(0, 0, width, dy);
+			else if(dy < 0)
+				strips[numStrips++] = D2D1::RectF(0, height + dy, width, height);
+			++ctxImpl->m_stats.layersScrolled;
+		}
+	}
 
-void Object::RemoveChild(Object* child)
-{
-	if(child)
+	if(!current)
 	{
-		child->SetParent(nullptr);
-		std::vector<Object*>& v = m_pImpl->m_children;
-		v.erase(std::remove(v.begin(), v.end(), child), v.end());
-		DirtyLayout();
+		strips[0] = extent;
+		numStrips = 1;
 	}
-}
-	
-D2D1_SIZE_F Object::GetSize() const 
-{ 
-	return D2D1::SizeF((FLOAT)m_pImpl->m_width, (FLOAT)m_pImpl->m_height); 
-}
 
-D2D1_SIZE_F Object::GetFinalSize() const 
-{ 
-	return D2D1::SizeF((FLOAT)m_pImpl->m_width.GetFinalValue(), (FLOAT)m_pImpl->m_height.GetFinalValue()); 
+	if(numStrips > 0)
+	{
+		if(!RasterStrips(ctx, layer, strips, numStrips))
+			return false;
+		layer->m_xTrans = xTrans;
+		layer->m_yTrans = yTrans;
+	}
+
+	ctxImpl->Device()->DrawBitmap(bitmap, extent, (FLOAT)effectiveOpacity, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR);
+	++ctxImpl->m_stats.layersComposited;
+	return true;
 }
 
-void Object::SetPosition(D2D1_POINT_2F newPos)
+bool Object::RasterStrips(RenderContext& ctx, LayerEntry* layer, const D2D1_RECT_F* strips, size_t count)
 {
-	tjm::animation::StoryBoard b;
-	tjm::animation::InstantChange ic(m_pImpl->m_x, !GetVisible());
-	tjm::animation::InstantChange ic2(m_pImpl->m_y, !GetVisible());
-	m_pImpl->m_x = newPos.x;
-	m_pImpl->m_y = newPos.y;
-}
+	RenderContextImpl* ctxImpl = ctx.m_pImpl;
 
-D2D1_POINT_2F Object::GetPosition() const 
-{ 
-	return D2D1::Point2F((FLOAT)m_pImpl->m_x, (FLOAT)m_pImpl->m_y); 
-}
+	// Our own content moves by translation, which the layer follows; only
+	// a change in size or something animating below makes it stale
+	bool outerVolatile = ctxImpl->m_volatile;
+	ctxImpl->m_volatile = IsVarAnimating(m_pImpl->m_width) || IsVarAnimating(m_pImpl->m_height);
+	++ctxImpl->m_rasterDepth;
 
-D2D1_POINT_2F Object::GetFinalPosition() const 
-{ 
-	return D2D1::Point2F((FLOAT)m_pImpl->m_x, (FLOAT)m_pImpl->m_y); 
-}
+	size_t activeBegin = ctxImpl->m_activeOccluderBegin;
+	size_t activeEnd = ctxImpl->m_activeOccluderEnd;
+	ctxImpl->m_activeOccluderBegin = ctxImpl->m_activeOccluderEnd = 0;
 
-void Object::SetZOrder(int z) 
-{ 
-	if(GetZOrder() != z)
+	ID2D1BitmapRenderTarget* pLayerTarget = layer->m_target;
+	ctxImpl->PushTarget(pLayerTarget);
+	pLayerTarget->BeginDraw();
+
+	// The layer is in our coordinates before translation, which
+	// RenderContent applies itself
+	for(size_t i = 0; i < count; ++i)
 	{
-		m_pImpl->m_z = z; 
-		DirtyParentZ();
+		ctxImpl->SetTransform(D2D1::Matrix3x2F::Identity());
+		ctxImpl->PushClip(strips[i]);
+		ctxImpl->Device()->Clear(D2D1::ColorF(0, 0, 0, 0));
+		RenderContent(ctx, strips[i], 1.0);
+		ctxImpl->SetTransform(D2D1::Matrix3x2F::Identity());
+		ctxImpl->PopClip();
 	}
-}
 
-int Object::GetZOrder() const 
-{ 
-	return m_pImpl->m_z; 
+	ctxImpl->PopTarget();
+	HRESULT hr = pLayerTarget->EndDraw();
+	ctxImpl->m_activeOccluderBegin = activeBegin;
+	ctxImpl->m_activeOccluderEnd = activeEnd;
+
+	--ctxImpl->m_rasterDepth;
+	++ctxImpl->m_stats.layersRasterized;
+	layer->m_version = m_pImpl->m_version;
+	layer->m_valid = SUCCEEDED(hr) && !ctxImpl->m_volatile;
+	ctxImpl->m_volatile = outerVolatile || ctxImpl->m_volatile;
+	return SUCCEEDED(hr);
 }
 
-void Object::SetTranslationX(double newX)
+void Object::SetLayerCaching(LayerCaching caching)
 {
-	m_pImpl->m_xTrans = newX;
+	m_pImpl->m_caching = caching;
 }
 
-void Object::SetTranslationY(double newY)
+LayerCaching Object::GetLayerCaching() const
 {
-	m_pImpl->m_yTrans = newY;
+	return m_pImpl->m_caching;
 }
 
-void Object::SetTranslationXDelta(double xdelta)
+void Object::SetLayerStretch(D2D1_SIZE_F size)
 {
-	m_pImpl->m_xTrans = m_pImpl->m_xTrans.GetFinalValue() + xdelta;
+	D2D1_SIZE_F& stretch = m_pImpl->m_layerStretch;
+	if(stretch.width != size.width || stretch.height != size.height)
+	{
+		stretch = size;
+		InvalidateParent();
+	}
 }
 
-void Object::SetTranslationYDelta(double ydelta)
+RenderContext* Object::GetRenderContext() const
 {
-	m_pImpl->m_yTrans = m_pImpl->m_yTrans.GetFinalValue() + ydelta;
+	return m_pImpl->m_renderContext;
 }
 
-D2D1_RECT_F Object::GetBoundingBox() const
+void Object::SetBatchedRendering(bool batched)
 {
-	return D2D1::RectF(	(FLOAT)m_pImpl->m_x, 
-						(FLOAT)m_pImpl->m_y, 
-						(FLOAT)(m_pImpl->m_x + m_pImpl->m_width),
-						(FLOAT)(m_pImpl->m_y + m_pImpl->m_height)
-						);
+	m_pImpl->m_batched = batched;
 }
 
-void Object::Layout()
+void Object::Invalidate()
 {
-	if(m_pImpl->m_dirtyLayout)
-	{
-		OnLayout();
-		m_pImpl->m_dirtyLayout = false;
-	}
-
-	if(m_pImpl->m_dirtyChild)
+	for(Object* obj = this; obj; obj = obj->GetParent())
 	{
-		std::vector<Object*>& v = m_pImpl->m_children;
-		for(auto& obj : v)
-		{
-			obj->Layout();
-		}
-		m_pImpl->m_dirtyChild = false;
+		++obj->m_pImpl->m_version;
 	}
 }
 
-void Object::OnLayout()
+unsigned Object::GetVersion() const
 {
-    std::vector<Object*>& v = m_pImpl->m_children;
-    for (auto& obj : v)
-    {
-        obj->SetPosition({ 0,0 });
-        obj->SetSize(GetSize());
-    }
+	return m_pImpl->m_version;
 }
 
-void Object::Render(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& box, DOUBLE baseOpacity)
+void Object::InvalidateParent()
 {
-	DOUBLE effectiveOpacity = GetOpacity() * baseOpacity;
-
-	if(HasClippingRect())
-		pTarget->PushAxisAlignedClip(GetClippingRect(),	D2D1_ANTIALIAS_MODE_ALIASED);
-
-	// Opacity culling
-	if(effectiveOpacity < 0.001)
-		return;
-
-	D2D1::Matrix3x2F preTrans;
-	pTarget->GetTransform(&preTrans);
-
-	// Set local translation
-	pTarget->SetTransform(preTrans * D2D1::Matrix3x2F::Translation((FLOAT)m_pImpl->m_xTrans, (FLOAT)m_pImpl->m_yTrans));
-
-	OnRenderBackground(pTarget, box, effectiveOpacity);
-	
-	m_pImpl->TrustZ();
-
-	D2D1::Matrix3x2F postTrans;
-	pTarget->GetTransform(&postTrans);
-
-	for(auto& obj : m_pImpl->m_children)
+	if(GetParent())
 	{
-		if(Intersects(obj, box)) 
-		{
-			D2D1_RECT_F transBox(box);
-			transBox.left -= obj->GetPosition().x;
-			transBox.right -= obj->GetPosition().x;
-			transBox.bottom -= obj->GetPosition().y;
-			transBox.top -= obj->GetPosition().y;
-
-			pTarget->SetTransform(postTrans * D2D1::Matrix3x2F::Translation(obj->GetPosition().x, obj->GetPosition().y));
-			obj->Render(pTarget, transBox, effectiveOpacity);
-		}
+		GetParent()->Invalidate();
 	}
-
-	pTarget->SetTransform(postTrans);
-
-	OnRenderForeground(pTarget, box, effectiveOpacity);
-
-	pTarget->SetTransform(preTrans);
-
-	if(HasClippingRect())
-		pTarget->PopAxisAlignedClip();
 }
 
 D2D1_POINT_2F Object::WorldToLocal(const D2D1_POINT_2F& world) const
@@ -528,9 +1929,10 @@ D2D1_POINT_2F Object::WorldToLocal(const D2D1_POINT_2F& world) const
 	if(!GetParent())
 		return world;
 
+	// Children sit in their parent's translated space
 	D2D1_POINT_2F pt = GetParent()->WorldToLocal(world);
-	pt.x -= GetPosition().x;
-	pt.y -= GetPosition().y;
+	pt.x -= GetPosition().x + (FLOAT)GetParent()->m_pImpl->m_xTrans;
+	pt.y -= GetPosition().y + (FLOAT)GetParent()->m_pImpl->m_yTrans;
 
 	return pt;
 }
@@ -539,14 +1941,13 @@ Object* Object::Touch(const D2D1_POINT_2F& pos)
 {
 	m_pImpl->TrustZ();
 
+	D2D1_POINT_2F contentPos = D2D1::Point2F(pos.x - (FLOAT)m_pImpl->m_xTrans, pos.y - (FLOAT)m_pImpl->m_yTrans);
 	for(auto obj = m_pImpl->m_children.rbegin(); obj != m_pImpl->m_children.rend(); ++obj)
 	{
-		if(Intersects(*obj, pos))
+		if(Intersects(*obj, contentPos))
 		{
-			D2D1_POINT_2F transPos(pos);
-			transPos.x -= pos.x;
-			transPos.y -= pos.y;
-			Object* owner = (*obj)->Touch(transPos);
+			D2D1_POINT_2F childPos = (*obj)->GetPosition();
+			Object* owner = (*obj)->Touch(D2D1::Point2F(contentPos.x - childPos.x, contentPos.y - childPos.y));
 			if(owner)
 				return owner;
 		}
@@ -555,41 +1956,109 @@ Object* Object::Touch(const D2D1_POINT_2F& pos)
 	return OnTouch(pos);
 }
 
-bool Object::Key(char key)
+Object* Object::HoverChild(const D2D1_POINT_2F& pos, bool& overlapped, size_t& tested)
 {
-    m_pImpl->TrustZ();
+	if(m_pImpl->m_hasClippingRect && !Intersects(m_pImpl->m_clippingRect, pos))
+		return nullptr;
 
-    if (OnKey(key))
-        return true;
+	m_pImpl->TrustZ();
 
-    for (auto obj = m_pImpl->m_children.rbegin(); obj != m_pImpl->m_children.rend(); ++obj)
-    {
-        if ((*obj)->Key(key))
-            return true;
-    }
+	std::vector<Object*>& children = m_pImpl->m_children;
+	D2D1_POINT_2F contentPos = D2D1::Point2F(pos.x - (FLOAT)m_pImpl->m_xTrans, pos.y - (FLOAT)m_pImpl->m_yTrans);
+	for(auto obj = children.rbegin(); obj != children.rend(); ++obj)
+	{
+		if(!(*obj)->GetVisible())
+			continue;
+		++tested;
+		if(!Intersects(*obj, contentPos))
+			continue;
+
+		// A sibling above that shares its bounds could take the point without
+		// it leaving them, so such hits aren't trusted on the next move
+		D2D1_RECT_F box = (*obj)->GetBoundingBox();
+		for(auto above = children.rbegin(); above != obj && !overlapped; ++above)
+			overlapped = (*above)->GetVisible() && Overlaps(box, (*above)->GetBoundingBox());
+		return *obj;
+	}
+	return nullptr;
+}
 
-    return false;
+void Object::HoverEnter()
+{
+	m_pImpl->m_hovered = true;
+	OnHoverEnter();
+}
+
+void Object::HoverLeave()
+{
+	m_pImpl->m_hovered = false;
+	OnHoverLeave();
+}
+
+bool Object::Hover(const D2D1_POINT_2F& pos)
+{
+	return OnHover(pos);
+}
+
+bool Object::IsHovered() const
+{
+	return m_pImpl->m_hovered;
+}
+
+void Object::SetTouchPrediction(bool predict)
+{
+	m_pImpl->m_touchPrediction = predict;
+}
+
+bool Object::GetTouchPrediction() const
+{
+	return m_pImpl->m_touchPrediction;
+}
+
+bool Object::Key(const KeyEvent& e)
+{
+	return OnKeyEvent(e);
+}
+
+bool Object::OnKeyEvent(const KeyEvent& e)
+{
+	if (e.type != KeyEventType::Char)
+		return false;
+	return OnKey((char)e.key);
 }
 
 bool Object::TouchContinue(const TouchInfo& ti)
 {
-	return OnTouchContinue(ti);
+	m_pImpl->m_touching = OnTouchContinue(ti);
+	return m_pImpl->m_touching;
 }
 
 void Object::TouchFinish(const TouchInfo& ti)
 {
+	// The drag's last frames may have been drawn at interactive quality, so
+	// ask for one more, which comes at full quality once nothing moves
+	if(m_pImpl->m_touching)
+		DirtyLayout();
+	m_pImpl->m_touching = false;
 	return OnTouchFinish(ti);
 }
 
+void Object::ViewportChanged(const D2D1_RECT_F& viewport, const D2D1_POINT_2F& velocity)
+{
+	OnViewportChanged(viewport, velocity);
+}
+
 void Object::SetClippingRect(const D2D1_RECT_F& rect)
 {
 	m_pImpl->m_clippingRect = rect;
 	m_pImpl->m_hasClippingRect = true;
+	InvalidateParent();
 }
 
 void Object::ClearClippingRect()
 {
 	m_pImpl->m_hasClippingRect = false;
+	InvalidateParent();
 }
 
 bool Object::HasClippingRect()
@@ -641,6 +2110,12 @@ void Clip(D2D1_RECT_F& in, const D2D1_RECT_F& clippingRect)
 SolidObject::SolidObject(D2D1_COLOR_F color) :
 m_color(color)
 {
+	SetBatchedRendering(true);
+}
+
+bool SolidObject::IsOpaque() const
+{
+	return m_color.a >= 1.0f;
 }
 
 D2D1_SIZE_F SolidObject::GetPreferredSize(D2D1_SIZE_F& max)
@@ -651,18 +2126,20 @@ D2D1_SIZE_F SolidObject::GetPreferredSize(D2D1_SIZE_F& max)
 	return size;
 }
 
-void SolidObject::OnRenderBackground(ID2D1RenderTarget* pTarget, const D2D1_RECT_F&, DOUBLE effectiveOpacity)
+void SolidObject::OnRenderBackground(ID2D1RenderTarget* /*pTarget*/, const D2D1_RECT_F&, DOUBLE effectiveOpacity)
 {
-	CComPtr<ID2D1SolidColorBrush> brush;
 	D2D1_RECT_F render;
 	render.left = render.top = 0;
 	render.right = GetSize().width;
 	render.bottom = GetSize().height;
-	D2D1_BRUSH_PROPERTIES bp;
-	bp.opacity = (FLOAT)effectiveOpacity;
-	bp.transform = D2D1::Matrix3x2F();
-	pTarget->CreateSolidColorBrush(m_color, bp, &brush);
-	pTarget->FillRectangle(render, brush);
+	GetRenderContext()->FillRectangle(render, m_color, (FLOAT)effectiveOpacity);
+}
+
+PannableObject::PannableObject()
+{
+	// Panning only moves the content, so composite it from a layer
+	SetLayerCaching(LayerCaching::Auto);
+	SetTouchPrediction(true);
 }
 
 Object* PannableObject::OnTouch(const D2D1_POINT_2F&)
@@ -673,11 +2150,148 @@ Object* PannableObject::OnTouch(const D2D1_POINT_2F&)
 bool PannableObject::OnTouchContinue(const TouchInfo& ti)
 {
 	tjm::animation::AllInstant ai(true);
-	SetTranslationXDelta(ti.currentTouch.x - ti.previousTouch.x);
-	SetTranslationYDelta(ti.currentTouch.y - ti.previousTouch.y);
+	SetTranslationXDelta(ti.predictedTouch.x - ti.previousPredictedTouch.x);
+	SetTranslationYDelta(ti.predictedTouch.y - ti.previousPredictedTouch.y);
 	return true;
 }
 
+void PannableObject::OnTouchFinish(const TouchInfo& ti)
+{
+	// Take back whatever the last prediction overshot
+	tjm::animation::AllInstant ai(true);
+	SetTranslationXDelta(ti.predictedTouch.x - ti.previousPredictedTouch.x);
+	SetTranslationYDelta(ti.predictedTouch.y - ti.previousPredictedTouch.y);
+}
+
+namespace {
+	// Least recently used layouts beyond this are dropped from the cache.
+	// Labels keep the ones they hold.
+	const size_t c_maxCachedLayouts = 1024;
+
+	// A format when m_text is empty, otherwise a layout of m_text
+	struct TextKey
+	{
+		std::wstring m_font;
+		std::wstring m_text;
+		FLOAT m_size;
+		FLOAT m_width;
+		FLOAT m_height;
+
+		bool operator==(const TextKey& other) const
+		{
+			return m_size == other.m_size && m_width == other.m_width && m_height == other.m_height &&
+				m_font == other.m_font && m_text == other.m_text;
+		}
+	};
+
+	struct TextKeyHash
+	{
+		size_t operator()(const TextKey& key) const
+		{
+			size_t hash = std::hash<std::wstring>()(key.m_font);
+			hash = hash * 31 + std::hash<std::wstring>()(key.m_text);
+			hash = hash * 31 + std::hash<FLOAT>()(key.m_size);
+			hash = hash * 31 + std::hash<FLOAT>()(key.m_width);
+			return hash * 31 + std::hash<FLOAT>()(key.m_height);
+		}
+	};
+
+	// DirectWrite objects shared by every label in every window, so the
+	// same caption shown in several windows is only shaped once
+	class TextCache
+	{
+	public:
+		static TextCache& Get()
+		{
+			static TextCache cache;
+			return cache;
+		}
+
+		IDWriteTextFormat* Format(const std::wstring& font, FLOAT size)
+		{
+			SetKey(font, std::wstring(), size, D2D1::SizeF(0, 0));
+			auto it = m_formats.find(m_key);
+			if (it != m_formats.end())
+				return it->second;
+
+			CComPtr<IDWriteTextFormat> format;
+			CORt(m_factory->CreateTextFormat(font.c_str(), nullptr, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, size, L"", &format));
+			m_formats[m_key] = format;
+			m_stats.formats = m_formats.size();
+			return format;
+		}
+
+		IDWriteTextLayout* Layout(const std::wstring& font, const std::wstring& text, FLOAT size, D2D1_SIZE_F max)
+		{
+			IDWriteTextFormat* format = Format(font, size);
+
+			SetKey(font, text, size, max);
+			auto it = m_layoutIndex.find(m_key);
+			if (it != m_layoutIndex.end())
+			{
+				m_layouts.splice(m_layouts.begin(), m_layouts, it->second);
+				++m_stats.hits;
+				return it->second->m_layout;
+			}
+
+			++m_stats.misses;
+			CComPtr<IDWriteTextLayout> layout;
+			CORt(m_factory->CreateTextLayout(text.c_str(), (UINT32)text.length(), format, max.width, max.height, &layout));
+			m_layouts.push_front(CachedLayout());
+			m_layouts.front().m_key = m_key;
+			m_layouts.front().m_layout = layout;
+			m_layoutIndex[m_key] = m_layouts.begin();
+
+			if (m_layouts.size() > c_maxCachedLayouts)
+			{
+				m_layoutIndex.erase(m_layouts.back().m_key);
+				m_layouts.pop_back();
+			}
+			m_stats.layouts = m_layouts.size();
+			return layout;
+		}
+
+		const TextCacheStats& GetStats() const { return m_stats; }
+
+	private:
+		TextCache() :
+			m_stats()
+		{
+			CORt(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&m_factory)));
+		}
+		TextCache(const TextCache&);
+		TextCache& operator=(const TextCache&);
+
+		// Lookups go through one key, so a hit doesn't allocate
+		void SetKey(const std::wstring& font, const std::wstring& text, FLOAT size, D2D1_SIZE_F max)
+		{
+			m_key.m_font = font;
+			m_key.m_text = text;
+			m_key.m_size = size;
+			m_key.m_width = max.width;
+			m_key.m_height = max.height;
+		}
+
+		struct CachedLayout
+		{
+			TextKey m_key;
+			CComPtr<IDWriteTextLayout> m_layout;
+		};
+
+		CComPtr<IDWriteFactory> m_factory;
+		std::unordered_map<TextKey, CComPtr<IDWriteTextFormat>, TextKeyHash> m_formats;
+		std::list<CachedLayout> m_layouts;	// Most recently used first
+		std::unordered_map<TextKey, std::list<CachedLayout>::iterator, TextKeyHash> m_layoutIndex;
+		TextKey m_key;
+		TextCacheStats m_stats;
+	};
+}
+
+IDWriteTextLayout* CachedTextLayout(const std::wstring& font, const std::wstring& text, FLOAT size, D2D1_SIZE_F max)
+{
+	return TextCache::Get().Layout(font, text, size, max);
+}
+
 struct TextLabelImpl
 {
     std::string m_text;
@@ -685,53 +2299,47 @@ struct TextLabelImpl
     FLOAT m_size;
     D2D1_SIZE_F m_max;
 
-    CComPtr<IDWriteFactory> m_factory;
-    CComPtr<IDWriteTextFormat> m_format;
+    // Converted when set, so relayouts don't allocate
+    std::wstring m_wideText;
+    std::wstring m_wideFont;
+
     CComPtr<IDWriteTextLayout> m_layout;
 
-    void EnsureFormat();
     void EnsureLayout();
 
     TextLabelImpl();
     TextLabelImpl(const std::string & text, const std::string & font, FLOAT size);
 };
 
-void TextLabelImpl::EnsureFormat()
-{
-    if (!m_format) {
-        CORt(m_factory->CreateTextFormat(towide(m_font).c_str(), nullptr, DWRITE_FONT_WEIGHT_NORMAL, DWRITE_FONT_STYLE_NORMAL, DWRITE_FONT_STRETCH_NORMAL, m_size, L"", &m_format));
-    }
-}
-
 void TextLabelImpl::EnsureLayout()
 {
-    EnsureFormat();
-
     if (!m_layout) {
-        CORt(m_factory->CreateTextLayout(towide(m_text).c_str(), m_text.length(), m_format, m_max.width, m_max.height, &m_layout));
+        m_layout = TextCache::Get().Layout(m_wideFont, m_wideText, m_size, m_max);
     }
 }
 
 TextLabelImpl::TextLabelImpl() :
     m_font("Ariel"),
     m_size(17.0),
-    m_max{ 10000,10000 }
+    m_max{ 10000,10000 },
+    m_wideFont(towide(m_font))
 {
-    CORt(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&m_factory)));
 }
 
 TextLabelImpl::TextLabelImpl(const std::string& text, const std::string& font, FLOAT size) :
     m_text(text),
     m_font(font),
     m_size(size),
-    m_max{ 10000,10000 }
+    m_max{ 10000,10000 },
+    m_wideText(towide(text)),
+    m_wideFont(towide(font))
 {
-    CORt(DWriteCreateFactory(DWRITE_FACTORY_TYPE_SHARED, __uuidof(IDWriteFactory), reinterpret_cast<IUnknown**>(&m_factory)));
 }
 
 TextLabel::TextLabel() :
     m_pImpl(new TextLabelImpl())
 {
+    SetBatchedRendering(true);
 }
 
 TextLabel::~TextLabel()
@@ -742,37 +2350,51 @@ TextLabel::~TextLabel()
 TextLabel::TextLabel(const std::string& text, const std::string& font, FLOAT size) :
     m_pImpl(new TextLabelImpl(text, font, size))
 {
+    SetBatchedRendering(true);
 }
 
 void TextLabel::SetText(const std::string& text)
 {
     m_pImpl->m_text = text;
+    m_pImpl->m_wideText = towide(text);
     m_pImpl->m_layout.Release();
+    Invalidate();
 }
 
 void TextLabel::SetFont(const std::string& font)
 {
     m_pImpl->m_font = font;
-    m_pImpl->m_format.Release();
+    m_pImpl->m_wideFont = towide(font);
+    m_pImpl->m_layout.Release();
+    Invalidate();
 }
 
 void TextLabel::SetSize(FLOAT size)
 {
     m_pImpl->m_size = size;
-    m_pImpl->m_format.Release();
+    m_pImpl->m_layout.Release();
+    Invalidate();
 }
 
-void TextLabel::OnRenderForeground(ID2D1RenderTarget * pTarget, const D2D1_RECT_F & /*rect*/, DOUBLE /* opacity */)
+void TextLabel::OnRenderForeground(ID2D1RenderTarget * /*pTarget*/, const D2D1_RECT_F & /*rect*/, DOUBLE /* opacity */)
 {
-    if ((GetSize().height != m_pImpl->m_max.height) || (GetSize().width != m_pImpl->m_max.width))
+    // A missing layout, left by a text, font or size change, is always
+    // built. While interacting an existing one is kept rather than shaped
+    // again for every size a drag passes through.
+    bool resized = (GetSize().height != m_pImpl->m_max.height) || (GetSize().width != m_pImpl->m_max.width);
+    if (!m_pImpl->m_layout || (resized && GetRenderContext()->GetQuality() == RenderQuality::Full))
     {
         m_pImpl->m_max = GetSize();
         m_pImpl->m_layout.Release();
         m_pImpl->EnsureLayout();
     }
-    CComPtr<ID2D1SolidColorBrush> brush;
-    pTarget->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::Black), &brush);
-    pTarget->DrawTextLayout({ 0,0 }, m_pImpl->m_layout, brush);
+    GetRenderContext()->DrawTextLayout(D2D1::Point2F(0, 0), m_pImpl->m_layout, m_pImpl->m_wideFont, m_pImpl->m_wideText,
+        m_pImpl->m_size, m_pImpl->m_max, D2D1::ColorF(D2D1::ColorF::Black));
+}
+
+const TextCacheStats& TextLabel::GetCacheStats()
+{
+    return TextCache::Get().GetStats();
 }
 
 D2D1_SIZE_F TextLabel::GetPreferredSize(D2D1_SIZE_F & max)
@@ -781,9 +2403,9 @@ D2D1_SIZE_F TextLabel::GetPreferredSize(D2D1_SIZE_F & max)
     {
         m_pImpl->m_max = max;
         m_pImpl->m_layout.Release();
-        m_pImpl->EnsureLayout();
     }
-    
+    m_pImpl->EnsureLayout();
+
     DWRITE_TEXT_METRICS metrics;
     CORt(m_pImpl->m_layout->GetMetrics(&metrics));
     D2D1_SIZE_F preferred;
@@ -797,12 +2419,17 @@ struct ListViewImpl
 {
     Orientation m_orientation;
     Direction m_direction;
+
+    // Layout scratch, reused across passes
+    std::vector<StackEntry> m_entries;
+    std::vector<D2D1_POINT_2F> m_positions;
 };
 
 ListView::ListView() :
     m_pImpl(new ListViewImpl())
 {
     m_pImpl->m_orientation = Orientation::Horizontal;
+    m_pImpl->m_direction = Direction::TopDown;
 }
 
 ListView::~ListView()
@@ -841,55 +2468,32 @@ Direction ListView::GetDirection() const
 void ListView::OnLayout()
 {
     D2D1_SIZE_F maxSize = GetFinalSize();
-
-    FLOAT offset = 0;
-    for (size_t i = 0; i < NumChildren(); ++i) {
-        Object* child = GetChild(i);
-        FLOAT left, right, top, bottom;
-        child->GetMargins(left, top, right, bottom);
+    size_t count = NumChildren();
+
+    // Gather margins and preferred sizes first, so the kernel for this
+    // orientation and direction runs over contiguous data
+    std::vector<StackEntry>& entries = m_pImpl->m_entries;
+    std::vector<D2D1_POINT_2F>& positions = m_pImpl->m_positions;
+    entries.resize(count);
+    positions.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        StackEntry& e = entries[i];
+        GetChild(i)->GetMargins(e.m_left, e.m_top, e.m_right, e.m_bottom);
 
         D2D1_SIZE_F localMaxSize = maxSize;
-        localMaxSize.height -= (top + bottom);
-        localMaxSize.width -= (left + right);
-
-        D2D1_SIZE_F preferredSize = child->GetPreferredSize(localMaxSize);
-        
-        if (GetOrientation() == Orientation::Vertical) {
-            if (GetDirection() == Direction::TopDown) {
-                offset += top;
-                child->SetPosition(D2D1::Point2F(left, offset));
-                child->SetSize(preferredSize);
-                offset += preferredSize.height;
-                offset += bottom;
-            }
-            else {
-                offset += bottom;
-                offset += preferredSize.height;
-                child->SetPosition(D2D1::Point2F(left, maxSize.height-offset));
-                child->SetSize(preferredSize);
-                offset += top;
-            }
-        }
-        else {
-            if (GetDirection() == Direction::LeftRight) {
-                offset += left;
-                child->SetPosition(D2D1::Point2F(offset, top));
-                child->SetSize(preferredSize);
-                offset += preferredSize.width;
-                offset += right;
-            }
-            else {
-                offset += right;
-                offset += preferredSize.width;
-                child->SetPosition(D2D1::Point2F(offset, top));
-                child->SetSize(preferredSize);
-                offset += left;
-            }
-        }
+        localMaxSize.height -= (e.m_top + e.m_bottom);
+        localMaxSize.width -= (e.m_left + e.m_right);
+        e.m_size = GetChild(i)->GetPreferredSize(localMaxSize);
     }
 
-    for (size_t i = 0; i < NumChildren(); ++i) {
-        GetChild(i)->SetVisible(true);
+    FLOAT extent = GetOrientation() == Orientation::Vertical ? maxSize.height : maxSize.width;
+    SelectStackKernel(GetOrientation(), GetDirection())(entries.data(), count, extent, positions.data());
+
+    for (size_t i = 0; i < count; ++i) {
+        Object* child = GetChild(i);
+        child->SetPosition(positions[i]);
+        child->SetSize(entries[i].m_size);
+        child->SetVisible(true);
     }
 }
 
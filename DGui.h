@@ -28,6 +28,26 @@ enum class Direction
     RightLeft = BottomUp
 };
 
+// Controls whether an object's subtree is rasterized once into an offscreen
+// bitmap and then composited with the object's opacity and translation.
+enum class LayerCaching
+{
+	None,	// Always render the subtree directly
+	Auto,	// Cache while opacity, translation or clipping is changing
+	Always,	// Always composite the subtree from its cached layer
+	Scroll	// Cache what is in view; translation changes shift the bitmap
+			// and only the newly exposed strips are drawn
+};
+
+// What a RenderContext draws at. Interactive trades fidelity for frame rate
+// while something is being dragged or animated.
+enum class RenderQuality
+{
+	Full,
+	Interactive	// Aliased fills, grayscale text, text not relaid out on
+				// resize, and nearly transparent objects skipped
+};
+
 class Object;
 struct TouchInfo
 {
@@ -35,24 +55,464 @@ struct TouchInfo
 	D2D1_POINT_2F originalTouch;
 	D2D1_POINT_2F previousTouch;
 	D2D1_POINT_2F currentTouch;
+
+	// Where the touch is expected to be when this frame is presented, for
+	// objects that opt in with SetTouchPrediction; otherwise the same as
+	// currentTouch. Handlers working in deltas should use the difference of
+	// these two so each new sample corrects the last guess. At TouchFinish
+	// the prediction is the last real position.
+	D2D1_POINT_2F previousPredictedTouch;
+	D2D1_POINT_2F predictedTouch;
+};
+
+// How far predictions were from where the touch really was once the
+// horizon had passed, in DIPs. totalLag is the same distance for the real
+// sample each prediction was made from, which is what an object without
+// prediction shows. latencyReduction is the seconds of the horizon that
+// prediction made up for: the horizon times 1 - totalError / totalLag.
+struct TouchPredictionStats
+{
+	size_t predictions;
+	double totalError;
+	double maxError;
+	double totalLag;
+	double latencyReduction;
+};
+
+enum class KeyEventType
+{
+	Down,
+	Up,
+	Char
+};
+
+// Flags for KeyEvent::modifiers
+enum KeyModifier
+{
+	KeyModShift = 1,
+	KeyModControl = 2,
+	KeyModAlt = 4
+};
+
+struct KeyEvent
+{
+	KeyEventType type;
+	UINT key;			// Virtual key code, or the character for Char
+	UINT modifiers;		// KeyModifier flags
+	bool repeat;		// Auto-repeated key down
+};
+
+enum class InputEventType
+{
+	TouchStart,
+	TouchMove,
+	TouchEnd,
+	Hover,
+	HoverEnd,
+	Key
+};
+
+struct InputEvent
+{
+	InputEventType type;
+	double time;			// Seconds since recording started
+	D2D1_POINT_2F point;	// Touch and hover events
+	KeyEvent key;			// Key events
+};
+
+// A timestamped input stream, captured from an InputManager and played back
+// into one with InputReplay. Saved as one line of text per event.
+struct InputRecordingImpl;
+class DUI_API InputRecording
+{
+public:
+	InputRecording();
+	~InputRecording();
+
+	void Clear();
+	void Append(const InputEvent& e);
+	size_t Size() const;
+	const InputEvent& Get(size_t index) const;
+	double GetDuration() const;
+
+	bool Save(const std::string& path) const;
+	bool Load(const std::string& path);
+
+private:
+	InputRecording(const InputRecording&);
+	InputRecording& operator=(const InputRecording&);
+
+	InputRecordingImpl* m_pImpl;
 };
 
+// Input-to-present latencies in seconds, for percentile reports
+struct LatencyStatsImpl;
+class DUI_API LatencyStats
+{
+public:
+	LatencyStats();
+	~LatencyStats();
+
+	void AddSample(double seconds);
+	void Reset();
+	// Every sample added, though percentiles come from a bounded random
+	// subset of them once there are more than a few thousand
+	size_t Count() const;
+	// Nearest rank, p from 0 to 100. Zero without samples.
+	double Percentile(double p) const;
+	double Max() const;
+
+private:
+	LatencyStats(const LatencyStats&);
+	LatencyStats& operator=(const LatencyStats&);
+
+	LatencyStatsImpl* m_pImpl;
+};
+
+struct HoverStats
+{
+	size_t moves;
+	size_t cachedMoves;		// Resolved without leaving the last hit path
+	size_t objectsTested;	// Bounds checks, cached path and traversal alike
+};
+
+struct InputManagerImpl;
 class DUI_API InputManager
 {
 public:
 	InputManager();
+	~InputManager();
+
+	// Keys go to the focused object, then each of its ancestors, then the
+	// accelerator table. Without a focus only the root is offered the key.
+	bool OnKeyEvent(const KeyEvent& e);
     void OnKey(char key);
 	void SetRoot(Object* root);
     void SetFocus(Object* focus);
-	bool StartTouch(const D2D1_POINT_2F& point);
-	bool ContinueTouch(const D2D1_POINT_2F& point);
+	Object* GetFocus() const;
+
+	// Runs on key down of key (a virtual key code) with exactly these
+	// modifiers. Replaces any action already bound to the combination.
+	void AddAccelerator(UINT key, UINT modifiers, std::function<void()> action);
+	void RemoveAccelerator(UINT key, UINT modifiers);
+
+	// time is when the sample was taken, in seconds on any clock, the same
+	// one for the whole touch; prediction fits to it. Negative means now.
+	bool StartTouch(const D2D1_POINT_2F& point, double time = -1);
+	bool ContinueTouch(const D2D1_POINT_2F& point, double time = -1);
 	bool EndTouch(const D2D1_POINT_2F& point);
 
+	// Extrapolates drags this far ahead from the velocity and acceleration of
+	// the last few samples, for objects with touch prediction on. Set it to
+	// the input-to-present latency; zero, the default, turns prediction off.
+	void SetPredictionHorizon(double seconds);
+	double GetPredictionHorizon() const;
+	const TouchPredictionStats& GetPredictionStats() const;
+
+	// Pointer moves with no touch in progress. Objects entering and leaving
+	// the hit path are told so, then the move bubbles up from the deepest
+	// one. The path from the last move is checked first, so a move only
+	// walks the tree when it leaves the cached objects' bounds.
+	bool Hover(const D2D1_POINT_2F& point);
+	void EndHover();
+	Object* GetHovered() const;
+	const HoverStats& GetHoverStats() const;
+
+	// Calls whichever of the above the event stands for
+	bool Dispatch(const InputEvent& e);
+
+	// Every input call is appended to the recording, timed from here
+	void StartRecording(InputRecording* recording);
+	void StopRecording();
+
+	// True once input that invalidated or dirtied the layout of the root
+	// has arrived and no frame has presented it yet. InputPresented clears
+	// it and returns the seconds since the oldest of that input arrived.
+	bool HasPendingInput() const;
+	double InputPresented();
+
 private:
+	InputManager(const InputManager&);
+	InputManager& operator=(const InputManager&);
+
 	TouchInfo TranslateToObjLocal(Object* obj);
 	Object* m_root;
     Object* m_focus;
 	TouchInfo m_info;
+	InputManagerImpl* m_pImpl;
+};
+
+// Feeds a recording to an input manager on the recording's timeline, sped
+// up by speed. It needs no window, so a headless harness can step it with
+// its own clock and render in between. The recording must outlive it.
+class DUI_API InputReplay
+{
+public:
+	InputReplay(const InputRecording& recording, InputManager& target, double speed = 1.0);
+
+	// Dispatches everything due by elapsed seconds of replay, returning how
+	// many events went out
+	size_t Advance(double elapsed);
+	bool IsDone() const;
+	// Replay time the next event is due at
+	double GetNextEventTime() const;
+
+private:
+	InputReplay(const InputReplay&);
+	InputReplay& operator=(const InputReplay&);
+
+	const InputRecording& m_recording;
+	InputManager& m_target;
+	double m_speed;
+	size_t m_next;
+};
+
+struct RemoteDisplayStats
+{
+	size_t frames;				// Sent to the viewer
+	size_t framesSkipped;		// Not drawn while the viewer caught up
+	size_t tilesSent;
+	size_t tilesUnchanged;
+	size_t bytesSent;
+	size_t lastFrameBytes;		// Zero if the last frame changed nothing
+	size_t framesUnchanged;		// Not drawn, nothing having been invalidated
+	size_t inputEvents;			// Received from the viewer
+};
+
+// Serves an Object tree to one remote viewer at a time, with no window or
+// desktop session. Each Pump lays out and renders offscreen, then sends
+// only the tiles that differ from what the viewer has, as run-length
+// encoded XOR deltas; a frame that changes nothing sends nothing, and
+// while nothing is invalidated, laid out or animating nothing is drawn. Input
+// the viewer sends back is dispatched to the input manager. There is no
+// authentication, so only listen beyond loopback behind something that
+// provides it. COM must be initialized on the calling thread.
+struct RemoteDisplayImpl;
+class DUI_API RemoteDisplay
+{
+public:
+	RemoteDisplay(Object* root, InputManager& input);
+	~RemoteDisplay();
+
+	bool Listen(unsigned short port, bool loopbackOnly = true);
+	void Close();
+	bool IsConnected() const;
+
+	// Accepts a waiting viewer, takes its input and sends a frame of size
+	// pixels. True if a frame went out. Frames over 64 MiB of pixels aren't
+	// sent; the viewer would drop the connection.
+	bool Pump(D2D1_SIZE_U size);
+	const RemoteDisplayStats& GetStats() const;
+
+private:
+	RemoteDisplay(const RemoteDisplay&);
+	RemoteDisplay& operator=(const RemoteDisplay&);
+
+	RemoteDisplayImpl* m_pImpl;
+};
+
+// The other end of a RemoteDisplay. Keeps a copy of the picture, in
+// premultiplied BGRA with rows of width * 4 bytes, and sends input back.
+struct RemoteViewerImpl;
+class DUI_API RemoteViewer
+{
+public:
+	RemoteViewer();
+	~RemoteViewer();
+
+	bool Connect(const std::string& host, unsigned short port);
+	void Close();
+	bool IsConnected() const;
+
+	// Applies whatever has arrived; true if the picture changed
+	bool Receive();
+	UINT GetWidth() const;
+	UINT GetHeight() const;
+	const BYTE* GetPixels() const;
+
+	bool SendInput(const InputEvent& e);
+
+private:
+	RemoteViewer(const RemoteViewer&);
+	RemoteViewer& operator=(const RemoteViewer&);
+
+	RemoteViewerImpl* m_pImpl;
+};
+
+// Per frame counters, reset by RenderContext::BeginFrame
+struct RenderStats
+{
+	size_t objectsRendered;
+	size_t objectsCulled;		// Skipped for opacity, bounds or clipping
+	size_t objectsOccluded;		// Skipped for being covered by opaque siblings
+	double occludedArea;		// Overdraw avoided by occlusion, in DIPs squared
+	size_t layersRasterized;
+	size_t layersComposited;
+	size_t layersScrolled;		// Scroll layers updated by shifting
+	size_t primitives;			// Fills submitted through the context
+	size_t drawCalls;			// Device calls those fills were batched into
+	size_t transformChanges;
+	size_t objectsNotRecorded;	// Drew to the device directly, so left out of a snapshot
+	size_t groupsComposited;	// Compositor animations drawn by Replay
+	size_t objectsAnimating;	// Drawn mid-animation, so the next frame will differ
+	RenderQuality quality;
+};
+
+struct RenderContextImpl;
+struct LayerEntry;
+struct SceneSnapshot;
+struct SnapshotText;
+class DUI_API RenderContext
+{
+public:
+	RenderContext();
+	~RenderContext();
+
+	// Device resources (cached layers) are created against this target.
+	// Changing the target releases them.
+	void SetTarget(ID2D1RenderTarget* pTarget);
+	ID2D1RenderTarget* GetTarget() const;
+
+	void BeginFrame();
+	void EndFrame();
+	const RenderStats& GetStats() const;
+
+	// Asks for another frame after this one, for content that moves
+	// without an AnimatedVar driving it. Cleared by BeginFrame.
+	void RequestFrame();
+	bool IsFrameRequested() const;
+
+	// A frame drawn while something is dragged or animating drops to
+	// Interactive quality when it comes more than this many seconds after
+	// the one before, and stays there until a frame has nothing moving.
+	// That frame asks for another, drawn at Full. Zero, the default, keeps
+	// Full quality. Cached layers are always drawn at Full.
+	void SetQualityTarget(double seconds);
+	double GetQualityTarget() const;
+	// For objects to draw more cheaply while it's Interactive
+	RenderQuality GetQuality() const;
+	// Counts this frame as part of an interaction. Visible objects being
+	// dragged or animated count it themselves; ending a drag asks for a
+	// Full frame.
+	void SetInteracting();
+
+	// Solid fills in the current object's coordinates. They are queued and
+	// merged by brush where draw order allows; anything drawing straight to
+	// the target in between flushes them first.
+	void FillRectangle(const D2D1_RECT_F& rect, const D2D1_COLOR_F& color, FLOAT opacity = 1.0f);
+	void FillEllipse(const D2D1_ELLIPSE& ellipse, const D2D1_COLOR_F& color, FLOAT opacity = 1.0f);
+	// The layout is kept alive by any snapshot it's recorded into, so it
+	// must not be changed afterwards; replace it instead
+	void DrawTextLayout(D2D1_POINT_2F origin, IDWriteTextLayout* layout, const D2D1_COLOR_F& color, FLOAT opacity = 1.0f);
+	// The same, for a layout made from exactly these, which recordings keep
+	// so the text can be laid out again by a SharedFrameView
+	void DrawTextLayout(D2D1_POINT_2F origin, IDWriteTextLayout* layout, const std::wstring& font, const std::wstring& text,
+		FLOAT size, D2D1_SIZE_F max, const D2D1_COLOR_F& color, FLOAT opacity = 1.0f);
+	void Flush();
+
+	// While recording, frames are captured into the snapshot rather than
+	// drawn, for Replay to draw later, possibly on another thread with its
+	// own context. Only fills, text and clips made through the context are
+	// captured. Layers aren't used, and objects that draw to the device
+	// themselves are left out. Objects with a compositor animation running
+	// are recorded as groups that Replay animates as of when it is called.
+	void BeginRecording(SceneSnapshot* snapshot);
+	void EndRecording();
+	bool IsRecording() const;
+	void Replay(const SceneSnapshot& snapshot);
+
+	// One brush shared by everything drawing to the device directly, so
+	// frames don't create brushes. Valid until the next call.
+	ID2D1SolidColorBrush* GetSolidBrush(const D2D1_COLOR_F& color, FLOAT opacity = 1.0f);
+
+	// Cached layers are evicted least recently used first once their
+	// total size exceeds the budget (in bytes).
+	void SetLayerBudget(size_t bytes);
+	size_t GetLayerBudget() const;
+	size_t GetLayerBytes() const;
+	void ReleaseLayers();
+
+private:
+	RenderContext(const RenderContext&);
+	RenderContext& operator=(const RenderContext&);
+
+	void RecordText(D2D1_POINT_2F origin, IDWriteTextLayout* layout, const SnapshotText& source, const D2D1_COLOR_F& color, FLOAT opacity);
+	void ReplayOps(const SceneSnapshot& snapshot, size_t begin, size_t end, D2D1_POINT_2F offset, FLOAT opacity);
+	bool CompositeGroup(const SceneSnapshot& snapshot, size_t begin, D2D1_POINT_2F origin, D2D1_POINT_2F offset, FLOAT opacity);
+
+	friend class Object;
+	RenderContextImpl* m_pImpl;
+};
+
+struct SharedFrameStats
+{
+	size_t frames;				// Written or read
+	size_t framesRejected;		// Too big to write, or failed checks when read
+	size_t bytes;
+	double seconds;				// Spent copying to or from shared memory
+};
+
+// Writes recorded frames into named shared memory for a compositor in
+// another process to present. Three slots rotate so the writer never waits
+// on the reader; a hung compositor can't stall the application. Text is
+// shared as its string, font and size and laid out again by the reader, so
+// only text drawn with the DrawTextLayout that takes those shows up.
+struct SharedFrameSourceImpl;
+class DUI_API SharedFrameSource
+{
+public:
+	SharedFrameSource();
+	~SharedFrameSource();
+
+	// slotBytes is the largest frame that can be written
+	bool Create(const std::string& name, size_t slotBytes);
+	void Close();
+	bool IsOpen() const;
+
+	bool Write(const SceneSnapshot& snapshot);
+	const SharedFrameStats& GetStats() const;
+
+private:
+	SharedFrameSource(const SharedFrameSource&);
+	SharedFrameSource& operator=(const SharedFrameSource&);
+
+	SharedFrameSourceImpl* m_pImpl;
+};
+
+// The compositor's side of a SharedFrameSource. Frames are copied out and
+// checked before use, so a writer that crashes or misbehaves can't take
+// the compositor down with it; the last good frame stays on screen.
+struct SharedFrameViewImpl;
+class DUI_API SharedFrameView
+{
+public:
+	SharedFrameView();
+	~SharedFrameView();
+
+	bool Open(const std::string& name);
+	void Close();
+	bool IsOpen() const;
+
+	// Takes the newest frame if one has been written since the last call
+	bool Update();
+	bool HasFrame() const;
+	D2D1_SIZE_U GetPixelSize() const;
+	// Seconds since the writer last wrote a frame, to tell a hung or dead
+	// writer from an idle one
+	double GetWriterIdle() const;
+	// True while the frame has compositor animations left to draw
+	bool IsAnimating() const;
+
+	// Replays the current frame; call between the context's BeginFrame
+	// and EndFrame
+	void Present(RenderContext& ctx);
+	const SharedFrameStats& GetStats() const;
+
+private:
+	SharedFrameView(const SharedFrameView&);
+	SharedFrameView& operator=(const SharedFrameView&);
+
+	SharedFrameViewImpl* m_pImpl;
 };
 
 struct ObjectImpl;
@@ -72,8 +532,40 @@ public:
     void InsertChild(Object* child, size_t i);
 	void RemoveChild(Object* child);
 
+	void Render(RenderContext& ctx, const D2D1_RECT_F& box, DOUBLE opacity=1.0);
 	void Render(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& box, DOUBLE opacity=1.0);
 	void Layout();
+	// True if the next Layout call has anything to do
+	bool NeedsLayout() const;
+
+	// Animated property changes started so far, across all objects. No-op
+	// sets don't count.
+	static size_t GetAnimationsStarted();
+
+	// Hands position, translation and opacity animations to whoever draws
+	// the frame, taking this many seconds; zero, the default, leaves them to
+	// AnimatedVar. The values jump to their targets straight away, so
+	// layout and hit testing only ever see where things end up. Threaded
+	// rendering turns this on.
+	static void SetCompositorAnimation(double seconds);
+	static double GetCompositorAnimation();
+
+	// Layer caching. Content changes invalidate the cached layer; opacity
+	// and translation changes only recomposite it.
+	void SetLayerCaching(LayerCaching caching);
+	LayerCaching GetLayerCaching() const;
+
+	// Composites the cached layer scaled to this size instead of redrawing
+	// at it, as a cheap preview while resizing. Needs a layer to have any
+	// effect; an empty size turns it off.
+	void SetLayerStretch(D2D1_SIZE_F size);
+
+	// Call when the object's appearance changes outside of the properties
+	// Object knows about, so any cached layers containing it are redrawn.
+	void Invalidate();
+	// Bumped by Invalidate here and on every ancestor, so an unchanged
+	// version at the root means nothing in the tree asked to be redrawn
+	unsigned GetVersion() const;
 
 	void DirtyLayout();
 	void DirtyParentLayout();
@@ -126,33 +618,128 @@ public:
 	// Input Handling
 	D2D1_POINT_2F WorldToLocal(const D2D1_POINT_2F& world) const;
 	Object* Touch(const D2D1_POINT_2F& pos);
-    bool Key(char key);
+	// Offers the key to this object alone; InputManager walks the chain
+	bool Key(const KeyEvent& e);
 	bool TouchContinue(const TouchInfo& ti);
 	void TouchFinish(const TouchInfo& ti);
+	void HoverEnter();
+	void HoverLeave();
+	bool Hover(const D2D1_POINT_2F& pos);
+	bool IsHovered() const;
+
+	// Opts in to TouchInfo::predictedTouch being extrapolated
+	void SetTouchPrediction(bool predict);
+	bool GetTouchPrediction() const;
+
+	// Scrolling containers report which part of the object is in view
+	// (in its own coordinates) and how fast that is moving, in DIPs per
+	// second, so virtualized content can realize items ahead of time.
+	void ViewportChanged(const D2D1_RECT_F& viewport, const D2D1_POINT_2F& velocity);
 
 	// Optional overrides
 	virtual D2D1_SIZE_F GetPreferredSize(D2D1_SIZE_F& max) { return max; }
 
+	// True if the background fully covers the object's bounds with opaque
+	// content at full opacity, letting Render skip whatever is beneath it.
+	virtual bool IsOpaque() const { return false; }
+
 protected:
 	// Optional overrides
+	// Content that moves on its own, without an AnimatedVar, and is
+	// advanced by layout. Such objects get another frame and layout pass
+	// after each render.
+	virtual bool IsContentAnimating() const { return false; }
+	// Content that can change without Invalidate being called, so layers
+	// holding it are redrawn every time they're shown. Asks for no frames.
+	virtual bool IsContentVolatile() const { return IsContentAnimating(); }
 	virtual void OnRenderBackground(ID2D1RenderTarget*, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/) { }
 	virtual void OnRenderForeground(ID2D1RenderTarget*, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/) { }
 	virtual void OnVisibilityChange(bool /* visible */) { }
     virtual void OnLayout();
 	virtual Object* OnTouch(const D2D1_POINT_2F& /*pos*/) { return nullptr; }
+	// Character events reach OnKey unless OnKeyEvent is overridden
+	virtual bool OnKeyEvent(const KeyEvent& e);
     virtual bool OnKey(char /*key*/) { return false; }
 	virtual bool OnTouchContinue(const TouchInfo& /*ti*/) { return false; }
 	virtual void OnTouchFinish(const TouchInfo& /*ti*/) { }
+	virtual void OnHoverEnter() { }
+	virtual void OnHoverLeave() { }
+	virtual bool OnHover(const D2D1_POINT_2F& /*pos*/) { return false; }
+	virtual void OnViewportChanged(const D2D1_RECT_F& /*viewport*/, const D2D1_POINT_2F& /*velocity*/) { }
+
+	// Valid while the render hooks run. Objects that only draw through the
+	// context's fills can say so, which lets their fills batch with their
+	// neighbours' instead of flushing around the hooks. Their hooks are
+	// then passed a null target.
+	RenderContext* GetRenderContext() const;
+	void SetBatchedRendering(bool batched);
 
 private:
+	void RenderContent(RenderContext& ctx, const D2D1_RECT_F& box, DOUBLE effectiveOpacity);
+	void OcclusionPrePass(RenderContext& ctx, const D2D1_RECT_F& contentBox, DOUBLE effectiveOpacity, D2D1_POINT_2F world);
+	bool RenderLayer(RenderContext& ctx, const D2D1_RECT_F& box, DOUBLE effectiveOpacity);
+	bool RenderScrollLayer(RenderContext& ctx, const D2D1_RECT_F& box, DOUBLE effectiveOpacity);
+	bool RasterStrips(RenderContext& ctx, LayerEntry* layer, const D2D1_RECT_F* strips, size_t count);
+	void InvalidateParent();
+	Object* HoverChild(const D2D1_POINT_2F& pos, bool& overlapped, size_t& tested);
+
+	friend struct InputManagerImpl;
 	ObjectImpl* m_pImpl;
 };
 
 class DUI_API PannableObject : public Object
 {
+public:
+	PannableObject();
+
 private:
 	virtual Object* OnTouch(const D2D1_POINT_2F& pos);
 	virtual bool OnTouchContinue(const TouchInfo& ti);	
+	virtual void OnTouchFinish(const TouchInfo& ti);
+};
+
+// A pannable viewport onto one content object. Released touches fling and
+// slow down frame by frame; the view is kept in a scroll layer, so moving
+// it only draws the strips that come into view.
+struct ScrollViewerImpl;
+class DUI_API ScrollViewer : public PannableObject
+{
+public:
+	ScrollViewer();
+	~ScrollViewer();
+
+	// The content becomes a child, laid out at the extent's size
+	void SetContent(Object* content);
+	Object* GetContent() const;
+
+	// Until set, the extent matches the viewport and nothing scrolls
+	void SetExtent(D2D1_SIZE_F extent);
+	D2D1_SIZE_F GetExtent() const;
+
+	void SetScrollDirections(bool horizontal, bool vertical);
+
+	// Offsets are clamped to the extent at the next layout
+	void SetScrollOffset(D2D1_POINT_2F offset);
+	D2D1_POINT_2F GetScrollOffset() const;
+	D2D1_POINT_2F GetVelocity() const;		// DIPs per second
+	bool IsFlinging() const;
+	void StopFling();
+
+	// Exponential decay rate of fling velocity, per second
+	void SetFriction(double perSecond);
+	double GetFriction() const;
+
+protected:
+	virtual bool IsContentAnimating() const;
+
+private:
+	virtual void OnLayout();
+	virtual Object* OnTouch(const D2D1_POINT_2F& pos);
+	virtual bool OnTouchContinue(const TouchInfo& ti);
+	virtual void OnTouchFinish(const TouchInfo& ti);
+	virtual void OnRenderBackground(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& box, DOUBLE effectiveOpacity);
+
+	ScrollViewerImpl* m_pImpl;
 };
 
 DUI_API bool Intersects(const Object* obj, const D2D1_POINT_2F& point);
@@ -176,6 +763,14 @@ enum class SplitterStyle
 	Dots
 };
 
+// What a Splitter drag does to its variable panes between full layouts
+enum class SplitLiveResize
+{
+	Immediate,	// Lay out both panes on every move
+	Clip,		// Show the panes' cached layers clipped to their new size
+	Stretch		// Show the panes' cached layers stretched to their new size
+};
+
 struct SplitterImpl;
 class DUI_API Splitter : public Object
 {
@@ -194,6 +789,11 @@ public:
 	void SetMoveable(bool moveable);
 	bool GetMoveable() const;
 
+	// With a preview mode, drags lay the panes out at most once per
+	// interval and on release, showing cached bitmaps in between
+	void SetLiveResize(SplitLiveResize mode, UINT intervalMs = 100);
+	SplitLiveResize GetLiveResize() const;
+
 	void SetLeftTop(Object* obj, SplitLayoutType layout=SplitLayoutType::Variable);
 	Object* GetLeftTop() const;
 	void SetLeftTopLayoutType(SplitLayoutType layout);
@@ -223,19 +823,147 @@ public:
 	D2D1_SIZE_F GetPreferredSize(D2D1_SIZE_F& max);
 
 private:
+	virtual bool IsContentAnimating() const;
 	virtual void OnRenderForeground(ID2D1RenderTarget*, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/);
 
+	void CacheOverlayPane(Object* obj, SplitLayoutType layout);
 	FLOAT SplitLength() const;
 	FLOAT SplitHeight() const;
 	D2D1_RECT_F GetSplitterRect() const;
 	void SetBounds();
+	void PlacePane(size_t i, const D2D1_RECT_F& rect, SplitLayoutType layout);
+	void EndPreview();
 	virtual void OnLayout();
 	virtual Object* OnTouch(const D2D1_POINT_2F& pos);
 	virtual bool OnTouchContinue(const TouchInfo& ti);
+	virtual void OnTouchFinish(const TouchInfo& ti);
 
 	SplitterImpl* m_pImpl;
 };
 
+// Any number of panes in a row or column with a divider between each pair.
+// Fixed panes keep their length when the splitter is resized and variable
+// panes share the rest in proportion to their lengths; overlay panes are
+// treated as variable. Layout is one pass over the panes, and moving a
+// divider only lays out the two panes beside it.
+struct MultiSplitterImpl;
+class DUI_API MultiSplitter : public Object
+{
+public:
+	MultiSplitter();
+	virtual ~MultiSplitter();
+
+	void SetOrientation(Orientation o);
+	Orientation GetOrientation() const;
+
+	void SetStyle(SplitterStyle s);
+	SplitterStyle GetStyle() const;
+	void SetColor(D2D1::ColorF color);
+	D2D1::ColorF GetColor() const;
+
+	void SetMoveable(bool moveable);
+	bool GetMoveable() const;
+
+	void SetDividerWidth(FLOAT width);
+	FLOAT GetDividerWidth() const;
+
+	// A length of zero gives a variable pane an even share
+	void AddPane(Object* obj, SplitLayoutType layout=SplitLayoutType::Variable, FLOAT length=0);
+	void RemovePane(Object* obj);
+	size_t NumPanes() const;
+	Object* GetPane(size_t i) const;
+
+	void SetPaneLayoutType(size_t i, SplitLayoutType layout);
+	SplitLayoutType GetPaneLayoutType(size_t i) const;
+	void SetPaneLength(size_t i, FLOAT length);
+	FLOAT GetPaneLength(size_t i) const;
+	void SetPaneMin(size_t i, FLOAT min);
+	void SetPaneMax(size_t i, FLOAT max);
+
+	// Divider i sits between panes i and i + 1
+	void MoveDivider(size_t i, FLOAT delta);
+	FLOAT GetDividerPos(size_t i) const;
+
+	D2D1_SIZE_F GetPreferredSize(D2D1_SIZE_F& max);
+
+private:
+	virtual void OnRenderForeground(ID2D1RenderTarget*, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/);
+	virtual void OnLayout();
+	virtual Object* OnTouch(const D2D1_POINT_2F& pos);
+	virtual bool OnTouchContinue(const TouchInfo& ti);
+	virtual void OnTouchFinish(const TouchInfo& ti);
+
+	void PlacePane(size_t i);
+
+	MultiSplitterImpl* m_pImpl;
+};
+
+enum class GridTrackType
+{
+	Fixed,		// value is the size in DIPs
+	Auto,		// Sized to the largest item in the track
+	Fraction	// value is a share of the space left over
+};
+
+struct GridTrack
+{
+	GridTrackType type;
+	FLOAT value;
+};
+
+enum class GridAlign
+{
+	Start,
+	Center,
+	End,
+	Stretch
+};
+
+// Lays items out on rows and columns of fixed, auto or fractional tracks,
+// solved in one pass over the items instead of through nested containers.
+// A single row or column of auto and fractional tracks works as a flex box.
+// Item measurements are cached: call InvalidateItem when one item's
+// preferred size changes and only that item is remeasured, and the others
+// only move if a track changed size.
+struct GridPanelImpl;
+class DUI_API GridPanel : public Object
+{
+public:
+	GridPanel();
+	virtual ~GridPanel();
+
+	void SetColumns(const GridTrack* tracks, size_t count);
+	void SetRows(const GridTrack* tracks, size_t count);
+	size_t NumColumns() const;
+	size_t NumRows() const;
+	void SetGap(FLOAT columnGap, FLOAT rowGap);
+
+	void AddItem(Object* obj, size_t row, size_t column, size_t rowSpan=1, size_t columnSpan=1);
+	void RemoveItem(Object* obj);
+	void SetItemCell(Object* obj, size_t row, size_t column, size_t rowSpan=1, size_t columnSpan=1);
+	void SetItemAlignment(Object* obj, GridAlign horizontal, GridAlign vertical);
+	void InvalidateItem(Object* obj);
+
+	// Bounds of the cell from the last layout
+	D2D1_RECT_F GetCellRect(size_t row, size_t column) const;
+
+	D2D1_SIZE_F GetPreferredSize(D2D1_SIZE_F& max);
+
+private:
+	virtual void OnLayout();
+
+	GridPanelImpl* m_pImpl;
+};
+
+// Text formats and layouts shared by all labels
+struct TextCacheStats
+{
+	size_t formats;
+	size_t layouts;		// Kept for reuse, up to a fixed number
+	size_t hits;		// Layouts reused instead of created
+	size_t misses;
+};
+
 struct TextLabelImpl;
 class DUI_API TextLabel : public Object
 {
@@ -248,6 +976,8 @@ public:
     void SetFont(const std::string& font);
     void SetSize(FLOAT size);
 
+    static const TextCacheStats& GetCacheStats();
+
 private:
     virtual void OnRenderForeground(ID2D1RenderTarget*, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/);
     virtual D2D1_SIZE_F GetPreferredSize(D2D1_SIZE_F& max);
@@ -274,6 +1004,148 @@ private:
     ListViewImpl* m_pImpl;
 };
 
+// Supplies the cells of a DataGrid. Only cells in view exist; as the grid
+// scrolls, cells that leave the view are rebound to ones coming into it.
+class DataGridProvider
+{
+public:
+	virtual ~DataGridProvider() {}
+
+	virtual size_t GetRowCount() = 0;
+	virtual size_t GetColumnCount() = 0;
+
+	// Cells are only rebound to positions of the same type
+	virtual int GetCellType(size_t /*row*/, size_t /*column*/) { return 0; }
+	virtual Object* CreateCell(int type) = 0;
+	virtual void BindCell(Object* cell, size_t row, size_t column) = 0;
+	virtual void DestroyCell(Object* cell) { delete cell; }
+};
+
+struct DataGridStats
+{
+	size_t cellsVisible;
+	size_t cellsCreated;		// Over the grid's lifetime
+	size_t cellsBound;			// By the last update
+	size_t cellsRecycled;		// By the last update
+};
+
+struct DataGridImpl;
+class DUI_API DataGrid : public Object
+{
+public:
+	DataGrid();
+	~DataGrid();
+
+	// The grid doesn't own the provider, but cells are destroyed through it,
+	// so it must outlive the grid. Call Reload when its row or column counts
+	// or its data change.
+	void SetProvider(DataGridProvider* provider);
+	DataGridProvider* GetProvider() const;
+	void Reload();
+	void ReloadCell(size_t row, size_t column);
+
+	// Sizes reset to the defaults on Reload
+	void SetDefaultRowHeight(FLOAT height);
+	void SetDefaultColumnWidth(FLOAT width);
+	void SetRowHeight(size_t row, FLOAT height);
+	FLOAT GetRowHeight(size_t row) const;
+	void SetColumnWidth(size_t column, FLOAT width);
+	FLOAT GetColumnWidth(size_t column) const;
+
+	// Frozen rows and columns stay in place while the rest scrolls
+	void SetFrozenRows(size_t rows);
+	size_t GetFrozenRows() const;
+	void SetFrozenColumns(size_t columns);
+	size_t GetFrozenColumns() const;
+
+	// Offset of the scrolling cells, clamped to the content
+	void SetScrollOffset(D2D1_POINT_2F offset);
+	D2D1_POINT_2F GetScrollOffset() const;
+	D2D1_SIZE_F GetContentSize() const;
+
+	// Cell under a point in local coordinates
+	bool HitTest(const D2D1_POINT_2F& pos, size_t& row, size_t& column) const;
+
+	const DataGridStats& GetStats() const;
+
+private:
+	virtual void OnLayout();
+	virtual Object* OnTouch(const D2D1_POINT_2F& pos);
+	virtual bool OnTouchContinue(const TouchInfo& ti);
+
+	DataGridImpl* m_pImpl;
+};
+
+typedef UINT64 TreeNodeId;
+
+class TreeView;
+
+// The data behind a TreeView. Nodes are named by ids the model chooses;
+// the tree only learns about children when a node is first expanded.
+class TreeViewModel
+{
+public:
+	virtual ~TreeViewModel() {}
+
+	// Called the first time node is expanded. Answer with TreeView::SetChildren,
+	// either straight away or later on the main thread.
+	virtual void FetchChildren(TreeView* tree, TreeNodeId node) = 0;
+
+	// Rows are recycled between nodes as the tree scrolls
+	virtual Object* CreateRow() = 0;
+	virtual void BindRow(Object* row, TreeNodeId node, size_t depth, bool expanded) = 0;
+	virtual void DestroyRow(Object* row) { delete row; }
+};
+
+// Shows the expanded part of a model's tree as a list of fixed height rows.
+// Only rows in view have objects, and expanding or collapsing a node is
+// O(log n) in the number of rows however many descendants it has.
+struct TreeViewImpl;
+class DUI_API TreeView : public Object
+{
+public:
+	static const size_t NoRow = (size_t)-1;
+
+	TreeView();
+	~TreeView();
+
+	// Rows are destroyed through the model, so it must outlive the tree
+	void SetModel(TreeViewModel* model);
+	TreeViewModel* GetModel() const;
+
+	// Replace the top level nodes, or the children of a node
+	void SetRoots(const TreeNodeId* nodes, size_t count);
+	void SetChildren(TreeNodeId parent, const TreeNodeId* children, size_t count);
+
+	void Expand(TreeNodeId node);
+	void Collapse(TreeNodeId node);
+	void Toggle(TreeNodeId node);
+	bool IsExpanded(TreeNodeId node) const;
+	// Expanded, but the model hasn't supplied the children yet
+	bool IsLoading(TreeNodeId node) const;
+	// Rebinds the row showing node, if it is in view
+	void ReloadNode(TreeNodeId node);
+
+	size_t NumRows() const;
+	bool GetRowNode(size_t row, TreeNodeId& node) const;
+	// The node's row, or NoRow if it is under a collapsed node
+	size_t GetNodeRow(TreeNodeId node) const;
+
+	void SetRowHeight(FLOAT height);
+	FLOAT GetRowHeight() const;
+	void SetScrollOffset(FLOAT offset);
+	FLOAT GetScrollOffset() const;
+
+	bool HitTest(const D2D1_POINT_2F& pos, TreeNodeId& node) const;
+
+private:
+	virtual void OnLayout();
+	virtual Object* OnTouch(const D2D1_POINT_2F& pos);
+	virtual bool OnTouchContinue(const TouchInfo& ti);
+
+	TreeViewImpl* m_pImpl;
+};
+
 struct DebugConsoleImpl;
 class DUI_API DebugConsole : public Object
 {
@@ -295,12 +1167,102 @@ public:
     SolidObject(D2D1_COLOR_F color);
 
 	virtual D2D1_SIZE_F GetPreferredSize(D2D1_SIZE_F& max);
+	virtual bool IsOpaque() const;
 private:
 	virtual void OnRenderBackground(ID2D1RenderTarget*, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/);
 
 	D2D1_COLOR_F m_color;
 };
 
+// A single object drawing many solid cells, for heatmaps and status grids
+// where a SolidObject per cell would be too heavy. Cells are rects in local
+// coordinates, drawn in index order, and have no layout of their own. When
+// no cells overlap they are drawn grouped by colour instead, so each colour
+// takes one draw call.
+struct RectBatchImpl;
+class DUI_API RectBatch : public Object
+{
+public:
+	static const size_t NoCell = (size_t)-1;
+
+	RectBatch();
+	virtual ~RectBatch();
+
+	size_t AddCell(const D2D1_RECT_F& rect, const D2D1_COLOR_F& color);
+	void ReserveCells(size_t count);
+	void ClearCells();
+	size_t NumCells() const;
+
+	void SetCellRect(size_t cell, const D2D1_RECT_F& rect);
+	D2D1_RECT_F GetCellRect(size_t cell) const;
+	void SetCellColor(size_t cell, const D2D1_COLOR_F& color);
+	void SetCellColors(size_t first, size_t count, const D2D1_COLOR_F* colors);
+	D2D1_COLOR_F GetCellColor(size_t cell) const;
+	void SetCellVisible(size_t cell, bool visible);
+	bool IsCellVisible(size_t cell) const;
+
+	// Topmost visible cell containing pos (local coordinates), or NoCell
+	size_t HitTestCell(const D2D1_POINT_2F& pos) const;
+
+private:
+	virtual void OnRenderBackground(ID2D1RenderTarget*, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/);
+	void InvalidateCells();
+
+	RectBatchImpl* m_pImpl;
+};
+
+// Plots a single series of (time, value) samples as a line, decimated to
+// the min and max of the samples under each pixel column. Samples are kept
+// in fixed size chunks with min/max summaries, so drawing costs scale with
+// the chart width rather than the sample count. Each chart reserves a 512 KB
+// table of chunk pointers up front, for up to 256M samples; the 50 KB
+// chunks themselves are allocated as samples arrive.
+struct TimeSeriesChartImpl;
+class DUI_API TimeSeriesChart : public Object
+{
+public:
+	TimeSeriesChart();
+	virtual ~TimeSeriesChart();
+
+	// Safe to call from one feed thread while the UI thread renders. Only
+	// one thread may ever append, until ClearSamples (asserted in debug
+	// builds). Times must not decrease; earlier times are clamped to the
+	// latest one. Call DashApplication::Refresh afterwards to get the new
+	// samples drawn.
+	void Append(double time, double value);
+	void Append(const double* times, const double* values, size_t count);
+	size_t NumSamples() const;
+
+	// Not safe while a feed thread is appending
+	void ClearSamples();
+
+	// Shows a fixed window of time
+	void SetTimeRange(double start, double end);
+	// Keeps the latest sample at the right edge, showing span before it
+	void SetFollow(double span);
+	bool IsFollowing() const;
+	double GetTimeStart() const;
+	double GetTimeEnd() const;
+
+	void SetValueRange(double min, double max);
+	double GetValueMin() const;
+	double GetValueMax() const;
+
+	void SetLineColor(D2D1::ColorF color);
+	void SetBackgroundColor(D2D1::ColorF color);
+
+	// Min and max over the samples in [start, end); false if there are none
+	bool GetMinMax(double start, double end, double& min, double& max) const;
+
+protected:
+	virtual bool IsContentVolatile() const;
+
+private:
+	virtual void OnRenderBackground(ID2D1RenderTarget*, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/);
+
+	TimeSeriesChartImpl* m_pImpl;
+};
+
 class DashApplication;
 class ApplicationCore
 {
@@ -312,7 +1274,29 @@ public:
 	virtual void PostRender(DashApplication* /*app*/) {}
 };
 
+// Heap allocations on the UI thread during the last frame, by phase. Only
+// counted in builds with DUI_COUNT_ALLOCATIONS defined. Animations are
+// counted in every build.
+struct FrameAllocations
+{
+	size_t tasks;		// Work queued with OnMainThread
+	size_t layout;
+	size_t render;
+	size_t present;		// EndDraw and the core's PostRender
+	bool structural;	// Tasks ran or layout had work to do
+	size_t animations;	// Animated property changes started
+};
+
+// Device memory a window holds for itself, to see what each extra window
+// costs. Factories, text caches and animations are shared and not counted.
+struct WindowMemory
+{
+	size_t targetBytes;		// The window's 32-bit back buffer
+	size_t layerBytes;		// Layers cached by its RenderContext; not counted with threaded rendering
+};
+
 struct DashApplicationImpl;
+struct DashWindow;
 class DUI_API DashApplication
 {
 public:
@@ -324,21 +1308,80 @@ public:
 
     void Refresh();
 
-	// ApplicationCore::InitializeApplication should call SetRoot
+	// ApplicationCore::InitializeApplication should call SetRoot. It and
+	// the other calls that take no window act on the primary: the first
+	// window still open, or the first window before Run.
 	void SetRoot(Object* root);
     Object* GetRoot() const;
 
-    // Focus always gets first change at input processing, then root
+    // Opens another window showing root, and returns its index. Windows
+    // share the factories, text caches, animation clock and main thread
+    // tasks, and one frame loop draws the windows whose trees changed,
+    // paced by the primary. Animation ticks redraw every window. The
+    // application quits once every window is closed.
+    size_t AddWindow(Object* root, const std::wstring& title = L"DashApplication");
+    size_t GetWindowCount() const;
+    Object* GetRoot(size_t window) const;
+    InputManager& GetInputManager(size_t window);
+    WindowMemory GetWindowMemory(size_t window) const;
+
+    // Focus always gets first chance at input processing, then its
+    // ancestors up to the root
     void SetFocus(Object* focus);
     Object* GetFocus() const;
 
+    void AddAccelerator(UINT key, UINT modifiers, std::function<void()> action);
+    void RemoveAccelerator(UINT key, UINT modifiers);
+
+    InputManager& GetInputManager();
+
+    // Time from input arriving to the end of EndDraw, one sample for each
+    // frame that presented input
+    LatencyStats& GetInputLatency();
+
+    // Renders on a thread of its own. The window thread runs tasks, input
+    // and layout, then hands over a snapshot of the frame, and the render
+    // thread draws the latest one it has. Call before Run. Only objects
+    // drawing through the RenderContext show up; see BeginRecording. Also
+    // hands position and opacity animations to the render thread; see
+    // Object::SetCompositorAnimation.
+    void SetThreadedRendering(bool threaded);
+    bool GetThreadedRendering() const;
+
+    // Plays a recording into the window's input at speed times real time,
+    // a frame at a time. The recording must outlive the replay.
+    void Replay(const InputRecording& recording, double speed = 1.0);
+    bool IsReplaying() const;
+
+    // Also writes the primary window's frames to shared memory under this
+    // name, for a SharedFrameView in another process. Fails unless
+    // threaded rendering is on; turning it off stops sharing.
+    bool ShareFrames(const std::string& name, size_t slotBytes = 4 * 1024 * 1024);
+    const SharedFrameStats& GetSharedFrameStats() const;
+
     void OnMainThread(std::function<void()> func);
+
+    const FrameAllocations& GetFrameAllocations() const;
+    // Asserts when a frame that ran no tasks and needed no layout
+    // allocates while laying out or rendering
+    void SetStaticFrameCheck(bool check);
+
+    // Lets every window drop to RenderQuality::Interactive when frames
+    // during a drag or animation miss this many seconds; see
+    // RenderContext::SetQualityTarget
+    void SetQualityTarget(double seconds);
+
 private:
 	HRESULT CreateDeviceIndependentResources();
-	HRESULT CreateDeviceResources();
-    
+	HRESULT CreateDeviceResources(DashWindow& window);
+	void CreateAppWindow(DashWindow& window);
+	void DestroyAppWindow(DashWindow& window);
+
 	void OnRender();
-	void OnResize(UINT width, UINT height);
+	// Each returns whether the window needed layout
+	bool RenderWindow(DashWindow& window);
+	bool RecordWindow(DashWindow& window);
+	void OnResize(DashWindow& window, UINT width, UINT height);
 
 	static LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
 
@@ -0,0 +1,521 @@
+#include "DGui.h"
+#include "AnimatedVar.h"
+#include "PrefixSum.h"
+#include "utils.h"
+
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+namespace {
+	enum Pane { Corner, Top, Left, Body, PaneCount };
+
+	const FLOAT c_defaultRowHeight = 24.0f;
+	const FLOAT c_defaultColumnWidth = 100.0f;
+
+	// Cells are positioned relative to an origin per pane so their positions
+	// stay small enough for FLOAT. The origin catches up with the scroll
+	// offset once they are this far apart.
+	const double c_rebaseDistance = 4096.0;
+
+	UINT64 CellKey(size_t row, size_t column)
+	{
+		return ((UINT64)row << 32) | column;
+	}
+
+	struct CellRange
+	{
+		size_t rowBegin;
+		size_t rowEnd;
+		size_t columnBegin;
+		size_t columnEnd;
+	};
+
+	const CellRange c_emptyRange = { 0, 0, 0, 0 };
+
+	// Calls f for each cell in range that isn't also in exclude
+	template<typename F>
+	void ForEachCell(const CellRange& range, const CellRange& exclude, F f)
+	{
+		for(size_t row = range.rowBegin; row < range.rowEnd; ++row)
+		{
+			if(row < exclude.rowBegin || row >= exclude.rowEnd || exclude.columnBegin >= exclude.columnEnd)
+			{
+				for(size_t column = range.columnBegin; column < range.columnEnd; ++column)
+				{
+					f(row, column);
+				}
+				continue;
+			}
+
+			for(size_t column = range.columnBegin; column < range.columnEnd && column < exclude.columnBegin; ++column)
+			{
+				f(row, column);
+			}
+			for(size_t column = max(range.columnBegin, exclude.columnEnd); column < range.columnEnd; ++column)
+			{
+				f(row, column);
+			}
+		}
+	}
+}
+
+// Holds one quadrant's cells. The grid places them, so there is no layout
+// to do here beyond the cells' own.
+class DataGridPane : public Object
+{
+private:
+	virtual void OnLayout() { }
+};
+
+struct GridCell
+{
+	Object* m_cell;
+	int m_type;
+};
+
+struct DataGridImpl
+{
+	DataGridProvider* m_provider;
+
+	PrefixSum m_rows;
+	PrefixSum m_columns;
+	FLOAT m_defaultRowHeight;
+	FLOAT m_defaultColumnWidth;
+	size_t m_frozenRows;
+	size_t m_frozenColumns;
+	double m_scrollX;
+	double m_scrollY;
+
+	DataGridPane m_panes[PaneCount];
+	CellRange m_ranges[PaneCount];
+	double m_originX[PaneCount];
+	double m_originY[PaneCount];
+
+	std::unordered_map<UINT64, GridCell> m_cells;
+	std::unordered_map<int, std::vector<Object*>> m_pool;	// Hidden, waiting to be rebound
+
+	bool m_reload;			// Rebind every cell on the next layout
+	bool m_reposition;		// Sizes changed; move every cell on the next layout
+
+	DataGridStats m_stats;
+
+	DataGridImpl();
+
+	size_t FrozenRows() const { return min(m_frozenRows, m_rows.Count()); }
+	size_t FrozenColumns() const { return min(m_frozenColumns, m_columns.Count()); }
+	Pane PaneOf(size_t row, size_t column) const;
+	void ClampScroll(D2D1_SIZE_F size);
+
+	// Cells leaving the view go back to the pool before any coming into it
+	// are taken out, and only those two sets of cells are touched
+	void ReleaseCells(Pane pane, const CellRange& range);
+	void BindCells(Pane pane, const CellRange& range);
+	void Acquire(Pane pane, size_t row, size_t column);
+	void Recycle(size_t row, size_t column);
+	void Place(Pane pane, size_t row, size_t column, Object* cell);
+	void DestroyCells();
+};
+
+DataGridImpl::DataGridImpl() :
+m_provider(nullptr),
+m_defaultRowHeight(c_defaultRowHeight),
+m_defaultColumnWidth(c_defaultColumnWidth),
+m_frozenRows(0),
+m_frozenColumns(0),
+m_scrollX(0),
+m_scrollY(0),
+m_reload(false),
+m_reposition(false)
+{
+	for(size_t i = 0; i < PaneCount; ++i)
+	{
+		m_ranges[i] = c_emptyRange;
+		m_originX[i] = m_originY[i] = 0;
+	}
+	m_stats = DataGridStats();
+}
+
+Pane DataGridImpl::PaneOf(size_t row, size_t column) const
+{
+	if(row < FrozenRows())
+		return column < FrozenColumns() ? Corner : Top;
+	return column < FrozenColumns() ? Left : Body;
+}
+
+void DataGridImpl::ClampScroll(D2D1_SIZE_F size)
+{
+	double maxX = m_columns.Total() - size.width;
+	double maxY = m_rows.Total() - size.height;
+	m_scrollX = max(0.0, min(m_scrollX, maxX));
+	m_scrollY = max(0.0, min(m_scrollY, maxY));
+}
+
+void DataGridImpl::ReleaseCells(Pane pane, const CellRange& range)
+{
+	ForEachCell(m_ranges[pane], m_reload ? c_emptyRange : range, [this](size_t row, size_t column) { Recycle(row, column); });
+}
+
+void DataGridImpl::BindCells(Pane pane, const CellRange& range)
+{
+	// Translate the pane to the scroll offset, moving the origin if needed
+	double contentX = (pane == Top || pane == Body) ? m_scrollX : 0;
+	double contentY = (pane == Left || pane == Body) ? m_scrollY : 0;
+	bool reposition = m_reposition;
+	if(fabs(contentX - m_originX[pane]) > c_rebaseDistance || fabs(contentY - m_originY[pane]) > c_rebaseDistance)
+	{
+		m_originX[pane] = contentX;
+		m_originY[pane] = contentY;
+		reposition = true;
+	}
+	m_panes[pane].SetTranslationX(m_originX[pane] - contentX);
+	m_panes[pane].SetTranslationY(m_originY[pane] - contentY);
+
+	ForEachCell(range, m_reload ? c_emptyRange : m_ranges[pane], [this, pane](size_t row, size_t column) { Acquire(pane, row, column); });
+	if(reposition && !m_reload)
+	{
+		ForEachCell(range, c_emptyRange, [this, pane](size_t row, size_t column) {
+			Place(pane, row, column, m_cells[CellKey(row, column)].m_cell);
+		});
+	}
+
+	m_ranges[pane] = range;
+}
+
+void DataGridImpl::Acquire(Pane pane, size_t row, size_t column)
+{
+	int type = m_provider->GetCellType(row, column);
+	std::vector<Object*>& pool = m_pool[type];
+
+	Object* cell;
+	if(!pool.empty())
+	{
+		cell = pool.back();
+		pool.pop_back();
+		++m_stats.cellsRecycled;
+	}
+	else
+	{
+		cell = m_provider->CreateCell(type);
+		++m_stats.cellsCreated;
+	}
+
+	if(cell->GetParent() != &m_panes[pane])
+	{
+		if(cell->GetParent())
+			cell->GetParent()->RemoveChild(cell);
+		m_panes[pane].AddChild(cell);
+	}
+
+	m_provider->BindCell(cell, row, column);
+	++m_stats.cellsBound;
+	Place(pane, row, column, cell);
+	cell->SetVisible(true);
+
+	GridCell entry;
+	entry.m_cell = cell;
+	entry.m_type = type;
+	m_cells[CellKey(row, column)] = entry;
+}
+
+void DataGridImpl::Recycle(size_t row, size_t column)
+{
+	auto it = m_cells.find(CellKey(row, column));
+	if(it == m_cells.end())
+		return;
+
+	it->second.m_cell->SetVisible(false);
+	m_pool[it->second.m_type].push_back(it->second.m_cell);
+	m_cells.erase(it);
+}
+
+void DataGridImpl::Place(Pane pane, size_t row, size_t column, Object* cell)
+{
+	// Scrolling panes count from the first unfrozen row or column
+	double x = m_columns.Sum(column) - ((pane == Top || pane == Body) ? m_columns.Sum(FrozenColumns()) : 0);
+	double y = m_rows.Sum(row) - ((pane == Left || pane == Body) ? m_rows.Sum(FrozenRows()) : 0);
+	cell->SetPosition(D2D1::Point2F((FLOAT)(x - m_originX[pane]), (FLOAT)(y - m_originY[pane])));
+	cell->SetSize(D2D1::SizeF((FLOAT)m_columns.Get(column), (FLOAT)m_rows.Get(row)));
+}
+
+void DataGridImpl::DestroyCells()
+{
+	auto destroy = [this](Object* cell) {
+		if(cell->GetParent())
+			cell->GetParent()->RemoveChild(cell);
+		m_provider->DestroyCell(cell);
+	};
+
+	for(auto& entry : m_cells)
+	{
+		destroy(entry.second.m_cell);
+	}
+	for(auto& pool : m_pool)
+	{
+		for(auto cell : pool.second)
+		{
+			destroy(cell);
+		}
+	}
+
+	m_cells.clear();
+	m_pool.clear();
+	for(size_t i = 0; i < PaneCount; ++i)
+	{
+		m_ranges[i] = c_emptyRange;
+	}
+}
+
+DataGrid::DataGrid() :
+m_pImpl(new DataGridImpl())
+{
+	// Frozen panes draw over the scrolling ones
+	int z[PaneCount] = { 3, 2, 2, 1 };
+	for(size_t i = 0; i < PaneCount; ++i)
+	{
+		m_pImpl->m_panes[i].SetZOrder(z[i]);
+		AddChild(&m_pImpl->m_panes[i]);
+	}
+}
+
+DataGrid::~DataGrid()
+{
+	if(m_pImpl->m_provider)
+		m_pImpl->DestroyCells();
+	for(size_t i = 0; i < PaneCount; ++i)
+	{
+		RemoveChild(&m_pImpl->m_panes[i]);
+	}
+	delete m_pImpl;
+}
+
+void DataGrid::SetProvider(DataGridProvider* provider)
+{
+	if(m_pImpl->m_provider)
+		m_pImpl->DestroyCells();
+
+	m_pImpl->m_provider = provider;
+	Reload();
+}
+
+DataGridProvider* DataGrid::GetProvider() const
+{
+	return m_pImpl->m_provider;
+}
+
+void DataGrid::Reload()
+{
+	DataGridProvider* provider = m_pImpl->m_provider;
+	m_pImpl->m_rows.Reset(provider ? provider->GetRowCount() : 0, m_pImpl->m_defaultRowHeight);
+	m_pImpl->m_columns.Reset(provider ? provider->GetColumnCount() : 0, m_pImpl->m_defaultColumnWidth);
+	m_pImpl->m_reload = true;
+	DirtyLayout();
+}
+
+void DataGrid::ReloadCell(size_t row, size_t column)
+{
+	auto it = m_pImpl->m_cells.find(CellKey(row, column));
+	if(it == m_pImpl->m_cells.end())
+		return;
+
+	if(m_pImpl->m_provider->GetCellType(row, column) == it->second.m_type)
+	{
+		m_pImpl->m_provider->BindCell(it->second.m_cell, row, column);
+		++m_pImpl->m_stats.cellsBound;
+	}
+	else
+	{
+		tjm::animation::AllInstant ai(true);
+		m_pImpl->Recycle(row, column);
+		m_pImpl->Acquire(m_pImpl->PaneOf(row, column), row, column);
+	}
+}
+
+void DataGrid::SetDefaultRowHeight(FLOAT height)
+{
+	m_pImpl->m_defaultRowHeight = height;
+}
+
+void DataGrid::SetDefaultColumnWidth(FLOAT width)
+{
+	m_pImpl->m_defaultColumnWidth = width;
+}
+
+void DataGrid::SetRowHeight(size_t row, FLOAT height)
+{
+	m_pImpl->m_rows.Set(row, height);
+	m_pImpl->m_reposition = true;
+	DirtyLayout();
+}
+
+FLOAT DataGrid::GetRowHeight(size_t row) const
+{
+	return (FLOAT)m_pImpl->m_rows.Get(row);
+}
+
+void DataGrid::SetColumnWidth(size_t column, FLOAT width)
+{
+	m_pImpl->m_columns.Set(column, width);
+	m_pImpl->m_reposition = true;
+	DirtyLayout();
+}
+
+FLOAT DataGrid::GetColumnWidth(size_t column) const
+{
+	return (FLOAT)m_pImpl->m_columns.Get(column);
+}
+
+void DataGrid::SetFrozenRows(size_t rows)
+{
+	m_pImpl->m_frozenRows = rows;
+	m_pImpl->m_reload = true;
+	DirtyLayout();
+}
+
+size_t DataGrid::GetFrozenRows() const
+{
+	return m_pImpl->m_frozenRows;
+}
+
+void DataGrid::SetFrozenColumns(size_t columns)
+{
+	m_pImpl->m_frozenColumns = columns;
+	m_pImpl->m_reload = true;
+	DirtyLayout();
+}
+
+size_t DataGrid::GetFrozenColumns() const
+{
+	return m_pImpl->m_frozenColumns;
+}
+
+void DataGrid::SetScrollOffset(D2D1_POINT_2F offset)
+{
+	m_pImpl->m_scrollX = offset.x;
+	m_pImpl->m_scrollY = offset.y;
+	m_pImpl->ClampScroll(GetSize());
+	DirtyLayout();
+}
+
+D2D1_POINT_2F DataGrid::GetScrollOffset() const
+{
+	return D2D1::Point2F((FLOAT)m_pImpl->m_scrollX, (FLOAT)m_pImpl->m_scrollY);
+}
+
+D2D1_SIZE_F DataGrid::GetContentSize() const
+{
+	return D2D1::SizeF((FLOAT)m_pImpl->m_columns.Total(), (FLOAT)m_pImpl->m_rows.Total());
+}
+
+bool DataGrid::HitTest(const D2D1_POINT_2F& pos, size_t& row, size_t& column) const
+{
+	double frozenWidth = m_pImpl->m_columns.Sum(m_pImpl->FrozenColumns());
+	double frozenHeight = m_pImpl->m_rows.Sum(m_pImpl->FrozenRows());
+	column = m_pImpl->m_columns.Find(pos.x < frozenWidth ? pos.x : pos.x + m_pImpl->m_scrollX);
+	row = m_pImpl->m_rows.Find(pos.y < frozenHeight ? pos.y : pos.y + m_pImpl->m_scrollY);
+	return pos.x >= 0 && pos.y >= 0 && column < m_pImpl->m_columns.Count() && row < m_pImpl->m_rows.Count();
+}
+
+const DataGridStats& DataGrid::GetStats() const
+{
+	return m_pImpl->m_stats;
+}
+
+void DataGrid::OnLayout()
+{
+	DataGridImpl* impl = m_pImpl;
+	impl->m_stats.cellsBound = 0;
+	impl->m_stats.cellsRecycled = 0;
+
+	// Cells snap to their places; only scrolling the grid moves them
+	tjm::animation::AllInstant ai(true);
+
+	D2D1_SIZE_F size = GetSize();
+	impl->ClampScroll(size);
+
+	size_t frozenRows = impl->FrozenRows();
+	size_t frozenColumns = impl->FrozenColumns();
+	FLOAT frozenWidth = min((FLOAT)impl->m_columns.Sum(frozenColumns), size.width);
+	FLOAT frozenHeight = min((FLOAT)impl->m_rows.Sum(frozenRows), size.height);
+	FLOAT bodyWidth = size.width - frozenWidth;
+	FLOAT bodyHeight = size.height - frozenHeight;
+
+	D2D1_RECT_F paneRects[PaneCount] = {
+		D2D1::RectF(0, 0, frozenWidth, frozenHeight),
+		D2D1::RectF(frozenWidth, 0, size.width, frozenHeight),
+		D2D1::RectF(0, frozenHeight, frozenWidth, size.height),
+		D2D1::RectF(frozenWidth, frozenHeight, size.width, size.height)
+	};
+	for(size_t i = 0; i < PaneCount; ++i)
+	{
+		const D2D1_RECT_F& r = paneRects[i];
+		impl->m_panes[i].SetPosition(D2D1::Point2F(r.left, r.top));
+		impl->m_panes[i].SetSize(D2D1::SizeF(r.right - r.left, r.bottom - r.top));
+		impl->m_panes[i].SetClippingRect(D2D1::RectF(0, 0, r.right - r.left, r.bottom - r.top));
+	}
+
+	// Scrolling rows and columns in view
+	size_t firstRow = frozenRows;
+	size_t endRow = frozenRows;
+	size_t firstColumn = frozenColumns;
+	size_t endColumn = frozenColumns;
+	if(impl->m_provider && bodyHeight > 0)
+	{
+		double top = impl->m_rows.Sum(frozenRows) + impl->m_scrollY;
+		firstRow = max(frozenRows, impl->m_rows.Find(top));
+		endRow = min(impl->m_rows.Count(), impl->m_rows.Find(top + bodyHeight) + 1);
+	}
+	if(impl->m_provider && bodyWidth > 0)
+	{
+		double left = impl->m_columns.Sum(frozenColumns) + impl->m_scrollX;
+		firstColumn = max(frozenColumns, impl->m_columns.Find(left));
+		endColumn = min(impl->m_columns.Count(), impl->m_columns.Find(left + bodyWidth) + 1);
+	}
+
+	CellRange ranges[PaneCount] = {
+		{ 0, frozenRows, 0, frozenColumns },
+		{ 0, frozenRows, firstColumn, endColumn },
+		{ firstRow, endRow, 0, frozenColumns },
+		{ firstRow, endRow, firstColumn, endColumn }
+	};
+	if(!impl->m_provider)
+	{
+		for(auto& range : ranges)
+		{
+			range = c_emptyRange;
+		}
+	}
+
+	for(size_t i = 0; i < PaneCount; ++i)
+	{
+		impl->ReleaseCells((Pane)i, ranges[i]);
+	}
+	for(size_t i = 0; i < PaneCount; ++i)
+	{
+		impl->BindCells((Pane)i, ranges[i]);
+	}
+
+	impl->m_reload = false;
+	impl->m_reposition = false;
+	impl->m_stats.cellsVisible = impl->m_cells.size();
+}
+
+Object* DataGrid::OnTouch(const D2D1_POINT_2F&)
+{
+	return this;
+}
+
+bool DataGrid::OnTouchContinue(const TouchInfo& ti)
+{
+	D2D1_POINT_2F offset = GetScrollOffset();
+	offset.x -= ti.currentTouch.x - ti.previousTouch.x;
+	offset.y -= ti.currentTouch.y - ti.previousTouch.y;
+	SetScrollOffset(offset);
+	return true;
+}
+
+} // end namespace dash
+} // end namespace tjm
@@ -0,0 +1,236 @@
+#include "DGui.h"
+#include "RenderContextImpl.h"
+#include "utils.h"
+
+namespace tjm {
+namespace dash {
+
+namespace {
+	// How many batches back a primitive may move to join one with its brush
+	const size_t c_searchWindow = 8;
+
+	bool SameBrush(const Batch& batch, const D2D1_COLOR_F& color, FLOAT opacity)
+	{
+		return batch.m_opacity == opacity && batch.m_color.r == color.r && batch.m_color.g == color.g &&
+			batch.m_color.b == color.b && batch.m_color.a == color.a;
+	}
+
+	void Union(D2D1_RECT_F& rect, const D2D1_RECT_F& other)
+	{
+		rect.left = min(rect.left, other.left);
+		rect.top = min(rect.top, other.top);
+		rect.right = max(rect.right, other.right);
+		rect.bottom = max(rect.bottom, other.bottom);
+	}
+
+	UINT64 HashPrimitive(UINT64 hash, const BatchPrimitive& primitive)
+	{
+		// FNV-1a over the bounds and shape
+		const BYTE* bytes = reinterpret_cast<const BYTE*>(&primitive.m_bounds);
+		for(size_t i = 0; i < sizeof(primitive.m_bounds); ++i)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+		return (hash ^ (primitive.m_ellipse ? 1 : 0)) * 1099511628211ULL;
+	}
+}
+
+DrawBatcher::DrawBatcher() :
+m_geometryOrdinal(0)
+{
+}
+
+void DrawBatcher::Add(const D2D1_RECT_F& bounds, bool ellipse, const D2D1_COLOR_F& color, FLOAT opacity, RenderStats& stats)
+{
+	++stats.primitives;
+
+	// Overlapping translucent primitives blend with each other, so they can't
+	// be merged into one fill. Opaque ones can; the union looks the same.
+	bool translucent = color.a * opacity < 1.0f;
+
+	// Walk back to the most recent batch with this brush. The primitive can
+	// join it if nothing drawn in between overlaps it.
+	size_t join = m_batches.size();
+	size_t searched = 0;
+	for(size_t i = m_batches.size(); i > 0 && searched < c_searchWindow; --i, ++searched)
+	{
+		const Batch& batch = m_batches[i - 1];
+		bool overlaps = Intersects(batch.m_bounds, bounds);
+		if(SameBrush(batch, color, opacity))
+		{
+			if(!(translucent && overlaps))
+				join = i - 1;
+			break;
+		}
+		if(overlaps)
+			break;
+	}
+
+	if(join == m_batches.size())
+	{
+		Batch batch;
+		batch.m_color = color;
+		batch.m_opacity = opacity;
+		batch.m_bounds = bounds;
+		batch.m_count = 0;
+		m_batches.push_back(batch);
+	}
+
+	Batch& batch = m_batches[join];
+	Union(batch.m_bounds, bounds);
+	++batch.m_count;
+
+	BatchPrimitive primitive;
+	primitive.m_bounds = bounds;
+	primitive.m_ellipse = ellipse;
+	primitive.m_batch = join;
+	m_primitives.push_back(primitive);
+}
+
+void DrawBatcher::Flush(ID2D1RenderTarget* pTarget, ID2D1RenderTarget* pDevice, bool cacheGeometry, RenderStats& stats)
+{
+	if(!m_brush)
+	{
+		// Created on the device target so it can be shared with its layers
+		CORt(pDevice->CreateSolidColorBrush(D2D1::ColorF(D2D1::ColorF::Black), &m_brush));
+	}
+
+	// Group primitives by batch, keeping submission order within a batch
+	m_batchStart.assign(m_batches.size() + 1, 0);
+	for(auto& primitive : m_primitives)
+	{
+		++m_batchStart[primitive.m_batch + 1];
+	}
+	for(size_t i = 1; i < m_batchStart.size(); ++i)
+	{
+		m_batchStart[i] += m_batchStart[i - 1];
+	}
+	m_order.resize(m_primitives.size());
+	for(size_t i = 0; i < m_primitives.size(); ++i)
+	{
+		m_order[m_batchStart[m_primitives[i].m_batch]++] = i;
+	}
+
+	size_t first = 0;
+	for(auto& batch : m_batches)
+	{
+		m_brush->SetColor(batch.m_color);
+		m_brush->SetOpacity(batch.m_opacity);
+
+		if(batch.m_count == 1)
+		{
+			const BatchPrimitive& primitive = m_primitives[m_order[first]];
+			if(primitive.m_ellipse)
+			{
+				const D2D1_RECT_F& b = primitive.m_bounds;
+				FLOAT rx = (b.right - b.left) / 2;
+				FLOAT ry = (b.bottom - b.top) / 2;
+				pTarget->FillEllipse(D2D1::Ellipse(D2D1::Point2F(b.left + rx, b.top + ry), rx, ry), m_brush);
+			}
+			else
+			{
+				pTarget->FillRectangle(primitive.m_bounds, m_brush);
+			}
+		}
+		else
+		{
+			pTarget->FillGeometry(BuildGeometry(pTarget, first, batch.m_count, cacheGeometry), m_brush);
+		}
+
+		++stats.drawCalls;
+		first += batch.m_count;
+	}
+
+	m_primitives.clear();
+	m_batches.clear();
+}
+
+ID2D1PathGeometry* DrawBatcher::BuildGeometry(ID2D1RenderTarget* pTarget, size_t first, size_t count, bool cacheGeometry)
+{
+	UINT64 hash = 14695981039346656037ULL;
+	CachedGeometry* cached = nullptr;
+	if(cacheGeometry)
+	{
+		for(size_t i = first; i < first + count; ++i)
+		{
+			hash = HashPrimitive(hash, m_primitives[m_order[i]]);
+		}
+
+		if(m_geometryOrdinal >= m_geometries.size())
+			m_geometries.resize(m_geometryOrdinal + 1);
+		cached = &m_geometries[m_geometryOrdinal++];
+		if(cached->m_geometry && cached->m_hash == hash && cached->m_count == count)
+			return cached->m_geometry;
+	}
+
+	CComPtr<ID2D1Factory> factory;
+	pTarget->GetFactory(&factory);
+
+	CComPtr<ID2D1PathGeometry> geometry;
+	CORt(factory->CreatePathGeometry(&geometry));
+
+	CComPtr<ID2D1GeometrySink> sink;
+	CORt(geometry->Open(&sink));
+
+	// Every figure winds clockwise, so overlaps fill as a union
+	sink->SetFillMode(D2D1_FILL_MODE_WINDING);
+	for(size_t i = first; i < first + count; ++i)
+	{
+		const BatchPrimitive& primitive = m_primitives[m_order[i]];
+		const D2D1_RECT_F& b = primitive.m_bounds;
+		if(primitive.m_ellipse)
+		{
+			FLOAT rx = (b.right - b.left) / 2;
+			FLOAT ry = (b.bottom - b.top) / 2;
+			D2D1_POINT_2F left = D2D1::Point2F(b.left, b.top + ry);
+			D2D1_POINT_2F right = D2D1::Point2F(b.right, b.top + ry);
+
+			D2D1_ARC_SEGMENT arc;
+			arc.size = D2D1::SizeF(rx, ry);
+			arc.rotationAngle = 0;
+			arc.sweepDirection = D2D1_SWEEP_DIRECTION_CLOCKWISE;
+			arc.arcSize = D2D1_ARC_SIZE_SMALL;
+
+			sink->BeginFigure(left, D2D1_FIGURE_BEGIN_FILLED);
+			arc.point = right;
+			sink->AddArc(arc);
+			arc.point = left;
+			sink->AddArc(arc);
+			sink->EndFigure(D2D1_FIGURE_END_CLOSED);
+		}
+		else
+		{
+			D2D1_POINT_2F corners[] = {
+				D2D1::Point2F(b.right, b.top),
+				D2D1::Point2F(b.right, b.bottom),
+				D2D1::Point2F(b.left, b.bottom)
+			};
+			sink->BeginFigure(D2D1::Point2F(b.left, b.top), D2D1_FIGURE_BEGIN_FILLED);
+			sink->AddLines(corners, 3);
+			sink->EndFigure(D2D1_FIGURE_END_CLOSED);
+		}
+	}
+	CORt(sink->Close());
+
+	if(cached)
+	{
+		cached->m_hash = hash;
+		cached->m_count = count;
+		cached->m_geometry = geometry;
+	}
+
+	// Keeps an uncached geometry alive until it has been drawn
+	m_lastGeometry = geometry;
+	return m_lastGeometry;
+}
+
+void DrawBatcher::ReleaseResources()
+{
+	m_brush.Release();
+	m_lastGeometry.Release();
+	m_geometries.clear();
+	m_geometryOrdinal = 0;
+}
+
+} // end namespace dash
+} // end namespace tjm
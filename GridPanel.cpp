@@ -0,0 +1,515 @@
+#include "DGui.h"
+#include "utils.h"
+#include "AnimatedVar.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+struct GridItem
+{
+	Object* m_obj;
+	size_t m_row;
+	size_t m_column;
+	size_t m_rowSpan;
+	size_t m_columnSpan;
+	GridAlign m_hAlign;
+	GridAlign m_vAlign;
+	D2D1_SIZE_F m_need;		// Preferred size plus margins, from the last measure
+	bool m_measured;
+	bool m_dirty;			// Queued for an incremental layout
+	D2D1_RECT_F m_placed;
+	bool m_placedValid;
+};
+
+// Tracks along one direction. An item's range is clamped to the tracks
+// that exist, so removing tracks never leaves items unplaced.
+struct GridAxis
+{
+	std::vector<GridTrack> m_tracks;
+	std::vector<FLOAT> m_sizes;
+	std::vector<FLOAT> m_starts;	// One more than there are tracks
+	FLOAT m_gap;
+
+	GridAxis();
+
+	void SetTracks(const GridTrack* tracks, size_t count);
+	void Range(size_t first, size_t span, size_t& outFirst, size_t& outSpan) const;
+	bool IsAuto(size_t track, bool fractionsAsAuto) const;
+	void Solve(const std::vector<GridItem>& items, bool columns, FLOAT available, bool fractionsAsAuto);
+	FLOAT Begin(size_t first) const { return m_starts[first]; }
+	FLOAT End(size_t first, size_t span) const { return m_starts[first + span] - m_gap; }
+	FLOAT Total() const { return m_starts.back() - m_gap; }
+};
+
+GridAxis::GridAxis() :
+m_gap(0)
+{
+	SetTracks(nullptr, 0);
+}
+
+void GridAxis::SetTracks(const GridTrack* tracks, size_t count)
+{
+	m_tracks.assign(tracks, tracks + count);
+	if(m_tracks.empty())
+	{
+		GridTrack fill = { GridTrackType::Fraction, 1.0f };
+		m_tracks.push_back(fill);
+	}
+	m_sizes.assign(m_tracks.size(), 0.0f);
+	m_starts.assign(m_tracks.size() + 1, 0.0f);
+}
+
+void GridAxis::Range(size_t first, size_t span, size_t& outFirst, size_t& outSpan) const
+{
+	size_t n = m_tracks.size();
+	outFirst = first < n ? first : n - 1;
+	outSpan = span < 1 ? 1 : span > n - outFirst ? n - outFirst : span;
+}
+
+bool GridAxis::IsAuto(size_t track, bool fractionsAsAuto) const
+{
+	GridTrackType type = m_tracks[track].type;
+	return type == GridTrackType::Auto || (fractionsAsAuto && type == GridTrackType::Fraction);
+}
+
+void GridAxis::Solve(const std::vector<GridItem>& items, bool columns, FLOAT available, bool fractionsAsAuto)
+{
+	size_t n = m_tracks.size();
+	for(size_t i = 0; i < n; ++i)
+	{
+		m_sizes[i] = m_tracks[i].type == GridTrackType::Fixed ? m_tracks[i].value : 0.0f;
+	}
+
+	// Items in a single auto track size it directly
+	for(auto& item : items)
+	{
+		size_t first, span;
+		Range(columns ? item.m_column : item.m_row, columns ? item.m_columnSpan : item.m_rowSpan, first, span);
+		FLOAT need = columns ? item.m_need.width : item.m_need.height;
+		if(span == 1 && IsAuto(first, fractionsAsAuto) && need > m_sizes[first])
+			m_sizes[first] = need;
+	}
+
+	// Spanning items grow the auto tracks they cross by whatever is still missing
+	for(auto& item : items)
+	{
+		size_t first, span;
+		Range(columns ? item.m_column : item.m_row, columns ? item.m_columnSpan : item.m_rowSpan, first, span);
+		if(span == 1)
+			continue;
+
+		FLOAT need = columns ? item.m_need.width : item.m_need.height;
+		FLOAT have = m_gap * (span - 1);
+		size_t autos = 0;
+		for(size_t t = first; t < first + span; ++t)
+		{
+			have += m_sizes[t];
+			if(IsAuto(t, fractionsAsAuto))
+				++autos;
+		}
+		if(autos > 0 && need > have)
+		{
+			FLOAT extra = (need - have) / autos;
+			for(size_t t = first; t < first + span; ++t)
+			{
+				if(IsAuto(t, fractionsAsAuto))
+					m_sizes[t] += extra;
+			}
+		}
+	}
+
+	// Fractions share what is left
+	if(!fractionsAsAuto)
+	{
+		FLOAT used = m_gap * (n - 1);
+		FLOAT weights = 0;
+		for(size_t i = 0; i < n; ++i)
+		{
+			used += m_sizes[i];
+			if(m_tracks[i].type == GridTrackType::Fraction)
+				weights += m_tracks[i].value;
+		}
+		FLOAT remaining = available > used ? available - used : 0.0f;
+		for(size_t i = 0; i < n; ++i)
+		{
+			if(m_tracks[i].type == GridTrackType::Fraction)
+				m_sizes[i] = weights > 0 ? remaining * m_tracks[i].value / weights : 0.0f;
+		}
+	}
+
+	FLOAT pos = 0;
+	for(size_t i = 0; i < n; ++i)
+	{
+		m_starts[i] = pos;
+		pos += m_sizes[i] + m_gap;
+	}
+	m_starts[n] = pos;
+}
+
+struct GridPanelImpl
+{
+	GridAxis m_columns;
+	GridAxis m_rows;
+	std::vector<GridItem> m_items;
+	std::unordered_map<Object*, size_t> m_index;
+	std::vector<size_t> m_dirtyItems;
+	bool m_fullLayout;
+	D2D1_SIZE_F m_lastSize;
+
+	GridPanelImpl();
+
+	GridItem* Find(Object* obj);
+	void Measure(GridItem& item, const D2D1_SIZE_F& size);
+	bool TouchesAuto(const GridItem& item) const;
+	void Place(GridItem& item);
+};
+
+GridPanelImpl::GridPanelImpl() :
+m_fullLayout(true),
+m_lastSize(D2D1::SizeF(0, 0))
+{
+}
+
+GridItem* GridPanelImpl::Find(Object* obj)
+{
+	auto it = m_index.find(obj);
+	return it == m_index.end() ? nullptr : &m_items[it->second];
+}
+
+void GridPanelImpl::Measure(GridItem& item, const D2D1_SIZE_F& size)
+{
+	// Items entirely in fixed tracks are measured against their cell,
+	// anything else against the whole panel
+	size_t first, span;
+	D2D1_SIZE_F limit = size;
+	m_columns.Range(item.m_column, item.m_columnSpan, first, span);
+	bool fixed = true;
+	FLOAT width = m_columns.m_gap * (span - 1);
+	for(size_t t = first; t < first + span; ++t)
+	{
+		fixed = fixed && m_columns.m_tracks[t].type == GridTrackType::Fixed;
+		width += m_columns.m_tracks[t].value;
+	}
+	if(fixed)
+		limit.width = width;
+
+	m_rows.Range(item.m_row, item.m_rowSpan, first, span);
+	fixed = true;
+	FLOAT height = m_rows.m_gap * (span - 1);
+	for(size_t t = first; t < first + span; ++t)
+	{
+		fixed = fixed && m_rows.m_tracks[t].type == GridTrackType::Fixed;
+		height += m_rows.m_tracks[t].value;
+	}
+	if(fixed)
+		limit.height = height;
+
+	Object* obj = item.m_obj;
+	FLOAT marginX = obj->GetMarginLeft() + obj->GetMarginRight();
+	FLOAT marginY = obj->GetMarginTop() + obj->GetMarginBottom();
+	limit.width = max(limit.width - marginX, 0.0f);
+	limit.height = max(limit.height - marginY, 0.0f);
+
+	D2D1_SIZE_F preferred = obj->GetPreferredSize(limit);
+	item.m_need = D2D1::SizeF(preferred.width + marginX, preferred.height + marginY);
+	item.m_measured = true;
+}
+
+bool GridPanelImpl::TouchesAuto(const GridItem& item) const
+{
+	size_t first, span;
+	m_columns.Range(item.m_column, item.m_columnSpan, first, span);
+	for(size_t t = first; t < first + span; ++t)
+	{
+		if(m_columns.IsAuto(t, false))
+			return true;
+	}
+	m_rows.Range(item.m_row, item.m_rowSpan, first, span);
+	for(size_t t = first; t < first + span; ++t)
+	{
+		if(m_rows.IsAuto(t, false))
+			return true;
+	}
+	return false;
+}
+
+namespace {
+	void Align(GridAlign align, FLOAT begin, FLOAT end, FLOAT need, FLOAT& outBegin, FLOAT& outSize)
+	{
+		FLOAT available = end > begin ? end - begin : 0.0f;
+		outSize = align == GridAlign::Stretch || need > available ? available : need;
+		switch(align)
+		{
+		case GridAlign::Center:
+			outBegin = begin + (available - outSize) / 2;
+			break;
+		case GridAlign::End:
+			outBegin = begin + available - outSize;
+			break;
+		default:
+			outBegin = begin;
+			break;
+		}
+	}
+}
+
+void GridPanelImpl::Place(GridItem& item)
+{
+	Object* obj = item.m_obj;
+	size_t column, columnSpan, row, rowSpan;
+	m_columns.Range(item.m_column, item.m_columnSpan, column, columnSpan);
+	m_rows.Range(item.m_row, item.m_rowSpan, row, rowSpan);
+
+	FLOAT marginX = obj->GetMarginLeft() + obj->GetMarginRight();
+	FLOAT marginY = obj->GetMarginTop() + obj->GetMarginBottom();
+	FLOAT x, y, width, height;
+	Align(item.m_hAlign, m_columns.Begin(column) + obj->GetMarginLeft(), m_columns.End(column, columnSpan) - obj->GetMarginRight(),
+		item.m_need.width - marginX, x, width);
+	Align(item.m_vAlign, m_rows.Begin(row) + obj->GetMarginTop(), m_rows.End(row, rowSpan) - obj->GetMarginBottom(),
+		item.m_need.height - marginY, y, height);
+
+	D2D1_RECT_F rect = D2D1::RectF(x, y, x + width, y + height);
+	const D2D1_RECT_F& placed = item.m_placed;
+	if(item.m_placedValid && placed.left == rect.left && placed.top == rect.top &&
+		placed.right == rect.right && placed.bottom == rect.bottom)
+	{
+		return;
+	}
+
+	obj->SetPosition(D2D1::Point2F(x, y));
+	obj->SetSize(D2D1::SizeF(width, height));
+	item.m_placed = rect;
+	item.m_placedValid = true;
+}
+
+GridPanel::GridPanel() :
+m_pImpl(new GridPanelImpl())
+{
+}
+
+GridPanel::~GridPanel()
+{
+	delete m_pImpl;
+}
+
+void GridPanel::SetColumns(const GridTrack* tracks, size_t count)
+{
+	m_pImpl->m_columns.SetTracks(tracks, count);
+	m_pImpl->m_fullLayout = true;
+	DirtyLayout();
+}
+
+void GridPanel::SetRows(const GridTrack* tracks, size_t count)
+{
+	m_pImpl->m_rows.SetTracks(tracks, count);
+	m_pImpl->m_fullLayout = true;
+	DirtyLayout();
+}
+
+size_t GridPanel::NumColumns() const
+{
+	return m_pImpl->m_columns.m_tracks.size();
+}
+
+size_t GridPanel::NumRows() const
+{
+	return m_pImpl->m_rows.m_tracks.size();
+}
+
+void GridPanel::SetGap(FLOAT columnGap, FLOAT rowGap)
+{
+	m_pImpl->m_columns.m_gap = columnGap;
+	m_pImpl->m_rows.m_gap = rowGap;
+	m_pImpl->m_fullLayout = true;
+	DirtyLayout();
+}
+
+void GridPanel::AddItem(Object* obj, size_t row, size_t column, size_t rowSpan, size_t columnSpan)
+{
+	if(m_pImpl->Find(obj))
+	{
+		SetItemCell(obj, row, column, rowSpan, columnSpan);
+		return;
+	}
+
+	GridItem item;
+	item.m_obj = obj;
+	item.m_row = row;
+	item.m_column = column;
+	item.m_rowSpan = rowSpan;
+	item.m_columnSpan = columnSpan;
+	item.m_hAlign = GridAlign::Stretch;
+	item.m_vAlign = GridAlign::Stretch;
+	item.m_need = D2D1::SizeF(0, 0);
+	item.m_measured = false;
+	item.m_dirty = false;
+	item.m_placedValid = false;
+
+	m_pImpl->m_index[obj] = m_pImpl->m_items.size();
+	m_pImpl->m_items.push_back(item);
+	AddChild(obj);
+	m_pImpl->m_fullLayout = true;
+	DirtyLayout();
+}
+
+void GridPanel::RemoveItem(Object* obj)
+{
+	auto it = m_pImpl->m_index.find(obj);
+	if(it == m_pImpl->m_index.end())
+		return;
+
+	// Move the last item into the hole. Queued indices would go stale, but
+	// the full layout this causes covers them anyway.
+	std::vector<GridItem>& items = m_pImpl->m_items;
+	for(size_t queued : m_pImpl->m_dirtyItems)
+	{
+		items[queued].m_dirty = false;
+	}
+	m_pImpl->m_dirtyItems.clear();
+	size_t i = it->second;
+	m_pImpl->m_index.erase(it);
+	if(i + 1 != items.size())
+	{
+		items[i] = items.back();
+		m_pImpl->m_index[items[i].m_obj] = i;
+	}
+	items.pop_back();
+
+	RemoveChild(obj);
+	m_pImpl->m_fullLayout = true;
+	DirtyLayout();
+}
+
+void GridPanel::SetItemCell(Object* obj, size_t row, size_t column, size_t rowSpan, size_t columnSpan)
+{
+	GridItem* item = m_pImpl->Find(obj);
+	if(!item)
+		return;
+
+	item->m_row = row;
+	item->m_column = column;
+	item->m_rowSpan = rowSpan;
+	item->m_columnSpan = columnSpan;
+	m_pImpl->m_fullLayout = true;
+	DirtyLayout();
+}
+
+void GridPanel::SetItemAlignment(Object* obj, GridAlign horizontal, GridAlign vertical)
+{
+	GridItem* item = m_pImpl->Find(obj);
+	if(!item)
+		return;
+
+	item->m_hAlign = horizontal;
+	item->m_vAlign = vertical;
+	InvalidateItem(obj);
+}
+
+void GridPanel::InvalidateItem(Object* obj)
+{
+	GridItem* item = m_pImpl->Find(obj);
+	if(!item || item->m_dirty)
+		return;
+
+	item->m_dirty = true;
+	m_pImpl->m_dirtyItems.push_back(m_pImpl->m_index[obj]);
+	DirtyLayout();
+}
+
+D2D1_RECT_F GridPanel::GetCellRect(size_t row, size_t column) const
+{
+	size_t c, r, span;
+	m_pImpl->m_columns.Range(column, 1, c, span);
+	m_pImpl->m_rows.Range(row, 1, r, span);
+	return D2D1::RectF(m_pImpl->m_columns.Begin(c), m_pImpl->m_rows.Begin(r),
+		m_pImpl->m_columns.End(c, 1), m_pImpl->m_rows.End(r, 1));
+}
+
+D2D1_SIZE_F GridPanel::GetPreferredSize(D2D1_SIZE_F& max)
+{
+	// Fractions are sized to their items, like auto tracks
+	for(auto& item : m_pImpl->m_items)
+	{
+		if(!item.m_measured)
+			m_pImpl->Measure(item, max);
+	}
+
+	GridAxis columns = m_pImpl->m_columns;
+	GridAxis rows = m_pImpl->m_rows;
+	columns.Solve(m_pImpl->m_items, true, max.width, true);
+	rows.Solve(m_pImpl->m_items, false, max.height, true);
+	return D2D1::SizeF(columns.Total(), rows.Total());
+}
+
+void GridPanel::OnLayout()
+{
+	tjm::animation::StoryBoard b;
+	GridPanelImpl* impl = m_pImpl;
+	std::vector<GridItem>& items = impl->m_items;
+
+	// Without queued items the layout was asked for from outside, say by a
+	// margin change, so everything is redone
+	D2D1_SIZE_F size = GetSize();
+	bool full = impl->m_fullLayout || impl->m_dirtyItems.empty() ||
+		size.width != impl->m_lastSize.width || size.height != impl->m_lastSize.height;
+	impl->m_fullLayout = false;
+	impl->m_lastSize = size;
+
+	bool solve = full;
+	if(full)
+	{
+		for(auto& item : items)
+		{
+			impl->Measure(item, size);
+		}
+	}
+	else
+	{
+		for(size_t i : impl->m_dirtyItems)
+		{
+			GridItem& item = items[i];
+			D2D1_SIZE_F old = item.m_need;
+			impl->Measure(item, size);
+			if((old.width != item.m_need.width || old.height != item.m_need.height) && impl->TouchesAuto(item))
+				solve = true;
+		}
+	}
+
+	// Everything moves only if a track did
+	bool moved = full;
+	if(solve)
+	{
+		std::vector<FLOAT> columnStarts(impl->m_columns.m_starts);
+		std::vector<FLOAT> rowStarts(impl->m_rows.m_starts);
+		impl->m_columns.Solve(items, true, size.width, false);
+		impl->m_rows.Solve(items, false, size.height, false);
+		moved = moved || columnStarts != impl->m_columns.m_starts || rowStarts != impl->m_rows.m_starts;
+	}
+
+	if(moved)
+	{
+		for(auto& item : items)
+		{
+			impl->Place(item);
+		}
+	}
+	else
+	{
+		for(size_t i : impl->m_dirtyItems)
+		{
+			impl->Place(items[i]);
+		}
+	}
+
+	for(size_t i : impl->m_dirtyItems)
+	{
+		items[i].m_dirty = false;
+	}
+	impl->m_dirtyItems.clear();
+}
+
+} // end namespace dash
+} // end namespace tjm
@@ -0,0 +1,222 @@
+#include "DGui.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+struct InputRecordingImpl
+{
+	std::vector<InputEvent> m_events;
+};
+
+InputRecording::InputRecording() :
+m_pImpl(new InputRecordingImpl)
+{
+}
+
+InputRecording::~InputRecording()
+{
+	delete m_pImpl;
+}
+
+void InputRecording::Clear()
+{
+	m_pImpl->m_events.clear();
+}
+
+void InputRecording::Append(const InputEvent& e)
+{
+	m_pImpl->m_events.push_back(e);
+}
+
+size_t InputRecording::Size() const
+{
+	return m_pImpl->m_events.size();
+}
+
+const InputEvent& InputRecording::Get(size_t index) const
+{
+	return m_pImpl->m_events[index];
+}
+
+double InputRecording::GetDuration() const
+{
+	return m_pImpl->m_events.empty() ? 0.0 : m_pImpl->m_events.back().time;
+}
+
+bool InputRecording::Save(const std::string& path) const
+{
+	std::ofstream out(path);
+	if(!out)
+		return false;
+
+	// time type x y keytype key modifiers repeat
+	out.precision(9);
+	for(auto& e : m_pImpl->m_events)
+	{
+		out << e.time << ' ' << (int)e.type << ' ' << e.point.x << ' ' << e.point.y << ' '
+			<< (int)e.key.type << ' ' << e.key.key << ' ' << e.key.modifiers << ' ' << (e.key.repeat ? 1 : 0) << '\n';
+	}
+	return out.good();
+}
+
+bool InputRecording::Load(const std::string& path)
+{
+	std::ifstream in(path);
+	if(!in)
+		return false;
+
+	std::vector<InputEvent> events;
+	InputEvent e = {};
+	int type, keyType, repeat;
+	while(in >> e.time >> type >> e.point.x >> e.point.y >> keyType >> e.key.key >> e.key.modifiers >> repeat)
+	{
+		if(type < (int)InputEventType::TouchStart || type > (int)InputEventType::Key ||
+			keyType < (int)KeyEventType::Down || keyType > (int)KeyEventType::Char)
+			return false;
+
+		e.type = (InputEventType)type;
+		e.key.type = (KeyEventType)keyType;
+		e.key.repeat = repeat != 0;
+		events.push_back(e);
+	}
+	if(!in.eof())
+		return false;
+
+	m_pImpl->m_events.swap(events);
+	return true;
+}
+
+namespace {
+	// Samples kept for percentiles. Past this a uniform random subset of
+	// everything seen is kept, so a long session doesn't grow without bound.
+	const size_t c_reservoirSize = 4096;
+}
+
+struct LatencyStatsImpl
+{
+	std::vector<double> m_samples;
+	size_t m_count;
+	double m_max;
+	UINT32 m_random;
+	// Sorted copy for percentiles, rebuilt only after new samples
+	mutable std::vector<double> m_sorted;
+	mutable bool m_sortedValid;
+
+	LatencyStatsImpl() : m_count(0), m_max(0), m_random(2463534242u), m_sortedValid(true) {}
+
+	UINT32 NextRandom()
+	{
+		// xorshift32
+		m_random ^= m_random << 13;
+		m_random ^= m_random >> 17;
+		m_random ^= m_random << 5;
+		return m_random;
+	}
+};
+
+LatencyStats::LatencyStats() :
+m_pImpl(new LatencyStatsImpl)
+{
+}
+
+LatencyStats::~LatencyStats()
+{
+	delete m_pImpl;
+}
+
+void LatencyStats::AddSample(double seconds)
+{
+	LatencyStatsImpl* impl = m_pImpl;
+	++impl->m_count;
+	if(impl->m_count == 1 || seconds > impl->m_max)
+		impl->m_max = seconds;
+
+	if(impl->m_samples.size() < c_reservoirSize)
+	{
+		impl->m_samples.push_back(seconds);
+	}
+	else
+	{
+		// Replaces a kept sample with the chance every sample so far had
+		size_t slot = impl->NextRandom() % impl->m_count;
+		if(slot >= c_reservoirSize)
+			return;
+		impl->m_samples[slot] = seconds;
+	}
+	impl->m_sortedValid = false;
+}
+
+void LatencyStats::Reset()
+{
+	m_pImpl->m_samples.clear();
+	m_pImpl->m_count = 0;
+	m_pImpl->m_max = 0;
+	m_pImpl->m_sorted.clear();
+	m_pImpl->m_sortedValid = true;
+}
+
+size_t LatencyStats::Count() const
+{
+	return m_pImpl->m_count;
+}
+
+double LatencyStats::Percentile(double p) const
+{
+	if(m_pImpl->m_samples.empty())
+		return 0;
+
+	if(!m_pImpl->m_sortedValid)
+	{
+		m_pImpl->m_sorted = m_pImpl->m_samples;
+		std::sort(m_pImpl->m_sorted.begin(), m_pImpl->m_sorted.end());
+		m_pImpl->m_sortedValid = true;
+	}
+
+	const std::vector<double>& sorted = m_pImpl->m_sorted;
+	p = p < 0 ? 0 : p > 100 ? 100 : p;
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+double LatencyStats::Max() const
+{
+	return m_pImpl->m_max;
+}
+
+InputReplay::InputReplay(const InputRecording& recording, InputManager& target, double speed) :
+m_recording(recording),
+m_target(target),
+m_speed(speed > 0 ? speed : 1.0),
+m_next(0)
+{
+}
+
+size_t InputReplay::Advance(double elapsed)
+{
+	size_t sent = 0;
+	while(m_next < m_recording.Size() && m_recording.Get(m_next).time / m_speed <= elapsed)
+	{
+		m_target.Dispatch(m_recording.Get(m_next));
+		++m_next;
+		++sent;
+	}
+	return sent;
+}
+
+bool InputReplay::IsDone() const
+{
+	return m_next >= m_recording.Size();
+}
+
+double InputReplay::GetNextEventTime() const
+{
+	return IsDone() ? m_recording.GetDuration() / m_speed : m_recording.Get(m_next).time / m_speed;
+}
+
+} // end namespace dash
+} // end namespace tjm
@@ -0,0 +1,442 @@
+#include "DGui.h"
+#include "utils.h"
+#include "AnimatedVar.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+struct SplitPane
+{
+	Object* m_obj;
+	SplitLayoutType m_type;
+	FLOAT m_length;		// Fixed panes: the rule. Otherwise the last laid out length.
+	double m_weight;	// Variable panes' share; zero for an even share
+	FLOAT m_min;
+	FLOAT m_max;
+	FLOAT m_start;		// Offset along the split, from the last layout
+};
+
+struct MultiSplitterImpl
+{
+	Orientation m_orientation;
+	SplitterStyle m_style;
+	D2D1::ColorF m_color;
+	bool m_moveable;
+	FLOAT m_dividerWidth;
+	std::vector<SplitPane> m_panes;
+
+	size_t m_dragDivider;
+	FLOAT m_grabOffset;		// Touch position relative to the divider's centre
+
+	MultiSplitterImpl();
+};
+
+MultiSplitterImpl::MultiSplitterImpl() :
+m_orientation(Orientation::Horizontal),
+m_style(SplitterStyle::Line),
+m_color(D2D1::ColorF::LightGray),
+m_moveable(true),
+m_dividerWidth(15.0f),
+m_dragDivider(0),
+m_grabOffset(0)
+{
+}
+
+MultiSplitter::MultiSplitter() :
+m_pImpl(new MultiSplitterImpl())
+{
+	SetBatchedRendering(true);
+	SetTouchPrediction(true);
+}
+
+MultiSplitter::~MultiSplitter()
+{
+	delete m_pImpl;
+}
+
+void MultiSplitter::SetOrientation(Orientation o)
+{
+	m_pImpl->m_orientation = o;
+	DirtyLayout();
+}
+
+Orientation MultiSplitter::GetOrientation() const
+{
+	return m_pImpl->m_orientation;
+}
+
+void MultiSplitter::SetStyle(SplitterStyle s)
+{
+	m_pImpl->m_style = s;
+	Invalidate();
+}
+
+SplitterStyle MultiSplitter::GetStyle() const
+{
+	return m_pImpl->m_style;
+}
+
+void MultiSplitter::SetColor(D2D1::ColorF color)
+{
+	m_pImpl->m_color = color;
+	Invalidate();
+}
+
+D2D1::ColorF MultiSplitter::GetColor() const
+{
+	return m_pImpl->m_color;
+}
+
+void MultiSplitter::SetMoveable(bool moveable)
+{
+	m_pImpl->m_moveable = moveable;
+}
+
+bool MultiSplitter::GetMoveable() const
+{
+	return m_pImpl->m_moveable;
+}
+
+void MultiSplitter::SetDividerWidth(FLOAT width)
+{
+	if(width != m_pImpl->m_dividerWidth)
+	{
+		m_pImpl->m_dividerWidth = width;
+		DirtyLayout();
+	}
+}
+
+FLOAT MultiSplitter::GetDividerWidth() const
+{
+	return m_pImpl->m_dividerWidth;
+}
+
+void MultiSplitter::AddPane(Object* obj, SplitLayoutType layout, FLOAT length)
+{
+	SplitPane pane;
+	pane.m_obj = obj;
+	pane.m_type = layout;
+	pane.m_length = length;
+	pane.m_weight = length;
+	pane.m_min = 0;
+	pane.m_max = FLT_MAX;
+	pane.m_start = 0;
+	m_pImpl->m_panes.push_back(pane);
+	AddChild(obj);
+	DirtyLayout();
+}
+
+void MultiSplitter::RemovePane(Object* obj)
+{
+	std::vector<SplitPane>& panes = m_pImpl->m_panes;
+	for(auto it = panes.begin(); it != panes.end(); ++it)
+	{
+		if(it->m_obj == obj)
+		{
+			panes.erase(it);
+			RemoveChild(obj);
+			DirtyLayout();
+			return;
+		}
+	}
+}
+
+size_t MultiSplitter::NumPanes() const
+{
+	return m_pImpl->m_panes.size();
+}
+
+Object* MultiSplitter::GetPane(size_t i) const
+{
+	return m_pImpl->m_panes[i].m_obj;
+}
+
+void MultiSplitter::SetPaneLayoutType(size_t i, SplitLayoutType layout)
+{
+	SplitPane& pane = m_pImpl->m_panes[i];
+	pane.m_type = layout;
+	pane.m_weight = pane.m_length;
+	DirtyLayout();
+}
+
+SplitLayoutType MultiSplitter::GetPaneLayoutType(size_t i) const
+{
+	return m_pImpl->m_panes[i].m_type;
+}
+
+void MultiSplitter::SetPaneLength(size_t i, FLOAT length)
+{
+	SplitPane& pane = m_pImpl->m_panes[i];
+	pane.m_length = length;
+	pane.m_weight = length;
+	DirtyLayout();
+}
+
+FLOAT MultiSplitter::GetPaneLength(size_t i) const
+{
+	return m_pImpl->m_panes[i].m_length;
+}
+
+void MultiSplitter::SetPaneMin(size_t i, FLOAT min)
+{
+	m_pImpl->m_panes[i].m_min = min;
+	DirtyLayout();
+}
+
+void MultiSplitter::SetPaneMax(size_t i, FLOAT max)
+{
+	m_pImpl->m_panes[i].m_max = max;
+	DirtyLayout();
+}
+
+void MultiSplitter::MoveDivider(size_t i, FLOAT delta)
+{
+	std::vector<SplitPane>& panes = m_pImpl->m_panes;
+	if(i + 1 >= panes.size())
+		return;
+
+	// Only the panes either side change, and both stay within their limits
+	SplitPane& first = panes[i];
+	SplitPane& second = panes[i + 1];
+	FLOAT lo = max(first.m_min - first.m_length, second.m_length - second.m_max);
+	FLOAT hi = min(first.m_max - first.m_length, second.m_length - second.m_min);
+	if(lo > hi)
+		return;
+	delta = delta < lo ? lo : delta > hi ? hi : delta;
+	if(delta == 0)
+		return;
+
+	first.m_length += delta;
+	second.m_length -= delta;
+	second.m_start += delta;
+	first.m_weight = first.m_length;
+	second.m_weight = second.m_length;
+
+	PlacePane(i);
+	PlacePane(i + 1);
+	Invalidate();
+}
+
+FLOAT MultiSplitter::GetDividerPos(size_t i) const
+{
+	return m_pImpl->m_panes[i + 1].m_start - GetDividerWidth() / 2;
+}
+
+void MultiSplitter::OnLayout()
+{
+	tjm::animation::StoryBoard b;
+
+	std::vector<SplitPane>& panes = m_pImpl->m_panes;
+	if(panes.empty())
+		return;
+
+	bool horizontal = GetOrientation() == Orientation::Horizontal;
+	FLOAT dividers = GetDividerWidth() * (panes.size() - 1);
+	FLOAT available = (horizontal ? GetSize().width : GetSize().height) - dividers;
+
+	// Fixed panes take their length; the rest is shared out by weight
+	FLOAT fixed = 0;
+	double weights = 0;
+	size_t weighted = 0;
+	size_t unweighted = 0;
+	for(auto& pane : panes)
+	{
+		if(pane.m_type == SplitLayoutType::Fixed)
+		{
+			pane.m_length = pane.m_length < pane.m_min ? pane.m_min : pane.m_length > pane.m_max ? pane.m_max : pane.m_length;
+			fixed += pane.m_length;
+		}
+		else if(pane.m_weight > 0)
+		{
+			weights += pane.m_weight;
+			++weighted;
+		}
+		else
+		{
+			++unweighted;
+		}
+	}
+
+	// New panes get the average share
+	double evenShare = weighted > 0 ? weights / weighted : 1.0;
+	weights += evenShare * unweighted;
+
+	FLOAT remaining = max(available - fixed, 0.0f);
+	FLOAT leftover = remaining;
+	for(auto& pane : panes)
+	{
+		if(pane.m_type == SplitLayoutType::Fixed)
+			continue;
+
+		double weight = pane.m_weight > 0 ? pane.m_weight : evenShare;
+		FLOAT length = weights > 0 ? (FLOAT)(remaining * weight / weights) : 0.0f;
+		pane.m_length = length < pane.m_min ? pane.m_min : length > pane.m_max ? pane.m_max : length;
+		leftover -= pane.m_length;
+	}
+
+	// Space gained or lost to limits goes to the first variable panes with
+	// room for it, then the offsets are a running sum
+	FLOAT start = 0;
+	for(size_t i = 0; i < panes.size(); ++i)
+	{
+		SplitPane& pane = panes[i];
+		if(pane.m_type != SplitLayoutType::Fixed && leftover != 0)
+		{
+			FLOAT room = leftover > 0 ? pane.m_max - pane.m_length : pane.m_min - pane.m_length;
+			FLOAT take = leftover > 0 ? min(room, leftover) : max(room, leftover);
+			pane.m_length += take;
+			leftover -= take;
+		}
+		if(pane.m_type != SplitLayoutType::Fixed)
+			pane.m_weight = pane.m_length;
+
+		pane.m_start = start;
+		start += pane.m_length + GetDividerWidth();
+		PlacePane(i);
+	}
+
+	Invalidate();
+}
+
+void MultiSplitter::PlacePane(size_t i)
+{
+	const SplitPane& pane = m_pImpl->m_panes[i];
+	Object* obj = pane.m_obj;
+	FLOAT left, top, right, bottom;
+	if(GetOrientation() == Orientation::Horizontal)
+	{
+		left = pane.m_start + obj->GetMarginLeft();
+		right = pane.m_start + pane.m_length - obj->GetMarginRight();
+		top = obj->GetMarginTop();
+		bottom = GetSize().height - obj->GetMarginBottom();
+	}
+	else
+	{
+		left = obj->GetMarginLeft();
+		right = GetSize().width - obj->GetMarginRight();
+		top = pane.m_start + obj->GetMarginTop();
+		bottom = pane.m_start + pane.m_length - obj->GetMarginBottom();
+	}
+	obj->SetPosition(D2D1::Point2F(left, top));
+	obj->SetSize(D2D1::SizeF(max(right - left, 0.0f), max(bottom - top, 0.0f)));
+}
+
+D2D1_SIZE_F MultiSplitter::GetPreferredSize(D2D1_SIZE_F& max)
+{
+	bool horizontal = GetOrientation() == Orientation::Horizontal;
+	FLOAT along = 0;
+	FLOAT across = 0;
+	for(auto& pane : m_pImpl->m_panes)
+	{
+		D2D1_SIZE_F size = pane.m_obj->GetPreferredSize(max);
+		FLOAT paneAlong = horizontal ? size.width : size.height;
+		FLOAT paneAcross = horizontal ? size.height : size.width;
+		along += pane.m_type == SplitLayoutType::Fixed ? pane.m_length : paneAlong;
+		if(paneAcross > across)
+			across = paneAcross;
+	}
+	if(!m_pImpl->m_panes.empty())
+		along += GetDividerWidth() * (m_pImpl->m_panes.size() - 1);
+
+	return horizontal ? D2D1::SizeF(along, across) : D2D1::SizeF(across, along);
+}
+
+void MultiSplitter::OnRenderForeground(ID2D1RenderTarget* /*pTarget*/, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/)
+{
+	RenderContext* ctx = GetRenderContext();
+	const FLOAT stroke = 1.0f;
+	std::vector<SplitPane>& panes = m_pImpl->m_panes;
+	bool horizontal = GetOrientation() == Orientation::Horizontal;
+	FLOAT half = GetDividerWidth() / 2;
+	FLOAT height = horizontal ? GetSize().height : GetSize().width;
+
+	for(size_t i = 1; i < panes.size() && GetStyle() != SplitterStyle::None; ++i)
+	{
+		// Follow the pane as it animates
+		Object* obj = panes[i].m_obj;
+		FLOAT pos = horizontal ? obj->GetPosition().x - obj->GetMarginLeft() - half :
+			obj->GetPosition().y - obj->GetMarginTop() - half;
+
+		switch(GetStyle())
+		{
+		case SplitterStyle::None:
+			break;
+		case SplitterStyle::Line:
+			ctx->FillRectangle(horizontal ? D2D1::RectF(pos - stroke, 0, pos + stroke, height) :
+				D2D1::RectF(0, pos - stroke, height, pos + stroke), GetColor());
+			break;
+		case SplitterStyle::Box:
+			{
+				D2D1_RECT_F r = horizontal ? D2D1::RectF(pos - half, 0, pos + half, height) :
+					D2D1::RectF(0, pos - half, height, pos + half);
+				ctx->FillRectangle(D2D1::RectF(r.left - stroke, r.top - stroke, r.right + stroke, r.top + stroke), GetColor());
+				ctx->FillRectangle(D2D1::RectF(r.left - stroke, r.bottom - stroke, r.right + stroke, r.bottom + stroke), GetColor());
+				ctx->FillRectangle(D2D1::RectF(r.left - stroke, r.top + stroke, r.left + stroke, r.bottom - stroke), GetColor());
+				ctx->FillRectangle(D2D1::RectF(r.right - stroke, r.top + stroke, r.right + stroke, r.bottom - stroke), GetColor());
+			}
+			break;
+		case SplitterStyle::Dots:
+			{
+				D2D1_ELLIPSE ellipse;
+				ellipse.radiusX = ellipse.radiusY = GetDividerWidth() / 6;
+				FLOAT step = GetDividerWidth();
+				FLOAT circlePos = (height / 2) - (3 * step);
+				for(int dot = 0; dot < 7; ++dot)
+				{
+					ellipse.point = horizontal ? D2D1::Point2F(pos, circlePos) : D2D1::Point2F(circlePos, pos);
+					ctx->FillEllipse(ellipse, GetColor());
+					circlePos += step;
+				}
+			}
+			break;
+		}
+	}
+}
+
+Object* MultiSplitter::OnTouch(const D2D1_POINT_2F& pos)
+{
+	std::vector<SplitPane>& panes = m_pImpl->m_panes;
+	if(!GetMoveable() || panes.size() < 2)
+		return nullptr;
+
+	// The divider before the first pane starting past the touch
+	FLOAT along = GetOrientation() == Orientation::Horizontal ? pos.x : pos.y;
+	auto next = std::upper_bound(panes.begin() + 1, panes.end(), along,
+		[](FLOAT value, const SplitPane& pane) { return value < pane.m_start; });
+	if(next == panes.end())
+		return nullptr;
+
+	size_t divider = (size_t)(next - panes.begin()) - 1;
+	FLOAT center = GetDividerPos(divider);
+	if(along < center - GetDividerWidth() / 2)
+		return nullptr;
+
+	m_pImpl->m_dragDivider = divider;
+	m_pImpl->m_grabOffset = along - center;
+	return this;
+}
+
+bool MultiSplitter::OnTouchContinue(const TouchInfo& ti)
+{
+	tjm::animation::AllInstant ai(true);
+	FLOAT along = GetOrientation() == Orientation::Horizontal ? ti.predictedTouch.x : ti.predictedTouch.y;
+	size_t divider = m_pImpl->m_dragDivider;
+	MoveDivider(divider, along - m_pImpl->m_grabOffset - GetDividerPos(divider));
+	return true;
+}
+
+void MultiSplitter::OnTouchFinish(const TouchInfo& ti)
+{
+	// Settle on where the touch really ended, not the last prediction
+	tjm::animation::AllInstant ai(true);
+	FLOAT along = GetOrientation() == Orientation::Horizontal ? ti.currentTouch.x : ti.currentTouch.y;
+	size_t divider = m_pImpl->m_dragDivider;
+	MoveDivider(divider, along - m_pImpl->m_grabOffset - GetDividerPos(divider));
+}
+
+} // end namespace dash
+} // end namespace tjm
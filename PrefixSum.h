@@ -0,0 +1,83 @@
+#ifndef PREFIXSUM_H
+#define PREFIXSUM_H
+
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+// Sizes of a run of items (rows, columns) as a Fenwick tree: changing one
+// size, the offset of an item and the item at an offset are all O(log n).
+class PrefixSum
+{
+public:
+	PrefixSum() : m_top(0) {}
+
+	void Reset(size_t count, double size)
+	{
+		m_sizes.assign(count, size);
+		m_tree.assign(count + 1, 0.0);
+		for(size_t i = 1; i <= count; ++i)
+		{
+			m_tree[i] += size;
+			size_t parent = i + (i & (0 - i));
+			if(parent <= count)
+				m_tree[parent] += m_tree[i];
+		}
+		for(m_top = 1; m_top * 2 <= count; m_top *= 2) { }
+	}
+
+	size_t Count() const { return m_sizes.size(); }
+	double Get(size_t i) const { return m_sizes[i]; }
+
+	void Set(size_t i, double size)
+	{
+		double delta = size - m_sizes[i];
+		m_sizes[i] = size;
+		for(size_t j = i + 1; j < m_tree.size(); j += j & (0 - j))
+		{
+			m_tree[j] += delta;
+		}
+	}
+
+	// Total size of items [0, end)
+	double Sum(size_t end) const
+	{
+		double sum = 0;
+		for(size_t j = end; j > 0; j -= j & (0 - j))
+		{
+			sum += m_tree[j];
+		}
+		return sum;
+	}
+
+	double Total() const { return Sum(Count()); }
+
+	// The item covering offset, or Count() if offset is past the end
+	size_t Find(double offset) const
+	{
+		if(offset < 0)
+			return 0;
+
+		size_t pos = 0;
+		for(size_t step = m_sizes.empty() ? 0 : m_top; step > 0; step /= 2)
+		{
+			if(pos + step < m_tree.size() && m_tree[pos + step] <= offset)
+			{
+				pos += step;
+				offset -= m_tree[pos];
+			}
+		}
+		return pos;
+	}
+
+private:
+	std::vector<double> m_sizes;
+	std::vector<double> m_tree;		// 1-based
+	size_t m_top;					// Highest power of two not above Count()
+};
+
+} // end namespace dash
+} // end namespace tjm
+
+#endif
@@ -0,0 +1,313 @@
+#include "DGui.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <vector>
+#include <xmmintrin.h>
+
+namespace tjm {
+namespace dash {
+
+struct RectBatchImpl
+{
+	// Cell rects as separate arrays so four cells test in one SSE compare.
+	// They are padded to a multiple of four with NaN, which fails every
+	// comparison, so there is no scalar tail.
+	std::vector<FLOAT> m_left;
+	std::vector<FLOAT> m_top;
+	std::vector<FLOAT> m_right;
+	std::vector<FLOAT> m_bottom;
+	std::vector<D2D1_COLOR_F> m_colors;
+	std::vector<BYTE> m_visible;
+	size_t m_count;
+
+	std::vector<size_t> m_drawList; // Render scratch, reused across frames
+
+	// The draw list is kept between frames while the cells and the box
+	// stay the same. Without overlaps it is sorted by colour, so the
+	// batcher gets each colour's cells together and merges them.
+	D2D1_RECT_F m_drawBox;
+	bool m_drawListValid;
+	bool m_overlapChecked;
+	bool m_overlaps;
+	std::vector<size_t> m_sweep;
+
+	// Invalidate has been called since the cells were last drawn
+	bool m_invalidated;
+
+	RectBatchImpl();
+	void Grow(size_t count);
+	void Cull(const D2D1_RECT_F& box);
+	bool Overlaps();
+	void SortByColor();
+};
+
+namespace {
+	bool ColorLess(const D2D1_COLOR_F& a, const D2D1_COLOR_F& b)
+	{
+		if(a.r != b.r)
+			return a.r < b.r;
+		if(a.g != b.g)
+			return a.g < b.g;
+		if(a.b != b.b)
+			return a.b < b.b;
+		return a.a < b.a;
+	}
+}
+
+RectBatchImpl::RectBatchImpl() :
+m_count(0),
+m_drawBox(D2D1::RectF(0, 0, 0, 0)),
+m_drawListValid(false),
+m_overlapChecked(false),
+m_overlaps(false),
+m_invalidated(false)
+{
+}
+
+void RectBatchImpl::Grow(size_t count)
+{
+	size_t padded = (count + 3) & ~(size_t)3;
+	if(padded <= m_left.size())
+		return;
+
+	const FLOAT nan = std::numeric_limits<FLOAT>::quiet_NaN();
+	m_left.resize(padded, nan);
+	m_top.resize(padded, nan);
+	m_right.resize(padded, nan);
+	m_bottom.resize(padded, nan);
+}
+
+void RectBatchImpl::Cull(const D2D1_RECT_F& box)
+{
+	m_drawList.clear();
+
+	const __m128 boxLeft = _mm_set1_ps(box.left);
+	const __m128 boxTop = _mm_set1_ps(box.top);
+	const __m128 boxRight = _mm_set1_ps(box.right);
+	const __m128 boxBottom = _mm_set1_ps(box.bottom);
+
+	for(size_t i = 0; i < m_left.size(); i += 4)
+	{
+		__m128 x = _mm_and_ps(_mm_cmpgt_ps(_mm_loadu_ps(&m_right[i]), boxLeft), _mm_cmplt_ps(_mm_loadu_ps(&m_left[i]), boxRight));
+		__m128 y = _mm_and_ps(_mm_cmpgt_ps(_mm_loadu_ps(&m_bottom[i]), boxTop), _mm_cmplt_ps(_mm_loadu_ps(&m_top[i]), boxBottom));
+		int mask = _mm_movemask_ps(_mm_and_ps(x, y));
+		if(!mask)
+			continue;
+
+		for(size_t j = 0; j < 4; ++j)
+		{
+			if((mask & (1 << j)) && m_visible[i + j])
+				m_drawList.push_back(i + j);
+		}
+	}
+}
+
+bool RectBatchImpl::Overlaps()
+{
+	if(m_overlapChecked)
+		return m_overlaps;
+
+	// Sweep along x; only cells whose x ranges meet need the y test. Run
+	// when rects change, not when colours do.
+	std::vector<size_t>& order = m_sweep;
+	order.resize(m_count);
+	for(size_t i = 0; i < m_count; ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [this](size_t a, size_t b) { return m_left[a] < m_left[b]; });
+
+	m_overlaps = false;
+	for(size_t i = 0; i < m_count && !m_overlaps; ++i)
+	{
+		size_t a = order[i];
+		for(size_t j = i + 1; j < m_count && m_left[order[j]] < m_right[a]; ++j)
+		{
+			size_t b = order[j];
+			if(m_top[b] < m_bottom[a] && m_top[a] < m_bottom[b])
+			{
+				m_overlaps = true;
+				break;
+			}
+		}
+	}
+	m_overlapChecked = true;
+	return m_overlaps;
+}
+
+void RectBatchImpl::SortByColor()
+{
+	// Cells that don't overlap can be drawn in any order
+	std::sort(m_drawList.begin(), m_drawList.end(), [this](size_t a, size_t b)
+	{
+		const D2D1_COLOR_F& ca = m_colors[a];
+		const D2D1_COLOR_F& cb = m_colors[b];
+		if(ColorLess(ca, cb))
+			return true;
+		if(ColorLess(cb, ca))
+			return false;
+		return a < b;
+	});
+}
+
+RectBatch::RectBatch() :
+m_pImpl(new RectBatchImpl())
+{
+	SetBatchedRendering(true);
+}
+
+RectBatch::~RectBatch()
+{
+	delete m_pImpl;
+}
+
+size_t RectBatch::AddCell(const D2D1_RECT_F& rect, const D2D1_COLOR_F& color)
+{
+	size_t cell = m_pImpl->m_count++;
+	m_pImpl->Grow(m_pImpl->m_count);
+	m_pImpl->m_colors.push_back(color);
+	m_pImpl->m_visible.push_back(1);
+	SetCellRect(cell, rect);
+	return cell;
+}
+
+void RectBatch::ReserveCells(size_t count)
+{
+	size_t padded = (count + 3) & ~(size_t)3;
+	m_pImpl->m_left.reserve(padded);
+	m_pImpl->m_top.reserve(padded);
+	m_pImpl->m_right.reserve(padded);
+	m_pImpl->m_bottom.reserve(padded);
+	m_pImpl->m_colors.reserve(count);
+	m_pImpl->m_visible.reserve(count);
+}
+
+void RectBatch::ClearCells()
+{
+	m_pImpl->m_left.clear();
+	m_pImpl->m_top.clear();
+	m_pImpl->m_right.clear();
+	m_pImpl->m_bottom.clear();
+	m_pImpl->m_colors.clear();
+	m_pImpl->m_visible.clear();
+	m_pImpl->m_count = 0;
+	m_pImpl->m_overlapChecked = false;
+	InvalidateCells();
+}
+
+size_t RectBatch::NumCells() const
+{
+	return m_pImpl->m_count;
+}
+
+void RectBatch::SetCellRect(size_t cell, const D2D1_RECT_F& rect)
+{
+	assert(cell < m_pImpl->m_count);
+	m_pImpl->m_left[cell] = rect.left;
+	m_pImpl->m_top[cell] = rect.top;
+	m_pImpl->m_right[cell] = rect.right;
+	m_pImpl->m_bottom[cell] = rect.bottom;
+	m_pImpl->m_overlapChecked = false;
+	InvalidateCells();
+}
+
+D2D1_RECT_F RectBatch::GetCellRect(size_t cell) const
+{
+	assert(cell < m_pImpl->m_count);
+	return D2D1::RectF(m_pImpl->m_left[cell], m_pImpl->m_top[cell], m_pImpl->m_right[cell], m_pImpl->m_bottom[cell]);
+}
+
+void RectBatch::SetCellColor(size_t cell, const D2D1_COLOR_F& color)
+{
+	assert(cell < m_pImpl->m_count);
+	m_pImpl->m_colors[cell] = color;
+	InvalidateCells();
+}
+
+void RectBatch::SetCellColors(size_t first, size_t count, const D2D1_COLOR_F* colors)
+{
+	assert(first + count <= m_pImpl->m_count);
+	std::copy(colors, colors + count, m_pImpl->m_colors.begin() + first);
+	InvalidateCells();
+}
+
+D2D1_COLOR_F RectBatch::GetCellColor(size_t cell) const
+{
+	assert(cell < m_pImpl->m_count);
+	return m_pImpl->m_colors[cell];
+}
+
+void RectBatch::SetCellVisible(size_t cell, bool visible)
+{
+	assert(cell < m_pImpl->m_count);
+	m_pImpl->m_visible[cell] = visible ? 1 : 0;
+	InvalidateCells();
+}
+
+bool RectBatch::IsCellVisible(size_t cell) const
+{
+	assert(cell < m_pImpl->m_count);
+	return m_pImpl->m_visible[cell] != 0;
+}
+
+size_t RectBatch::HitTestCell(const D2D1_POINT_2F& pos) const
+{
+	const __m128 x = _mm_set1_ps(pos.x);
+	const __m128 y = _mm_set1_ps(pos.y);
+
+	// Later cells draw on top, so search from the back
+	for(size_t i = m_pImpl->m_left.size(); i > 0; i -= 4)
+	{
+		size_t base = i - 4;
+		__m128 inX = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&m_pImpl->m_left[base]), x), _mm_cmpgt_ps(_mm_loadu_ps(&m_pImpl->m_right[base]), x));
+		__m128 inY = _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&m_pImpl->m_top[base]), y), _mm_cmpgt_ps(_mm_loadu_ps(&m_pImpl->m_bottom[base]), y));
+		int mask = _mm_movemask_ps(_mm_and_ps(inX, inY));
+		if(!mask)
+			continue;
+
+		for(size_t j = 4; j > 0; --j)
+		{
+			if((mask & (1 << (j - 1))) && m_pImpl->m_visible[base + j - 1])
+				return base + j - 1;
+		}
+	}
+	return NoCell;
+}
+
+void RectBatch::InvalidateCells()
+{
+	// Invalidate walks to the root; once per frame's worth of changes is enough
+	m_pImpl->m_drawListValid = false;
+	if(!m_pImpl->m_invalidated)
+	{
+		m_pImpl->m_invalidated = true;
+		Invalidate();
+	}
+}
+
+void RectBatch::OnRenderBackground(ID2D1RenderTarget* /*pTarget*/, const D2D1_RECT_F& box, DOUBLE effectiveOpacity)
+{
+	m_pImpl->m_invalidated = false;
+	const D2D1_RECT_F& last = m_pImpl->m_drawBox;
+	if(!m_pImpl->m_drawListValid || box.left != last.left || box.top != last.top || box.right != last.right || box.bottom != last.bottom)
+	{
+		m_pImpl->Cull(box);
+		if(!m_pImpl->Overlaps())
+			m_pImpl->SortByColor();
+		m_pImpl->m_drawBox = box;
+		m_pImpl->m_drawListValid = true;
+	}
+
+	RenderContext* ctx = GetRenderContext();
+	for(size_t cell : m_pImpl->m_drawList)
+	{
+		const D2D1_COLOR_F& color = m_pImpl->m_colors[cell];
+		if(color.a * effectiveOpacity < 0.001)
+			continue;
+		ctx->FillRectangle(GetCellRect(cell), color, (FLOAT)effectiveOpacity);
+	}
+}
+
+} // end namespace dash
+} // end namespace tjm
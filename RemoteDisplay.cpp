@@ -0,0 +1,756 @@
+// Before anything pulls in windows.h, which would bring the old winsock
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "DGui.h"
+#include "AnimatedVar.h"
+#include "utils.h"
+
+#include <atlbase.h>
+#include <wincodec.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+namespace {
+	const UINT c_tileSize = 64;
+
+	// Each message is a type byte and a payload length, then the payload
+	const BYTE c_frameMessage = 1;
+	const BYTE c_inputMessage = 2;
+	// Frame flag: the viewer starts from a blank picture before applying it
+	const UINT32 c_frameReset = 1;
+	const size_t c_messageHeader = 1 + sizeof(UINT32);
+	// A peer claiming more than this is dropped rather than buffered
+	const UINT32 c_maxMessage = 64 * 1024 * 1024;
+	const UINT32 c_maxFrameSide = 16384;
+
+	// Whether the viewer will take a frame this size. Its picture is
+	// allocated from the peer's header, so it is held to the message limit.
+	bool FrameFits(UINT32 width, UINT32 height)
+	{
+		return width <= c_maxFrameSide && height <= c_maxFrameSide &&
+			(UINT64)width * height * 4 <= c_maxMessage;
+	}
+
+	// Top bit of a run count: one value repeated, rather than literals
+	const UINT16 c_repeatRun = 0x8000;
+	const size_t c_maxRun = 0x7FFF;
+
+	template<class T> void Put(std::vector<BYTE>& out, const T& value)
+	{
+		const BYTE* p = (const BYTE*)&value;
+		out.insert(out.end(), p, p + sizeof(T));
+	}
+
+	template<class T> bool Take(const BYTE*& p, const BYTE* end, T& value)
+	{
+		if((size_t)(end - p) < sizeof(T))
+			return false;
+		memcpy(&value, p, sizeof(T));
+		p += sizeof(T);
+		return true;
+	}
+
+	// Deltas of unchanged pixels are long zero runs, and new content is
+	// mostly runs of its background, so both come out small
+	void EncodeRuns(const UINT32* values, size_t count, std::vector<BYTE>& out)
+	{
+		size_t i = 0;
+		while(i < count)
+		{
+			size_t run = 1;
+			while(i + run < count && run < c_maxRun && values[i + run] == values[i])
+				++run;
+			if(run >= 3)
+			{
+				Put(out, (UINT16)(c_repeatRun | run));
+				Put(out, values[i]);
+				i += run;
+				continue;
+			}
+
+			// Literals up to the next run worth encoding
+			size_t literals = 0;
+			while(i + literals < count && literals < c_maxRun)
+			{
+				size_t j = i + literals;
+				if(j + 2 < count && values[j] == values[j + 1] && values[j] == values[j + 2])
+					break;
+				++literals;
+			}
+			Put(out, (UINT16)literals);
+			const BYTE* p = (const BYTE*)(values + i);
+			out.insert(out.end(), p, p + literals * sizeof(UINT32));
+			i += literals;
+		}
+	}
+
+	bool DecodeRuns(const BYTE*& p, const BYTE* end, UINT32* values, size_t count)
+	{
+		size_t i = 0;
+		while(i < count)
+		{
+			UINT16 header;
+			if(!Take(p, end, header))
+				return false;
+			size_t run = header & ~c_repeatRun;
+			if(run == 0 || run > count - i)
+				return false;
+
+			if(header & c_repeatRun)
+			{
+				UINT32 value;
+				if(!Take(p, end, value))
+					return false;
+				for(size_t k = 0; k < run; ++k)
+					values[i + k] = value;
+			}
+			else
+			{
+				if((size_t)(end - p) < run * sizeof(UINT32))
+					return false;
+				memcpy(values + i, p, run * sizeof(UINT32));
+				p += run * sizeof(UINT32);
+			}
+			i += run;
+		}
+		return true;
+	}
+
+	void PutInput(std::vector<BYTE>& out, const InputEvent& e)
+	{
+		Put(out, (UINT32)e.type);
+		Put(out, e.time);
+		Put(out, e.point.x);
+		Put(out, e.point.y);
+		Put(out, (UINT32)e.key.type);
+		Put(out, (UINT32)e.key.key);
+		Put(out, (UINT32)e.key.modifiers);
+		Put(out, (BYTE)(e.key.repeat ? 1 : 0));
+	}
+
+	bool TakeInput(const BYTE*& p, const BYTE* end, InputEvent& e)
+	{
+		UINT32 type, keyType, key, modifiers;
+		BYTE repeat;
+		if(!Take(p, end, type) || !Take(p, end, e.time) || !Take(p, end, e.point.x) || !Take(p, end, e.point.y) ||
+			!Take(p, end, keyType) || !Take(p, end, key) || !Take(p, end, modifiers) || !Take(p, end, repeat))
+		{
+			return false;
+		}
+		if(type > (UINT32)InputEventType::Key || keyType > (UINT32)KeyEventType::Char)
+			return false;
+
+		e.type = (InputEventType)type;
+		e.key.type = (KeyEventType)keyType;
+		e.key.key = key;
+		e.key.modifiers = modifiers;
+		e.key.repeat = repeat != 0;
+		return true;
+	}
+
+	// A non-blocking stream of messages. Writes queue up and go out as the
+	// socket takes them, so a slow peer never blocks the caller.
+	struct RemoteSocket
+	{
+		SOCKET m_socket;
+		// Messages are taken from m_inRead on and the buffer compacted once
+		// per Read, so a burst of small ones doesn't shift it each time
+		std::vector<BYTE> m_in;
+		size_t m_inRead;
+		std::vector<BYTE> m_out;
+		size_t m_outSent;
+
+		RemoteSocket() : m_socket(INVALID_SOCKET), m_inRead(0), m_outSent(0) {}
+		~RemoteSocket() { Close(); }
+
+		bool IsOpen() const { return m_socket != INVALID_SOCKET; }
+		bool Idle() const { return m_outSent == m_out.size(); }
+
+		bool Attach(SOCKET s)
+		{
+			Close();
+			ULONG nonBlocking = 1;
+			BOOL noDelay = TRUE;
+			if(ioctlsocket(s, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+			{
+				closesocket(s);
+				return false;
+			}
+			setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+			m_socket = s;
+			return true;
+		}
+
+		void Close()
+		{
+			if(m_socket != INVALID_SOCKET)
+				closesocket(m_socket);
+			m_socket = INVALID_SOCKET;
+			m_in.clear();
+			m_inRead = 0;
+			m_out.clear();
+			m_outSent = 0;
+		}
+
+		void Queue(BYTE type, const std::vector<BYTE>& payload)
+		{
+			Put(m_out, type);
+			Put(m_out, (UINT32)payload.size());
+			m_out.insert(m_out.end(), payload.begin(), payload.end());
+		}
+
+		// False once the connection is gone
+		bool Flush()
+		{
+			while(IsOpen() && m_outSent < m_out.size())
+			{
+				int chunk = (int)min(m_out.size() - m_outSent, (size_t)(1 << 20));
+				int sent = send(m_socket, (const char*)m_out.data() + m_outSent, chunk, 0);
+				if(sent == SOCKET_ERROR)
+				{
+					if(WSAGetLastError() == WSAEWOULDBLOCK)
+						return true;
+					Close();
+					return false;
+				}
+				m_outSent += sent;
+			}
+			if(m_outSent == m_out.size())
+			{
+				m_out.clear();
+				m_outSent = 0;
+			}
+			return IsOpen();
+		}
+
+		bool Read()
+		{
+			m_in.erase(m_in.begin(), m_in.begin() + m_inRead);
+			m_inRead = 0;
+
+			char buffer[64 * 1024];
+			while(IsOpen())
+			{
+				int got = recv(m_socket, buffer, sizeof(buffer), 0);
+				if(got > 0)
+				{
+					m_in.insert(m_in.end(), buffer, buffer + got);
+					continue;
+				}
+				if(got == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK)
+					return true;
+				Close();
+			}
+			return false;
+		}
+
+		// Takes the next complete message, if there is one
+		bool Next(BYTE& type, std::vector<BYTE>& payload)
+		{
+			size_t available = m_in.size() - m_inRead;
+			if(available < c_messageHeader)
+				return false;
+			const BYTE* message = m_in.data() + m_inRead;
+			UINT32 length;
+			memcpy(&length, message + 1, sizeof(length));
+			if(length > c_maxMessage)
+			{
+				Close();
+				return false;
+			}
+			if(available < c_messageHeader + length)
+				return false;
+
+			type = message[0];
+			payload.assign(message + c_messageHeader, message + c_messageHeader + length);
+			m_inRead += c_messageHeader + length;
+			return true;
+		}
+	};
+}
+
+struct RemoteDisplayImpl
+{
+	Object* m_root;
+	InputManager& m_input;
+	bool m_winsock;
+	SOCKET m_listener;
+	RemoteSocket m_viewer;
+
+	CComPtr<ID2D1Factory> m_factory;
+	CComPtr<IWICImagingFactory> m_wic;
+	CComPtr<IWICBitmap> m_bitmap;
+	CComPtr<ID2D1RenderTarget> m_target;
+	RenderContext m_context;
+	D2D1_SIZE_U m_size;
+
+	// What the viewer is showing, which frames are diffed against. Only a
+	// new viewer or size starts it over, and the viewer is told so.
+	std::vector<UINT32> m_shown;
+	bool m_reset;
+	// The root's version when last drawn, and whether anything was still
+	// moving then
+	unsigned m_version;
+	bool m_animating;
+	std::vector<UINT32> m_delta;
+	std::vector<BYTE> m_frame;
+	std::vector<BYTE> m_message;
+
+	RemoteDisplayStats m_stats;
+
+	RemoteDisplayImpl(Object* root, InputManager& input);
+	void Accept();
+	void ReadInput();
+	bool NeedsFrame(D2D1_SIZE_U size) const;
+	bool Render(D2D1_SIZE_U size);
+	void Encode(const BYTE* pixels, UINT stride);
+};
+
+RemoteDisplayImpl::RemoteDisplayImpl(Object* root, InputManager& input) :
+m_root(root),
+m_input(input),
+m_winsock(false),
+m_listener(INVALID_SOCKET),
+m_size(D2D1::SizeU(0, 0)),
+m_reset(true),
+m_version(0),
+m_animating(false)
+{
+	m_stats = RemoteDisplayStats();
+}
+
+void RemoteDisplayImpl::Accept()
+{
+	SOCKET s = accept(m_listener, nullptr, nullptr);
+	if(s == INVALID_SOCKET || !m_viewer.Attach(s))
+		return;
+
+	// A new viewer has nothing yet, so everything goes out
+	m_reset = true;
+}
+
+void RemoteDisplayImpl::ReadInput()
+{
+	m_viewer.Read();
+
+	BYTE type;
+	while(m_viewer.Next(type, m_message))
+	{
+		const BYTE* p = m_message.data();
+		const BYTE* end = p + m_message.size();
+		InputEvent e = {};
+		if(type != c_inputMessage || !TakeInput(p, end, e))
+		{
+			m_viewer.Close();
+			return;
+		}
+		++m_stats.inputEvents;
+		m_input.Dispatch(e);
+	}
+}
+
+bool RemoteDisplayImpl::NeedsFrame(D2D1_SIZE_U size) const
+{
+	return m_reset || !m_target || size.width != m_size.width || size.height != m_size.height ||
+		m_animating || m_root->NeedsLayout() || m_root->GetVersion() != m_version;
+}
+
+bool RemoteDisplayImpl::Render(D2D1_SIZE_U size)
+{
+	if(!m_factory)
+		CORt(D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &m_factory));
+	if(!m_wic)
+		CORt(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&m_wic));
+
+	// A lost target is made again at the same size; the viewer's picture
+	// and m_shown still match, so deltas carry on from them
+	bool resized = size.width != m_size.width || size.height != m_size.height;
+	if(!m_target || resized)
+	{
+		m_context.SetTarget(nullptr);
+		m_target.Release();
+		m_bitmap.Release();
+		CORt(m_wic->CreateBitmap(size.width, size.height, GUID_WICPixelFormat32bppPBGRA, WICBitmapCacheOnLoad, &m_bitmap));
+		CORt(m_factory->CreateWicBitmapRenderTarget(m_bitmap, D2D1::RenderTargetProperties(), &m_target));
+		m_context.SetTarget(m_target);
+		m_size = size;
+	}
+
+	// Both ends start a new size or viewer from nothing
+	if(resized)
+		m_reset = true;
+	if(m_reset)
+		m_shown.assign((size_t)size.width * size.height, 0);
+
+	// The target is at 96 DPI, so DIPs are pixels
+	D2D1_SIZE_F dips = D2D1::SizeF((FLOAT)size.width, (FLOAT)size.height);
+	{
+		bool resized = m_root->GetSize().width != dips.width || m_root->GetSize().height != dips.height;
+		tjm::animation::AllInstant ai(resized);
+		m_root->SetSize(dips);
+		m_root->Layout();
+	}
+	m_version = m_root->GetVersion();
+
+	m_target->BeginDraw();
+	m_target->SetTransform(D2D1::Matrix3x2F::Identity());
+	m_target->Clear(D2D1::ColorF(D2D1::ColorF::White));
+	m_context.BeginFrame();
+	m_root->Render(m_context, m_root->GetBoundingBox());
+	m_context.EndFrame();
+	m_animating = m_context.IsFrameRequested() || m_context.GetStats().objectsAnimating > 0;
+	HRESULT hr = m_target->EndDraw();
+	if(hr == D2DERR_RECREATE_TARGET)
+	{
+		m_context.SetTarget(nullptr);
+		m_target.Release();
+		return false;
+	}
+	CORt(hr);
+
+	WICRect rect = { 0, 0, (INT)size.width, (INT)size.height };
+	CComPtr<IWICBitmapLock> lock;
+	CORt(m_bitmap->Lock(&rect, WICBitmapLockRead, &lock));
+	UINT stride = 0;
+	UINT bytes = 0;
+	BYTE* pixels = nullptr;
+	CORt(lock->GetStride(&stride));
+	CORt(lock->GetDataPointer(&bytes, &pixels));
+	Encode(pixels, stride);
+	return true;
+}
+
+void RemoteDisplayImpl::Encode(const BYTE* pixels, UINT stride)
+{
+	// Frame: width, height, flags and tile count, then each changed tile's
+	// rect and its pixels XORed with what the viewer has, run-length encoded
+	m_stats.lastFrameBytes = 0;
+	m_frame.clear();
+	Put(m_frame, (UINT32)m_size.width);
+	Put(m_frame, (UINT32)m_size.height);
+	Put(m_frame, m_reset ? c_frameReset : (UINT32)0);
+	Put(m_frame, (UINT32)0);
+
+	UINT32 tiles = 0;
+	for(UINT ty = 0; ty < m_size.height; ty += c_tileSize)
+	{
+		for(UINT tx = 0; tx < m_size.width; tx += c_tileSize)
+		{
+			UINT w = min(c_tileSize, m_size.width - tx);
+			UINT h = min(c_tileSize, m_size.height - ty);
+
+			bool changed = false;
+			for(UINT y = 0; y < h && !changed; ++y)
+			{
+				const BYTE* row = pixels + (size_t)(ty + y) * stride + tx * 4;
+				changed = memcmp(row, &m_shown[(size_t)(ty + y) * m_size.width + tx], w * 4) != 0;
+			}
+			if(!changed)
+			{
+				++m_stats.tilesUnchanged;
+				continue;
+			}
+
+			m_delta.resize((size_t)w * h);
+			for(UINT y = 0; y < h; ++y)
+			{
+				const UINT32* row = (const UINT32*)(pixels + (size_t)(ty + y) * stride) + tx;
+				UINT32* shown = &m_shown[(size_t)(ty + y) * m_size.width + tx];
+				for(UINT x = 0; x < w; ++x)
+				{
+					m_delta[(size_t)y * w + x] = row[x] ^ shown[x];
+					shown[x] = row[x];
+				}
+			}
+
+			Put(m_frame, (UINT16)tx);
+			Put(m_frame, (UINT16)ty);
+			Put(m_frame, (UINT16)w);
+			Put(m_frame, (UINT16)h);
+			EncodeRuns(m_delta.data(), m_delta.size(), m_frame);
+			++tiles;
+		}
+	}
+
+	// Nothing changed, nothing sent, unless the viewer has to start over
+	if(tiles == 0 && !m_reset)
+		return;
+
+	memcpy(&m_frame[3 * sizeof(UINT32)], &tiles, sizeof(tiles));
+	m_viewer.Queue(c_frameMessage, m_frame);
+	m_reset = false;
+	++m_stats.frames;
+	m_stats.tilesSent += tiles;
+	m_stats.lastFrameBytes = c_messageHeader + m_frame.size();
+	m_stats.bytesSent += m_stats.lastFrameBytes;
+}
+
+RemoteDisplay::RemoteDisplay(Object* root, InputManager& input) :
+m_pImpl(new RemoteDisplayImpl(root, input))
+{
+}
+
+RemoteDisplay::~RemoteDisplay()
+{
+	Close();
+	delete m_pImpl;
+}
+
+bool RemoteDisplay::Listen(unsigned short port, bool loopbackOnly)
+{
+	Close();
+
+	WSADATA data;
+	if(WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		return false;
+	m_pImpl->m_winsock = true;
+
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(s == INVALID_SOCKET)
+	{
+		Close();
+		return false;
+	}
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY);
+	ULONG nonBlocking = 1;
+	if(bind(s, (const sockaddr*)&address, sizeof(address)) == SOCKET_ERROR ||
+		listen(s, 1) == SOCKET_ERROR ||
+		ioctlsocket(s, FIONBIO, &nonBlocking) == SOCKET_ERROR)
+	{
+		closesocket(s);
+		Close();
+		return false;
+	}
+	m_pImpl->m_listener = s;
+	return true;
+}
+
+void RemoteDisplay::Close()
+{
+	m_pImpl->m_viewer.Close();
+	if(m_pImpl->m_listener != INVALID_SOCKET)
+		closesocket(m_pImpl->m_listener);
+	m_pImpl->m_listener = INVALID_SOCKET;
+	if(m_pImpl->m_winsock)
+		WSACleanup();
+	m_pImpl->m_winsock = false;
+}
+
+bool RemoteDisplay::IsConnected() const
+{
+	return m_pImpl->m_viewer.IsOpen();
+}
+
+bool RemoteDisplay::Pump(D2D1_SIZE_U size)
+{
+	if(m_pImpl->m_listener == INVALID_SOCKET)
+		return false;
+
+	if(!m_pImpl->m_viewer.IsOpen())
+		m_pImpl->Accept();
+	if(!m_pImpl->m_viewer.IsOpen())
+		return false;
+
+	m_pImpl->ReadInput();
+
+	// Until the viewer has taken the last frame, there is no point drawing
+	// another; the next one carries everything that changed meanwhile
+	if(!m_pImpl->m_viewer.Flush() || !m_pImpl->m_viewer.Idle())
+	{
+		++m_pImpl->m_stats.framesSkipped;
+		return false;
+	}
+
+	if(size.width == 0 || size.height == 0 || !FrameFits(size.width, size.height))
+		return false;
+	if(!m_pImpl->NeedsFrame(size))
+	{
+		++m_pImpl->m_stats.framesUnchanged;
+		return false;
+	}
+	if(!m_pImpl->Render(size))
+		return false;
+	m_pImpl->m_viewer.Flush();
+	return true;
+}
+
+const RemoteDisplayStats& RemoteDisplay::GetStats() const
+{
+	return m_pImpl->m_stats;
+}
+
+struct RemoteViewerImpl
+{
+	bool m_winsock;
+	RemoteSocket m_display;
+	UINT m_width;
+	UINT m_height;
+	std::vector<UINT32> m_pixels;
+	std::vector<UINT32> m_tile;
+	std::vector<BYTE> m_message;
+
+	RemoteViewerImpl() : m_winsock(false), m_width(0), m_height(0) {}
+	bool ApplyFrame();
+};
+
+bool RemoteViewerImpl::ApplyFrame()
+{
+	const BYTE* p = m_message.data();
+	const BYTE* end = p + m_message.size();
+	UINT32 width, height, flags, tiles;
+	if(!Take(p, end, width) || !Take(p, end, height) || !Take(p, end, flags) || !Take(p, end, tiles) ||
+		!FrameFits(width, height))
+	{
+		return false;
+	}
+
+	if(width != m_width || height != m_height || (flags & c_frameReset))
+	{
+		m_width = width;
+		m_height = height;
+		m_pixels.assign((size_t)width * height, 0);
+	}
+
+	for(UINT32 i = 0; i < tiles; ++i)
+	{
+		UINT16 tx, ty, w, h;
+		if(!Take(p, end, tx) || !Take(p, end, ty) || !Take(p, end, w) || !Take(p, end, h) ||
+			(UINT)tx + w > m_width || (UINT)ty + h > m_height)
+		{
+			return false;
+		}
+
+		m_tile.resize((size_t)w * h);
+		if(!DecodeRuns(p, end, m_tile.data(), m_tile.size()))
+			return false;
+		for(UINT y = 0; y < h; ++y)
+		{
+			UINT32* row = &m_pixels[(size_t)(ty + y) * m_width + tx];
+			for(UINT x = 0; x < w; ++x)
+				row[x] ^= m_tile[(size_t)y * w + x];
+		}
+	}
+	return p == end;
+}
+
+RemoteViewer::RemoteViewer() :
+m_pImpl(new RemoteViewerImpl)
+{
+}
+
+RemoteViewer::~RemoteViewer()
+{
+	Close();
+	delete m_pImpl;
+}
+
+bool RemoteViewer::Connect(const std::string& host, unsigned short port)
+{
+	Close();
+
+	WSADATA data;
+	if(WSAStartup(MAKEWORD(2, 2), &data) != 0)
+		return false;
+	m_pImpl->m_winsock = true;
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+	addrinfo* found = nullptr;
+	if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0)
+	{
+		Close();
+		return false;
+	}
+
+	SOCKET s = INVALID_SOCKET;
+	for(addrinfo* a = found; a && s == INVALID_SOCKET; a = a->ai_next)
+	{
+		s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+		if(s != INVALID_SOCKET && connect(s, a->ai_addr, (int)a->ai_addrlen) == SOCKET_ERROR)
+		{
+			closesocket(s);
+			s = INVALID_SOCKET;
+		}
+	}
+	freeaddrinfo(found);
+
+	if(s == INVALID_SOCKET || !m_pImpl->m_display.Attach(s))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void RemoteViewer::Close()
+{
+	m_pImpl->m_display.Close();
+	if(m_pImpl->m_winsock)
+		WSACleanup();
+	m_pImpl->m_winsock = false;
+}
+
+bool RemoteViewer::IsConnected() const
+{
+	return m_pImpl->m_display.IsOpen();
+}
+
+bool RemoteViewer::Receive()
+{
+	m_pImpl->m_display.Flush();
+	m_pImpl->m_display.Read();
+
+	bool changed = false;
+	BYTE type;
+	while(m_pImpl->m_display.Next(type, m_pImpl->m_message))
+	{
+		// A display sending garbage is cut off
+		if(type != c_frameMessage || !m_pImpl->ApplyFrame())
+		{
+			m_pImpl->m_display.Close();
+			break;
+		}
+		changed = true;
+	}
+	return changed;
+}
+
+UINT RemoteViewer::GetWidth() const
+{
+	return m_pImpl->m_width;
+}
+
+UINT RemoteViewer::GetHeight() const
+{
+	return m_pImpl->m_height;
+}
+
+const BYTE* RemoteViewer::GetPixels() const
+{
+	return m_pImpl->m_pixels.empty() ? nullptr : (const BYTE*)m_pImpl->m_pixels.data();
+}
+
+bool RemoteViewer::SendInput(const InputEvent& e)
+{
+	if(!m_pImpl->m_display.IsOpen())
+		return false;
+
+	std::vector<BYTE> payload;
+	PutInput(payload, e);
+	m_pImpl->m_display.Queue(c_inputMessage, payload);
+	return m_pImpl->m_display.Flush();
+}
+
+} // end namespace dash
+} // end namespace tjm
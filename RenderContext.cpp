@@ -0,0 +1,719 @@
+#include "DGui.h"
+#include "RenderContextImpl.h"
+#include "utils.h"
+
+#include <cassert>
+#include <cmath>
+
+namespace tjm {
+namespace dash {
+
+namespace {
+	// Layers that haven't been composited for this many frames are released
+	// even when under budget; their owners are most likely gone.
+	const UINT64 c_staleLayerFrames = 300;
+	const size_t c_defaultLayerBudget = 64 * 1024 * 1024;
+
+	// A longer gap between frames of an interaction is a pause, not a
+	// slow frame
+	const double c_interactionPauseSeconds = 0.25;
+
+	bool SameMatrix(const D2D1_MATRIX_3X2_F& a, const D2D1_MATRIX_3X2_F& b)
+	{
+		return a._11 == b._11 && a._12 == b._12 && a._21 == b._21 &&
+			a._22 == b._22 && a._31 == b._31 && a._32 == b._32;
+	}
+
+	bool IsTranslation(const D2D1_MATRIX_3X2_F& m)
+	{
+		return m._11 == 1 && m._12 == 0 && m._21 == 0 && m._22 == 1;
+	}
+
+	TargetState MakeTargetState(ID2D1RenderTarget* pTarget)
+	{
+		TargetState state;
+		state.m_target = pTarget;
+		state.m_transform = D2D1::Matrix3x2F::Identity();
+		state.m_applied = D2D1::Matrix3x2F::Identity();
+		state.m_appliedValid = false;
+		return state;
+	}
+}
+
+CompositorAnimation::CompositorAnimation() :
+m_duration(0),
+m_fromOffset(D2D1::Point2F(0, 0)),
+m_fromOpacity(1.0f),
+m_toOpacity(1.0f)
+{
+}
+
+bool CompositorAnimation::IsDone(std::chrono::steady_clock::time_point now) const
+{
+	return Progress(now) >= 1.0;
+}
+
+double CompositorAnimation::Progress(std::chrono::steady_clock::time_point now) const
+{
+	double elapsed = std::chrono::duration<double>(now - m_start).count();
+	if(m_duration <= 0 || elapsed >= m_duration)
+		return 1.0;
+	return elapsed <= 0 ? 0.0 : elapsed / m_duration;
+}
+
+D2D1_POINT_2F CompositorAnimation::Offset(std::chrono::steady_clock::time_point now) const
+{
+	// Ease out cubic
+	double remaining = 1.0 - Progress(now);
+	FLOAT left = (FLOAT)(remaining * remaining * remaining);
+	return D2D1::Point2F(m_fromOffset.x * left, m_fromOffset.y * left);
+}
+
+FLOAT CompositorAnimation::Opacity(std::chrono::steady_clock::time_point now) const
+{
+	double remaining = 1.0 - Progress(now);
+	FLOAT left = (FLOAT)(remaining * remaining * remaining);
+	return m_toOpacity + (m_fromOpacity - m_toOpacity) * left;
+}
+
+SceneSnapshot::SceneSnapshot() :
+m_sequence(0),
+m_pixelSize(D2D1::SizeU(0, 0)),
+m_quality(RenderQuality::Full),
+m_inputAge(-1)
+{
+}
+
+void SceneSnapshot::Clear()
+{
+	m_ops.clear();
+	m_texts.clear();
+	m_textSources.clear();
+	m_textChars.clear();
+	m_groups.clear();
+	m_quality = RenderQuality::Full;
+	m_inputAge = -1;
+}
+
+bool SceneSnapshot::IsAnimating(std::chrono::steady_clock::time_point now) const
+{
+	for(auto& group : m_groups)
+	{
+		if(!group.m_animation.IsDone(now))
+			return true;
+	}
+	return false;
+}
+
+RenderContextImpl::RenderContextImpl() :
+m_layerBudget(c_defaultLayerBudget),
+m_layerBytes(0),
+m_frame(0),
+m_rasterDepth(0),
+m_volatile(false),
+m_clipDepth(0),
+m_frameRequested(false),
+m_interacting(false),
+m_qualityTarget(0),
+m_quality(RenderQuality::Full),
+m_recording(nullptr),
+m_recordings(0),
+m_activeOccluderBegin(0),
+m_activeOccluderEnd(0)
+{
+	m_targets.push_back(MakeTargetState(nullptr));
+	m_stats = RenderStats();
+}
+
+void RenderContextImpl::PushTarget(ID2D1RenderTarget* pTarget)
+{
+	Flush();
+	m_targets.push_back(MakeTargetState(pTarget));
+}
+
+void RenderContextImpl::PopTarget()
+{
+	Flush();
+	m_targets.pop_back();
+}
+
+void RenderContextImpl::ApplyQuality(RenderQuality quality)
+{
+	ID2D1RenderTarget* pTarget = m_targets.front().m_target;
+	if(!pTarget)
+		return;
+	bool full = quality == RenderQuality::Full;
+	pTarget->SetAntialiasMode(full ? D2D1_ANTIALIAS_MODE_PER_PRIMITIVE : D2D1_ANTIALIAS_MODE_ALIASED);
+	pTarget->SetTextAntialiasMode(full ? D2D1_TEXT_ANTIALIAS_MODE_DEFAULT : D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
+}
+
+ID2D1RenderTarget* RenderContextImpl::Device()
+{
+	Flush();
+
+	TargetState& state = m_targets.back();
+	if(!state.m_appliedValid || !SameMatrix(state.m_applied, state.m_transform))
+	{
+		state.m_target->SetTransform(state.m_transform);
+		state.m_applied = state.m_transform;
+		state.m_appliedValid = true;
+		++m_stats.transformChanges;
+	}
+	return state.m_target;
+}
+
+void RenderContextImpl::Flush()
+{
+	if(m_batcher.Empty())
+		return;
+
+	// Queued primitives are already in target space
+	TargetState& state = m_targets.back();
+	if(!state.m_appliedValid || !SameMatrix(state.m_applied, D2D1::Matrix3x2F::Identity()))
+	{
+		state.m_target->SetTransform(D2D1::Matrix3x2F::Identity());
+		state.m_applied = D2D1::Matrix3x2F::Identity();
+		state.m_appliedValid = true;
+		++m_stats.transformChanges;
+	}
+	m_batcher.Flush(state.m_target, m_targets.front().m_target, m_targets.size() == 1, m_stats);
+}
+
+ID2D1RenderTarget* RenderContextImpl::BeginHook(bool batched)
+{
+	// The walk's transform and queued fills aren't on the device, so
+	// batched hooks get no target to draw to
+	return batched ? nullptr : Device();
+}
+
+void RenderContextImpl::EndHook(bool batched)
+{
+	if(!batched)
+	{
+		TargetState& state = m_targets.back();
+		state.m_target->GetTransform(&state.m_applied);
+	}
+}
+
+ID2D1SolidColorBrush* RenderContextImpl::SolidBrush(const D2D1_COLOR_F& color, FLOAT opacity)
+{
+	if(!m_brush)
+	{
+		// On the device target, so layers can use it too
+		CORt(m_targets.front().m_target->CreateSolidColorBrush(color, D2D1::BrushProperties(opacity), &m_brush));
+		return m_brush;
+	}
+	m_brush->SetColor(color);
+	m_brush->SetOpacity(opacity);
+	return m_brush;
+}
+
+void RenderContextImpl::PushClip(const D2D1_RECT_F& clip)
+{
+	if(m_recording)
+		Record(SnapshotOpType::PushClip).m_rect = clip;
+	else
+		Device()->PushAxisAlignedClip(clip, D2D1_ANTIALIAS_MODE_ALIASED);
+	++m_clipDepth;
+}
+
+void RenderContextImpl::PopClip()
+{
+	assert(m_clipDepth > 0);
+	if(m_recording)
+		Record(SnapshotOpType::PopClip);
+	else
+		Device()->PopAxisAlignedClip();
+	--m_clipDepth;
+}
+
+SnapshotOp& RenderContextImpl::Record(SnapshotOpType type)
+{
+	m_recording->m_ops.push_back(SnapshotOp());
+	SnapshotOp& op = m_recording->m_ops.back();
+	op.m_type = type;
+	op.m_transform = GetTransform();
+	op.m_rect = D2D1::RectF(0, 0, 0, 0);
+	op.m_color = D2D1::ColorF(0, 0, 0, 0);
+	op.m_opacity = 1.0f;
+	op.m_index = 0;
+	return op;
+}
+
+void RenderContextImpl::BeginGroup(UINT64 owner, const D2D1_RECT_F& extent, const CompositorAnimation& animation, FLOAT opacity)
+{
+	SnapshotGroup group;
+	group.m_owner = owner;
+	group.m_extent = extent;
+	group.m_animation = animation;
+	group.m_opacity = opacity;
+	group.m_end = 0;
+
+	Record(SnapshotOpType::BeginGroup).m_index = m_recording->m_groups.size();
+	m_openGroups.push_back(m_recording->m_groups.size());
+	m_recording->m_groups.push_back(group);
+}
+
+void RenderContextImpl::EndGroup()
+{
+	assert(!m_openGroups.empty());
+	m_recording->m_groups[m_openGroups.back()].m_end = m_recording->m_ops.size();
+	m_openGroups.pop_back();
+	Record(SnapshotOpType::EndGroup);
+}
+
+LayerEntry* RenderContextImpl::FindLayer(UINT64 owner)
+{
+	auto it = m_layerIndex.find(owner);
+	if(it == m_layerIndex.end())
+		return nullptr;
+
+	// Move to the front of the LRU list
+	m_layers.splice(m_layers.begin(), m_layers, it->second);
+	it->second->m_lastUsed = m_frame;
+	return &*it->second;
+}
+
+LayerEntry* RenderContextImpl::CreateLayer(UINT64 owner, const D2D1_RECT_F& extent)
+{
+	auto existing = m_layerIndex.find(owner);
+	if(existing != m_layerIndex.end())
+		EvictLayer(existing->second);
+
+	ID2D1RenderTarget* pDevice = m_targets.front().m_target;
+	if(!pDevice || m_layerBudget == 0)
+		return nullptr;
+
+	// Check the budget before creating anything, so a layer that won't fit
+	// doesn't cost a bitmap every frame
+	FLOAT dpiX, dpiY;
+	pDevice->GetDpi(&dpiX, &dpiY);
+	D2D1_SIZE_F size = D2D1::SizeF(extent.right - extent.left, extent.bottom - extent.top);
+	double estimate = ceil(size.width * dpiX / 96.0) * ceil(size.height * dpiY / 96.0) * 4;
+	if(!(estimate <= (double)m_layerBudget))
+		return nullptr;
+
+	CComPtr<ID2D1BitmapRenderTarget> target;
+	if(!SUCCEEDED(pDevice->CreateCompatibleRenderTarget(size, &target)))
+		return nullptr;
+
+	// Layers are transparent, which ClearType can't blend onto
+	target->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
+
+	D2D1_SIZE_U pixels = target->GetPixelSize();
+	size_t bytes = (size_t)pixels.width * pixels.height * 4;
+
+	LayerEntry entry;
+	entry.m_owner = owner;
+	entry.m_target = target;
+	entry.m_extent = extent;
+	entry.m_bytes = bytes;
+	entry.m_version = 0;
+	entry.m_valid = false;
+	entry.m_lastUsed = m_frame;
+	entry.m_xTrans = 0;
+	entry.m_yTrans = 0;
+
+	m_layers.push_front(entry);
+	m_layerIndex[owner] = m_layers.begin();
+	m_layerBytes += bytes;
+	return &m_layers.front();
+}
+
+void RenderContextImpl::EvictLayer(std::list<LayerEntry>::iterator it)
+{
+	m_layerBytes -= it->m_bytes;
+	m_layerIndex.erase(it->m_owner);
+	m_layers.erase(it);
+}
+
+void RenderContextImpl::EnforceBudget()
+{
+	while(!m_layers.empty())
+	{
+		auto lru = std::prev(m_layers.end());
+		if(m_layerBytes <= m_layerBudget && lru->m_lastUsed + c_staleLayerFrames > m_frame)
+			break;
+		EvictLayer(lru);
+	}
+}
+
+RenderContext::RenderContext() :
+m_pImpl(new RenderContextImpl)
+{
+}
+
+RenderContext::~RenderContext()
+{
+	delete m_pImpl;
+}
+
+void RenderContext::SetTarget(ID2D1RenderTarget* pTarget)
+{
+	if(m_pImpl->m_targets.front().m_target != pTarget)
+	{
+		ReleaseLayers();
+		m_pImpl->m_batcher.ReleaseResources();
+		m_pImpl->m_brush.Release();
+		m_pImpl->m_targets.front() = MakeTargetState(pTarget);
+	}
+}
+
+ID2D1RenderTarget* RenderContext::GetTarget() const
+{
+	return m_pImpl->m_targets.front().m_target;
+}
+
+void RenderContext::BeginFrame()
+{
+	++m_pImpl->m_frame;
+	m_pImpl->m_stats = RenderStats();
+	m_pImpl->m_frameRequested = false;
+	m_pImpl->m_batcher.m_geometryOrdinal = 0;
+
+	// Quality only drops while an interaction keeps missing the target,
+	// and is back to full as soon as a frame has nothing moving
+	auto now = std::chrono::steady_clock::now();
+	double interval = std::chrono::duration<double>(now - m_pImpl->m_frameStart).count();
+	if(m_pImpl->m_qualityTarget <= 0 || !m_pImpl->m_interacting)
+		m_pImpl->m_quality = RenderQuality::Full;
+	else if(interval > m_pImpl->m_qualityTarget && interval < c_interactionPauseSeconds)
+		m_pImpl->m_quality = RenderQuality::Interactive;
+	m_pImpl->m_frameStart = now;
+	m_pImpl->m_interacting = false;
+	m_pImpl->m_stats.quality = m_pImpl->m_quality;
+	m_pImpl->ApplyQuality(m_pImpl->m_quality);
+
+	// The walk starts from the identity; the device is whatever it was left at
+	m_pImpl->m_targets.front().m_transform = D2D1::Matrix3x2F::Identity();
+	m_pImpl->m_targets.front().m_appliedValid = false;
+}
+
+void RenderContext::EndFrame()
+{
+	m_pImpl->Flush();
+
+	// Every clip pushed during the frame must have been popped again
+	assert(m_pImpl->m_clipDepth == 0);
+	assert(m_pImpl->m_occluders.empty());
+	m_pImpl->EnforceBudget();
+
+	// The interaction is over, so what it left on screen is redrawn properly
+	if(m_pImpl->m_quality == RenderQuality::Interactive && !m_pImpl->m_interacting)
+		m_pImpl->m_frameRequested = true;
+}
+
+void RenderContext::FillRectangle(const D2D1_RECT_F& rect, const D2D1_COLOR_F& color, FLOAT opacity)
+{
+	if(m_pImpl->m_recording)
+	{
+		SnapshotOp& op = m_pImpl->Record(SnapshotOpType::FillRectangle);
+		op.m_rect = rect;
+		op.m_color = color;
+		op.m_opacity = opacity;
+		return;
+	}
+
+	const D2D1::Matrix3x2F& transform = m_pImpl->GetTransform();
+	if(!IsTranslation(transform))
+	{
+		ID2D1RenderTarget* pTarget = m_pImpl->Device();
+		ID2D1SolidColorBrush* brush = m_pImpl->SolidBrush(color, opacity);
+		pTarget->FillRectangle(rect, brush);
+		return;
+	}
+
+	D2D1_RECT_F bounds = D2D1::RectF(rect.left + transform._31, rect.top + transform._32, rect.right + transform._31, rect.bottom + transform._32);
+	m_pImpl->m_batcher.Add(bounds, false, color, opacity, m_pImpl->m_stats);
+}
+
+void RenderContext::FillEllipse(const D2D1_ELLIPSE& ellipse, const D2D1_COLOR_F& color, FLOAT opacity)
+{
+	if(m_pImpl->m_recording)
+	{
+		SnapshotOp& op = m_pImpl->Record(SnapshotOpType::FillEllipse);
+		op.m_rect = D2D1::RectF(ellipse.point.x - ellipse.radiusX, ellipse.point.y - ellipse.radiusY,
+			ellipse.point.x + ellipse.radiusX, ellipse.point.y + ellipse.radiusY);
+		op.m_color = color;
+		op.m_opacity = opacity;
+		return;
+	}
+
+	const D2D1::Matrix3x2F& transform = m_pImpl->GetTransform();
+	if(!IsTranslation(transform))
+	{
+		ID2D1RenderTarget* pTarget = m_pImpl->Device();
+		ID2D1SolidColorBrush* brush = m_pImpl->SolidBrush(color, opacity);
+		pTarget->FillEllipse(ellipse, brush);
+		return;
+	}
+
+	FLOAT x = ellipse.point.x + transform._31;
+	FLOAT y = ellipse.point.y + transform._32;
+	D2D1_RECT_F bounds = D2D1::RectF(x - ellipse.radiusX, y - ellipse.radiusY, x + ellipse.radiusX, y + ellipse.radiusY);
+	m_pImpl->m_batcher.Add(bounds, true, color, opacity, m_pImpl->m_stats);
+}
+
+void RenderContext::DrawTextLayout(D2D1_POINT_2F origin, IDWriteTextLayout* layout, const D2D1_COLOR_F& color, FLOAT opacity)
+{
+	if(m_pImpl->m_recording)
+	{
+		SnapshotText source = {};
+		RecordText(origin, layout, source, color, opacity);
+		return;
+	}
+
+	ID2D1RenderTarget* pTarget = m_pImpl->Device();
+	pTarget->DrawTextLayout(origin, layout, m_pImpl->SolidBrush(color, opacity));
+}
+
+void RenderContext::DrawTextLayout(D2D1_POINT_2F origin, IDWriteTextLayout* layout, const std::wstring& font, const std::wstring& text,
+	FLOAT size, D2D1_SIZE_F max, const D2D1_COLOR_F& color, FLOAT opacity)
+{
+	if(!m_pImpl->m_recording)
+	{
+		DrawTextLayout(origin, layout, color, opacity);
+		return;
+	}
+
+	// The strings go into one buffer the snapshot reuses, so recording
+	// text doesn't allocate once the buffer has grown
+	std::vector<wchar_t>& chars = m_pImpl->m_recording->m_textChars;
+	SnapshotText source;
+	source.m_font = (UINT32)chars.size();
+	source.m_fontLength = (UINT32)font.length();
+	chars.insert(chars.end(), font.begin(), font.end());
+	source.m_text = (UINT32)chars.size();
+	source.m_textLength = (UINT32)text.length();
+	chars.insert(chars.end(), text.begin(), text.end());
+	source.m_size = size;
+	source.m_max = max;
+	RecordText(origin, layout, source, color, opacity);
+}
+
+void RenderContext::RecordText(D2D1_POINT_2F origin, IDWriteTextLayout* layout, const SnapshotText& source, const D2D1_COLOR_F& color, FLOAT opacity)
+{
+	SnapshotOp& op = m_pImpl->Record(SnapshotOpType::DrawText);
+	op.m_rect = D2D1::RectF(origin.x, origin.y, origin.x, origin.y);
+	op.m_color = color;
+	op.m_opacity = opacity;
+	op.m_index = m_pImpl->m_recording->m_texts.size();
+	m_pImpl->m_recording->m_texts.push_back(layout);
+	m_pImpl->m_recording->m_textSources.push_back(source);
+}
+
+void RenderContext::BeginRecording(SceneSnapshot* snapshot)
+{
+	m_pImpl->Flush();
+	snapshot->Clear();
+	snapshot->m_sequence = ++m_pImpl->m_recordings;
+	m_pImpl->m_recording = snapshot;
+}
+
+void RenderContext::EndRecording()
+{
+	assert(m_pImpl->m_openGroups.empty());
+	m_pImpl->m_recording->m_quality = m_pImpl->m_quality;
+	m_pImpl->m_recording = nullptr;
+}
+
+bool RenderContext::IsRecording() const
+{
+	return m_pImpl->m_recording != nullptr;
+}
+
+void RenderContext::Replay(const SceneSnapshot& snapshot)
+{
+	m_pImpl->m_replayTime = std::chrono::steady_clock::now();
+	// Drawn at the quality it was recorded at
+	m_pImpl->m_stats.quality = snapshot.m_quality;
+	m_pImpl->ApplyQuality(snapshot.m_quality);
+	ReplayOps(snapshot, 0, snapshot.m_ops.size(), D2D1::Point2F(0, 0), 1.0f);
+	m_pImpl->Flush();
+	m_pImpl->ApplyQuality(m_pImpl->m_quality);
+	m_pImpl->SetTransform(D2D1::Matrix3x2F::Identity());
+}
+
+void RenderContext::ReplayOps(const SceneSnapshot& snapshot, size_t begin, size_t end, D2D1_POINT_2F offset, FLOAT opacity)
+{
+	// Fills go back through the batcher, so they merge as if drawn live
+	for(size_t i = begin; i < end; ++i)
+	{
+		const SnapshotOp& op = snapshot.m_ops[i];
+		m_pImpl->SetTransform(op.m_transform * D2D1::Matrix3x2F::Translation(offset.x, offset.y));
+		switch(op.m_type)
+		{
+		case SnapshotOpType::FillRectangle:
+			FillRectangle(op.m_rect, op.m_color, op.m_opacity * opacity);
+			break;
+		case SnapshotOpType::FillEllipse:
+			{
+				FLOAT rx = (op.m_rect.right - op.m_rect.left) / 2;
+				FLOAT ry = (op.m_rect.bottom - op.m_rect.top) / 2;
+				FillEllipse(D2D1::Ellipse(D2D1::Point2F(op.m_rect.left + rx, op.m_rect.top + ry), rx, ry), op.m_color, op.m_opacity * opacity);
+			}
+			break;
+		case SnapshotOpType::DrawText:
+			// Text from another process whose source wasn't shared is missing
+			if(op.m_index < snapshot.m_texts.size() && snapshot.m_texts[op.m_index])
+				DrawTextLayout(D2D1::Point2F(op.m_rect.left, op.m_rect.top), snapshot.m_texts[op.m_index], op.m_color, op.m_opacity * opacity);
+			break;
+		case SnapshotOpType::PushClip:
+			m_pImpl->PushClip(op.m_rect);
+			break;
+		case SnapshotOpType::PopClip:
+			m_pImpl->PopClip();
+			break;
+		case SnapshotOpType::BeginGroup:
+			{
+				const SnapshotGroup& group = snapshot.m_groups[op.m_index];
+				D2D1_POINT_2F origin = D2D1::Point2F(op.m_transform._31 + offset.x, op.m_transform._32 + offset.y);
+				D2D1_POINT_2F animated = group.m_animation.Offset(m_pImpl->m_replayTime);
+				FLOAT groupOpacity = opacity * group.m_opacity * group.m_animation.Opacity(m_pImpl->m_replayTime);
+				++m_pImpl->m_stats.groupsComposited;
+
+				// Without a layer the ops are drawn moved and faded one by one,
+				// which only differs where they overlap
+				if(!CompositeGroup(snapshot, i, origin, animated, groupOpacity))
+					ReplayOps(snapshot, i + 1, group.m_end, D2D1::Point2F(offset.x + animated.x, offset.y + animated.y), groupOpacity);
+				i = group.m_end;
+			}
+			break;
+		case SnapshotOpType::EndGroup:
+			break;
+		}
+	}
+}
+
+bool RenderContext::CompositeGroup(const SceneSnapshot& snapshot, size_t begin, D2D1_POINT_2F origin, D2D1_POINT_2F offset, FLOAT opacity)
+{
+	const SnapshotOp& op = snapshot.m_ops[begin];
+	const SnapshotGroup& group = snapshot.m_groups[op.m_index];
+	const D2D1_RECT_F& extent = group.m_extent;
+	if(extent.right <= extent.left || extent.bottom <= extent.top || !IsTranslation(op.m_transform))
+		return false;
+
+	// Keyed apart from the owner's own layer, which may be live elsewhere
+	UINT64 key = group.m_owner | (1ull << 63);
+	LayerEntry* layer = m_pImpl->FindLayer(key);
+	if(!layer || layer->m_extent.right - layer->m_extent.left != extent.right - extent.left ||
+		layer->m_extent.bottom - layer->m_extent.top != extent.bottom - extent.top)
+	{
+		layer = m_pImpl->CreateLayer(key, extent);
+		if(!layer)
+			return false;
+	}
+
+	if(!layer->m_valid || layer->m_version != snapshot.m_sequence)
+	{
+		bool outerVolatile = m_pImpl->m_volatile;
+		m_pImpl->m_volatile = false;
+		++m_pImpl->m_rasterDepth;
+
+		ID2D1BitmapRenderTarget* pLayerTarget = layer->m_target;
+		m_pImpl->PushTarget(pLayerTarget);
+		pLayerTarget->BeginDraw();
+		pLayerTarget->Clear(D2D1::ColorF(0, 0, 0, 0));
+
+		// The recorded ops are in the snapshot's target space; move the
+		// extent's corner to the bitmap's origin
+		ReplayOps(snapshot, begin + 1, group.m_end,
+			D2D1::Point2F(-op.m_transform._31 - extent.left, -op.m_transform._32 - extent.top), 1.0f);
+
+		m_pImpl->PopTarget();
+		HRESULT hr = pLayerTarget->EndDraw();
+
+		--m_pImpl->m_rasterDepth;
+		++m_pImpl->m_stats.layersRasterized;
+		layer->m_extent = extent;
+		layer->m_version = snapshot.m_sequence;
+		// Groups animating inside it need it redrawn every time
+		layer->m_valid = SUCCEEDED(hr) && !m_pImpl->m_volatile;
+		m_pImpl->m_volatile = outerVolatile || m_pImpl->m_volatile;
+
+		if(!SUCCEEDED(hr))
+			return false;
+	}
+	if(m_pImpl->m_rasterDepth > 0 && !group.m_animation.IsDone(m_pImpl->m_replayTime))
+		m_pImpl->m_volatile = true;
+
+	CComPtr<ID2D1Bitmap> bitmap;
+	if(!SUCCEEDED(layer->m_target->GetBitmap(&bitmap)))
+		return false;
+
+	m_pImpl->SetTransform(D2D1::Matrix3x2F::Translation(origin.x + offset.x, origin.y + offset.y));
+	m_pImpl->Device()->DrawBitmap(bitmap, extent, opacity, D2D1_BITMAP_INTERPOLATION_MODE_LINEAR);
+	++m_pImpl->m_stats.layersComposited;
+	return true;
+}
+
+ID2D1SolidColorBrush* RenderContext::GetSolidBrush(const D2D1_COLOR_F& color, FLOAT opacity)
+{
+	return m_pImpl->SolidBrush(color, opacity);
+}
+
+void RenderContext::Flush()
+{
+	m_pImpl->Flush();
+}
+
+const RenderStats& RenderContext::GetStats() const
+{
+	return m_pImpl->m_stats;
+}
+
+void RenderContext::RequestFrame()
+{
+	m_pImpl->m_frameRequested = true;
+}
+
+bool RenderContext::IsFrameRequested() const
+{
+	return m_pImpl->m_frameRequested;
+}
+
+void RenderContext::SetLayerBudget(size_t bytes)
+{
+	m_pImpl->m_layerBudget = bytes;
+	m_pImpl->EnforceBudget();
+}
+
+size_t RenderContext::GetLayerBudget() const
+{
+	return m_pImpl->m_layerBudget;
+}
+
+void RenderContext::SetQualityTarget(double seconds)
+{
+	m_pImpl->m_qualityTarget = seconds;
+}
+
+double RenderContext::GetQualityTarget() const
+{
+	return m_pImpl->m_qualityTarget;
+}
+
+RenderQuality RenderContext::GetQuality() const
+{
+	return m_pImpl->Quality();
+}
+
+void RenderContext::SetInteracting()
+{
+	m_pImpl->m_interacting = true;
+}
+
+size_t RenderContext::GetLayerBytes() const
+{
+	return m_pImpl->m_layerBytes;
+}
+
+void RenderContext::ReleaseLayers()
+{
+	m_pImpl->m_layers.clear();
+	m_pImpl->m_layerIndex.clear();
+	m_pImpl->m_layerBytes = 0;
+}
+
+} // end namespace dash
+} // end namespace tjm
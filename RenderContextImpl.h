@@ -0,0 +1,283 @@
+#ifndef RENDERCONTEXTIMPL_H
+#define RENDERCONTEXTIMPL_H
+
+#include "DGui.h"
+
+#include <atlbase.h>
+#include <chrono>
+#include <dwrite.h>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+// Larger subtrees are always rendered directly, and groups from another
+// process are cut down to this
+const FLOAT c_maxLayerExtent = 4096;
+
+struct LayerEntry
+{
+	UINT64 m_owner;
+	CComPtr<ID2D1BitmapRenderTarget> m_target;
+	D2D1_RECT_F m_extent;		// Local content rect covered by the bitmap
+	size_t m_bytes;
+	unsigned m_version;		// Content version last rasterized
+	bool m_valid;				// False forces a re-raster (content was animating)
+	UINT64 m_lastUsed;
+
+	// Scroll layers: the translation the bitmap was drawn at, and a second
+	// bitmap to shift through since a bitmap can't copy onto itself
+	FLOAT m_xTrans;
+	FLOAT m_yTrans;
+	CComPtr<ID2D1Bitmap> m_scratch;
+};
+
+// A filled rect or ellipse in target space
+struct BatchPrimitive
+{
+	D2D1_RECT_F m_bounds;
+	bool m_ellipse;
+	size_t m_batch;
+};
+
+// Primitives sharing a brush, drawn with one device call
+struct Batch
+{
+	D2D1_COLOR_F m_color;
+	FLOAT m_opacity;
+	D2D1_RECT_F m_bounds;
+	size_t m_count;
+};
+
+struct CachedGeometry
+{
+	UINT64 m_hash;
+	size_t m_count;
+	CComPtr<ID2D1PathGeometry> m_geometry;
+};
+
+// Sits between the tree walk and the device. Primitives are queued with
+// their translation already applied, merged into batches by brush, and
+// moved earlier past batches they don't overlap so same-brush draws end
+// up together.
+struct DrawBatcher
+{
+	std::vector<BatchPrimitive> m_primitives;
+	std::vector<Batch> m_batches;
+	std::vector<size_t> m_order;			// Flush scratch, reused across frames
+	std::vector<size_t> m_batchStart;
+	CComPtr<ID2D1SolidColorBrush> m_brush;
+
+	// Geometry for multi-primitive batches on the device target, by the
+	// batch's ordinal in the frame. Static scenes rebuild nothing.
+	std::vector<CachedGeometry> m_geometries;
+	size_t m_geometryOrdinal;
+	CComPtr<ID2D1PathGeometry> m_lastGeometry;
+
+	DrawBatcher();
+
+	bool Empty() const { return m_primitives.empty(); }
+	void Add(const D2D1_RECT_F& bounds, bool ellipse, const D2D1_COLOR_F& color, FLOAT opacity, RenderStats& stats);
+	void Flush(ID2D1RenderTarget* pTarget, ID2D1RenderTarget* pDevice, bool cacheGeometry, RenderStats& stats);
+	void ReleaseResources();
+
+private:
+	ID2D1PathGeometry* BuildGeometry(ID2D1RenderTarget* pTarget, size_t first, size_t count, bool cacheGeometry);
+};
+
+enum class SnapshotOpType
+{
+	FillRectangle,
+	FillEllipse,	// m_rect is the ellipse's bounds
+	DrawText,		// m_rect's top left is the origin
+	PushClip,
+	PopClip,
+	BeginGroup,		// m_index is the group
+	EndGroup
+};
+
+struct SnapshotOp
+{
+	SnapshotOpType m_type;
+	D2D1::Matrix3x2F m_transform;
+	D2D1_RECT_F m_rect;
+	D2D1_COLOR_F m_color;
+	FLOAT m_opacity;
+	size_t m_index;		// Into SceneSnapshot::m_texts or m_groups
+};
+
+// What a text op's layout was made from, so another process can make it
+// again. The strings are ranges of SceneSnapshot::m_textChars; an empty
+// font means the layout came without its source and isn't shared.
+struct SnapshotText
+{
+	UINT32 m_font;
+	UINT32 m_fontLength;
+	UINT32 m_text;
+	UINT32 m_textLength;
+	FLOAT m_size;
+	D2D1_SIZE_F m_max;
+};
+
+// A move and fade run by whoever draws the frame, so it keeps going while
+// the window thread is busy. Eases out from m_fromOffset, relative to where
+// the object has already been placed, to no offset.
+struct CompositorAnimation
+{
+	std::chrono::steady_clock::time_point m_start;
+	double m_duration;
+	D2D1_POINT_2F m_fromOffset;
+	FLOAT m_fromOpacity;
+	FLOAT m_toOpacity;
+
+	CompositorAnimation();
+	bool IsDone(std::chrono::steady_clock::time_point now) const;
+	D2D1_POINT_2F Offset(std::chrono::steady_clock::time_point now) const;
+	FLOAT Opacity(std::chrono::steady_clock::time_point now) const;
+
+private:
+	double Progress(std::chrono::steady_clock::time_point now) const;
+};
+
+// An object recorded mid-animation. Its ops, up to m_end, are drawn into a
+// layer and composited with the animation applied.
+struct SnapshotGroup
+{
+	UINT64 m_owner;
+	D2D1_RECT_F m_extent;		// Relative to the BeginGroup op's transform
+	CompositorAnimation m_animation;
+	FLOAT m_opacity;			// Inherited from above, times the animation's
+	size_t m_end;				// The matching EndGroup op
+};
+
+// A frame recorded by a RenderContext, holding everything needed to draw
+// it again without the Object tree. Buffers are reused between frames.
+struct SceneSnapshot
+{
+	std::vector<SnapshotOp> m_ops;
+	std::vector<CComPtr<IDWriteTextLayout>> m_texts;
+	std::vector<SnapshotText> m_textSources;	// One for each of m_texts
+	std::vector<wchar_t> m_textChars;
+	std::vector<SnapshotGroup> m_groups;
+
+	// Different for every recording, so group layers know to re-raster
+	unsigned m_sequence;
+
+	D2D1_SIZE_U m_pixelSize;
+	RenderQuality m_quality;
+	// Age of the oldest input this frame shows when it was published, or
+	// negative if it shows none
+	double m_inputAge;
+	std::chrono::steady_clock::time_point m_published;
+
+	SceneSnapshot();
+	void Clear();
+	// True while any group is still animating
+	bool IsAnimating(std::chrono::steady_clock::time_point now) const;
+};
+
+// The transform the walk has asked for is only pushed to the device when
+// something draws to the device directly.
+struct TargetState
+{
+	ID2D1RenderTarget* m_target;
+	D2D1::Matrix3x2F m_transform;
+	D2D1::Matrix3x2F m_applied;
+	bool m_appliedValid;
+};
+
+struct RenderContextImpl
+{
+	// m_targets[0] is the device target, the rest are layers being rasterized
+	std::vector<TargetState> m_targets;
+
+	std::list<LayerEntry> m_layers; // Most recently used first
+	std::unordered_map<UINT64, std::list<LayerEntry>::iterator> m_layerIndex;
+	size_t m_layerBudget;
+	size_t m_layerBytes;
+	UINT64 m_frame;
+
+	// Set while rasterizing a layer if anything inside it is mid-animation
+	int m_rasterDepth;
+	bool m_volatile;
+
+	// Outstanding axis aligned clips across all targets; zero between frames
+	int m_clipDepth;
+
+	RenderStats m_stats;
+	bool m_frameRequested;
+
+	// Set by the walk when anything is dragged or moving
+	bool m_interacting;
+	double m_qualityTarget;
+	RenderQuality m_quality;
+	std::chrono::steady_clock::time_point m_frameStart;
+
+	// Set between BeginRecording and EndRecording
+	SceneSnapshot* m_recording;
+	std::vector<size_t> m_openGroups;
+	unsigned m_recordings;
+
+	// Groups in a replay are all drawn as of this time
+	std::chrono::steady_clock::time_point m_replayTime;
+
+	// Opaque rects in target space. Each level of the walk appends its own
+	// segment; [m_activeOccluderBegin, m_activeOccluderEnd) is what the
+	// object being rendered is covered by.
+	std::vector<D2D1_RECT_F> m_occluders;
+	size_t m_activeOccluderBegin;
+	size_t m_activeOccluderEnd;
+
+	DrawBatcher m_batcher;
+
+	// For hooks and fallbacks drawing straight to the device
+	CComPtr<ID2D1SolidColorBrush> m_brush;
+
+	RenderContextImpl();
+
+	ID2D1RenderTarget* Target() const { return m_targets.back().m_target; }
+
+	// Layers are kept, so they're drawn at full quality
+	RenderQuality Quality() const { return m_rasterDepth > 0 ? RenderQuality::Full : m_quality; }
+	void ApplyQuality(RenderQuality quality);
+	void PushTarget(ID2D1RenderTarget* pTarget);
+	void PopTarget();
+
+	const D2D1::Matrix3x2F& GetTransform() const { return m_targets.back().m_transform; }
+	void SetTransform(const D2D1::Matrix3x2F& transform) { m_targets.back().m_transform = transform; }
+
+	// Flushes queued primitives and syncs the transform, for drawing
+	// straight to the current target
+	ID2D1RenderTarget* Device();
+	void Flush();
+
+	// Brackets an object's render hooks. Unbatched hooks draw to the device
+	// themselves and may leave its transform changed; batched ones are
+	// passed no target and draw only through the context.
+	ID2D1RenderTarget* BeginHook(bool batched);
+	void EndHook(bool batched);
+
+	ID2D1SolidColorBrush* SolidBrush(const D2D1_COLOR_F& color, FLOAT opacity);
+
+	void PushClip(const D2D1_RECT_F& clip);
+	void PopClip();
+
+	SnapshotOp& Record(SnapshotOpType type);
+	void BeginGroup(UINT64 owner, const D2D1_RECT_F& extent, const CompositorAnimation& animation, FLOAT opacity);
+	void EndGroup();
+
+	LayerEntry* FindLayer(UINT64 owner);
+	LayerEntry* CreateLayer(UINT64 owner, const D2D1_RECT_F& extent);
+	void EvictLayer(std::list<LayerEntry>::iterator it);
+	void EnforceBudget();
+};
+
+// The layout the shared text cache has for these, made if it has none
+IDWriteTextLayout* CachedTextLayout(const std::wstring& font, const std::wstring& text, FLOAT size, D2D1_SIZE_F max);
+
+} // end namespace dash
+} // end namespace tjm
+
+#endif
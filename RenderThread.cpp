@@ -0,0 +1,142 @@
+#include "RenderThread.h"
+#include "utils.h"
+
+#include <exception>
+
+namespace tjm {
+namespace dash {
+
+RenderThread::RenderThread(ID2D1Factory* factory, HWND hwnd) :
+m_factory(factory),
+m_hwnd(hwnd),
+m_writing(0),
+m_ready(1),
+m_drawing(2),
+m_fresh(false),
+m_stop(false),
+m_drawnSequence(0)
+{
+	// Started last, once everything it reads is set up
+	m_thread = std::thread(&RenderThread::Run, this);
+}
+
+RenderThread::~RenderThread()
+{
+	{
+		std::lock_guard<std::mutex> g(m_lock);
+		m_stop = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+}
+
+SceneSnapshot* RenderThread::AcquireSnapshot()
+{
+	return &m_snapshots[m_writing];
+}
+
+void RenderThread::Publish()
+{
+	m_snapshots[m_writing].m_published = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> g(m_lock);
+		std::swap(m_writing, m_ready);
+		m_fresh = true;
+	}
+	m_wake.notify_one();
+}
+
+void RenderThread::DrainLatencies(LatencyStats& stats)
+{
+	std::lock_guard<std::mutex> g(m_latencyLock);
+	for(double latency : m_latencies)
+		stats.AddSample(latency);
+	m_latencies.clear();
+}
+
+void RenderThread::Run()
+{
+	bool animating = false;
+	for(;;)
+	{
+		{
+			// While a compositor animation runs the same snapshot is drawn
+			// again each frame, paced by EndDraw waiting for vsync
+			std::unique_lock<std::mutex> g(m_lock);
+			if(!animating)
+				m_wake.wait(g, [this] { return m_fresh || m_stop; });
+			if(m_stop)
+				break;
+			if(m_fresh)
+			{
+				std::swap(m_drawing, m_ready);
+				m_fresh = false;
+			}
+		}
+
+		animating = false;
+		try
+		{
+			animating = Draw(m_snapshots[m_drawing]);
+		}
+		catch(const std::exception&)
+		{
+			// Start over with a new target on the next frame
+			m_context.SetTarget(nullptr);
+			m_target.Release();
+		}
+	}
+
+	// Device resources belong to this thread
+	m_context.SetTarget(nullptr);
+	m_target.Release();
+}
+
+bool RenderThread::Draw(const SceneSnapshot& snapshot)
+{
+	if(!m_target)
+	{
+		CORt(m_factory->CreateHwndRenderTarget(
+			D2D1::RenderTargetProperties(),
+			D2D1::HwndRenderTargetProperties(m_hwnd, snapshot.m_pixelSize),
+			&m_target));
+		m_context.SetTarget(m_target);
+	}
+	else
+	{
+		D2D1_SIZE_U size = m_target->GetPixelSize();
+		if(size.width != snapshot.m_pixelSize.width || size.height != snapshot.m_pixelSize.height)
+			m_target->Resize(snapshot.m_pixelSize);
+	}
+
+	m_target->BeginDraw();
+	m_target->SetTransform(D2D1::Matrix3x2F::Identity());
+	m_target->Clear(D2D1::ColorF(D2D1::ColorF::White));
+	m_context.BeginFrame();
+	m_context.Replay(snapshot);
+	m_context.EndFrame();
+
+	HRESULT hr = m_target->EndDraw();
+	if(hr == D2DERR_RECREATE_TARGET)
+	{
+		// Drawn again straight away on a new target
+		m_context.SetTarget(nullptr);
+		m_target.Release();
+		return true;
+	}
+	CORt(hr);
+
+	// Input latency is measured to the first time a snapshot is shown
+	bool first = snapshot.m_sequence != m_drawnSequence;
+	m_drawnSequence = snapshot.m_sequence;
+	if(first && snapshot.m_inputAge >= 0)
+	{
+		double sincePublish = std::chrono::duration<double>(std::chrono::steady_clock::now() - snapshot.m_published).count();
+		std::lock_guard<std::mutex> g(m_latencyLock);
+		m_latencies.push_back(snapshot.m_inputAge + sincePublish);
+	}
+	return snapshot.IsAnimating(std::chrono::steady_clock::now());
+}
+
+} // end namespace dash
+} // end namespace tjm
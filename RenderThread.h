@@ -0,0 +1,69 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include "DGui.h"
+#include "RenderContextImpl.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+// Draws scene snapshots to a window from a thread of its own. Three
+// snapshots rotate between the window thread writing one, the latest
+// finished one, and the one being drawn, so neither thread waits on the
+// other beyond swapping indices. Frames the render thread doesn't get to
+// are dropped in favour of newer ones. Compositor animations in a snapshot
+// are drawn until they finish, whether or not new snapshots arrive.
+class RenderThread
+{
+public:
+	// The factory must be multithreaded
+	RenderThread(ID2D1Factory* factory, HWND hwnd);
+	~RenderThread();
+
+	// The window thread's snapshot to record into, until Publish
+	SceneSnapshot* AcquireSnapshot();
+	void Publish();
+
+	// Input-to-present latencies of frames drawn since the last call
+	void DrainLatencies(LatencyStats& stats);
+
+private:
+	RenderThread(const RenderThread&);
+	RenderThread& operator=(const RenderThread&);
+
+	void Run();
+	// True if the snapshot still has animations to draw
+	bool Draw(const SceneSnapshot& snapshot);
+
+	ID2D1Factory* m_factory;
+	HWND m_hwnd;
+
+	SceneSnapshot m_snapshots[3];
+	size_t m_writing;
+	size_t m_ready;
+	size_t m_drawing;
+	bool m_fresh;
+	bool m_stop;
+	std::mutex m_lock;
+	std::condition_variable m_wake;
+
+	// Only touched by the render thread
+	CComPtr<ID2D1HwndRenderTarget> m_target;
+	RenderContext m_context;
+	unsigned m_drawnSequence;
+
+	std::mutex m_latencyLock;
+	std::vector<double> m_latencies;
+
+	std::thread m_thread;
+};
+
+} // end namespace dash
+} // end namespace tjm
+
+#endif
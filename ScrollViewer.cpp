@@ -0,0 +1,376 @@
+#include "DGui.h"
+#include "AnimatedVar.h"
+#include "utils.h"
+
+#include <chrono>
+#include <cmath>
+
+namespace tjm {
+namespace dash {
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	// Touch moves kept for estimating the release velocity
+	const size_t c_velocitySamples = 8;
+	// Only moves this recent count towards the velocity
+	const double c_velocityWindow = 0.1;
+	// Flings slower than this (DIPs per second) stop
+	const double c_minFlingSpeed = 20.0;
+	// Longest fling step, so a stalled frame doesn't jump the content
+	const double c_maxStep = 0.05;
+	const double c_defaultFriction = 4.0;
+
+	double Seconds(Clock::duration d)
+	{
+		return std::chrono::duration<double>(d).count();
+	}
+
+	double ClampOffset(double offset, double extent, double viewport)
+	{
+		double maxOffset = extent > viewport ? extent - viewport : 0.0;
+		return offset < 0 ? 0 : offset > maxOffset ? maxOffset : offset;
+	}
+}
+
+struct ScrollSample
+{
+	Clock::time_point m_time;
+	double m_x;
+	double m_y;
+};
+
+struct ScrollViewerImpl
+{
+	Object* m_content;
+	D2D1_SIZE_F m_extent;
+	bool m_extentSet;
+	bool m_horizontal;
+	bool m_vertical;
+
+	// Unsnapped offset; the translation is this rounded to device pixels
+	double m_x;
+	double m_y;
+
+	double m_vx;
+	double m_vy;
+	bool m_flinging;
+	double m_friction;
+	Clock::time_point m_lastStep;
+
+	ScrollSample m_samples[c_velocitySamples];
+	size_t m_numSamples;
+	size_t m_nextSample;
+
+	FLOAT m_pixelsPerDip;
+
+	D2D1_RECT_F m_lastViewport;
+	D2D1_POINT_2F m_lastVelocity;
+
+	ScrollViewerImpl();
+
+	void AddSample(Clock::time_point now);
+	void EstimateVelocity(Clock::time_point now);
+	void Step(Clock::time_point now, const D2D1_SIZE_F& viewport);
+	void Clamp(const D2D1_SIZE_F& viewport);
+	FLOAT Snap(double offset) const;
+};
+
+ScrollViewerImpl::ScrollViewerImpl() :
+m_content(nullptr),
+m_extent(D2D1::SizeF(0, 0)),
+m_extentSet(false),
+m_horizontal(true),
+m_vertical(true),
+m_x(0),
+m_y(0),
+m_vx(0),
+m_vy(0),
+m_flinging(false),
+m_friction(c_defaultFriction),
+m_numSamples(0),
+m_nextSample(0),
+m_pixelsPerDip(1.0f),
+m_lastViewport(D2D1::RectF(0, 0, 0, 0)),
+m_lastVelocity(D2D1::Point2F(0, 0))
+{
+}
+
+void ScrollViewerImpl::AddSample(Clock::time_point now)
+{
+	ScrollSample& sample = m_samples[m_nextSample];
+	sample.m_time = now;
+	sample.m_x = m_x;
+	sample.m_y = m_y;
+	m_nextSample = (m_nextSample + 1) % c_velocitySamples;
+	if(m_numSamples < c_velocitySamples)
+		++m_numSamples;
+}
+
+void ScrollViewerImpl::EstimateVelocity(Clock::time_point now)
+{
+	m_vx = m_vy = 0;
+	if(m_numSamples < 2)
+		return;
+
+	// Oldest and newest moves inside the window. A finger that stopped
+	// before lifting gives no velocity.
+	const ScrollSample& newest = m_samples[(m_nextSample + c_velocitySamples - 1) % c_velocitySamples];
+	if(Seconds(now - newest.m_time) > c_velocityWindow / 2)
+		return;
+
+	const ScrollSample* oldest = &newest;
+	for(size_t i = 2; i <= m_numSamples; ++i)
+	{
+		const ScrollSample& sample = m_samples[(m_nextSample + c_velocitySamples - i) % c_velocitySamples];
+		if(Seconds(newest.m_time - sample.m_time) > c_velocityWindow)
+			break;
+		oldest = &sample;
+	}
+
+	double dt = Seconds(newest.m_time - oldest->m_time);
+	if(dt <= 0)
+		return;
+
+	m_vx = (newest.m_x - oldest->m_x) / dt;
+	m_vy = (newest.m_y - oldest->m_y) / dt;
+}
+
+void ScrollViewerImpl::Step(Clock::time_point now, const D2D1_SIZE_F& viewport)
+{
+	double dt = Seconds(now - m_lastStep);
+	m_lastStep = now;
+	if(dt > c_maxStep)
+		dt = c_maxStep;
+
+	// Velocity decays exponentially; move by its exact integral over the step
+	// so the distance covered doesn't depend on the frame rate.
+	double decay = exp(-m_friction * dt);
+	double travel = (1.0 - decay) / m_friction;
+	m_x += m_vx * travel;
+	m_y += m_vy * travel;
+	m_vx *= decay;
+	m_vy *= decay;
+
+	// Hitting an edge stops that axis
+	double x = m_x;
+	double y = m_y;
+	Clamp(viewport);
+	if(x != m_x)
+		m_vx = 0;
+	if(y != m_y)
+		m_vy = 0;
+
+	if(sqrt(m_vx * m_vx + m_vy * m_vy) < c_minFlingSpeed)
+	{
+		m_flinging = false;
+		m_vx = m_vy = 0;
+	}
+}
+
+void ScrollViewerImpl::Clamp(const D2D1_SIZE_F& viewport)
+{
+	D2D1_SIZE_F extent = m_extentSet ? m_extent : viewport;
+	m_x = m_horizontal ? ClampOffset(m_x, extent.width, viewport.width) : 0.0;
+	m_y = m_vertical ? ClampOffset(m_y, extent.height, viewport.height) : 0.0;
+}
+
+FLOAT ScrollViewerImpl::Snap(double offset) const
+{
+	// Whole device pixels let the scroll layer shift instead of redraw
+	return (FLOAT)(floor(offset * m_pixelsPerDip + 0.5) / m_pixelsPerDip);
+}
+
+ScrollViewer::ScrollViewer() :
+m_pImpl(new ScrollViewerImpl)
+{
+	SetLayerCaching(LayerCaching::Scroll);
+	SetBatchedRendering(true);
+}
+
+ScrollViewer::~ScrollViewer()
+{
+	delete m_pImpl;
+}
+
+void ScrollViewer::SetContent(Object* content)
+{
+	if(m_pImpl->m_content == content)
+		return;
+
+	if(m_pImpl->m_content)
+		RemoveChild(m_pImpl->m_content);
+	m_pImpl->m_content = content;
+	if(content)
+		AddChild(content);
+
+	// Make sure the new content hears about the viewport
+	m_pImpl->m_lastViewport = D2D1::RectF(0, 0, 0, 0);
+	DirtyLayout();
+}
+
+Object* ScrollViewer::GetContent() const
+{
+	return m_pImpl->m_content;
+}
+
+void ScrollViewer::SetExtent(D2D1_SIZE_F extent)
+{
+	m_pImpl->m_extent = extent;
+	m_pImpl->m_extentSet = true;
+	DirtyLayout();
+}
+
+D2D1_SIZE_F ScrollViewer::GetExtent() const
+{
+	D2D1_SIZE_F viewport = GetSize();
+	if(!m_pImpl->m_extentSet)
+		return viewport;
+	return D2D1::SizeF(max(m_pImpl->m_extent.width, viewport.width), max(m_pImpl->m_extent.height, viewport.height));
+}
+
+void ScrollViewer::SetScrollDirections(bool horizontal, bool vertical)
+{
+	m_pImpl->m_horizontal = horizontal;
+	m_pImpl->m_vertical = vertical;
+	DirtyLayout();
+}
+
+void ScrollViewer::SetScrollOffset(D2D1_POINT_2F offset)
+{
+	StopFling();
+	m_pImpl->m_x = offset.x;
+	m_pImpl->m_y = offset.y;
+	DirtyLayout();
+}
+
+D2D1_POINT_2F ScrollViewer::GetScrollOffset() const
+{
+	return D2D1::Point2F((FLOAT)m_pImpl->m_x, (FLOAT)m_pImpl->m_y);
+}
+
+D2D1_POINT_2F ScrollViewer::GetVelocity() const
+{
+	return D2D1::Point2F((FLOAT)m_pImpl->m_vx, (FLOAT)m_pImpl->m_vy);
+}
+
+bool ScrollViewer::IsFlinging() const
+{
+	return m_pImpl->m_flinging;
+}
+
+void ScrollViewer::StopFling()
+{
+	m_pImpl->m_flinging = false;
+	m_pImpl->m_vx = m_pImpl->m_vy = 0;
+}
+
+void ScrollViewer::SetFriction(double perSecond)
+{
+	m_pImpl->m_friction = perSecond > 0.01 ? perSecond : 0.01;
+}
+
+double ScrollViewer::GetFriction() const
+{
+	return m_pImpl->m_friction;
+}
+
+bool ScrollViewer::IsContentAnimating() const
+{
+	return m_pImpl->m_flinging;
+}
+
+void ScrollViewer::OnLayout()
+{
+	tjm::animation::AllInstant ai(true);
+
+	D2D1_SIZE_F viewport = GetSize();
+	SetClippingRect(D2D1::RectF(0, 0, viewport.width, viewport.height));
+
+	if(m_pImpl->m_flinging)
+		m_pImpl->Step(Clock::now(), viewport);
+	m_pImpl->Clamp(viewport);
+
+	FLOAT x = m_pImpl->Snap(m_pImpl->m_x);
+	FLOAT y = m_pImpl->Snap(m_pImpl->m_y);
+	SetTranslationX(-x);
+	SetTranslationY(-y);
+
+	Object* content = m_pImpl->m_content;
+	if(!content)
+		return;
+
+	content->SetPosition(D2D1::Point2F(0, 0));
+	content->SetSize(GetExtent());
+
+	D2D1_RECT_F view = D2D1::RectF(x, y, x + viewport.width, y + viewport.height);
+	D2D1_POINT_2F velocity = GetVelocity();
+	const D2D1_RECT_F& last = m_pImpl->m_lastViewport;
+	if(view.left != last.left || view.top != last.top || view.right != last.right || view.bottom != last.bottom ||
+		velocity.x != m_pImpl->m_lastVelocity.x || velocity.y != m_pImpl->m_lastVelocity.y)
+	{
+		m_pImpl->m_lastViewport = view;
+		m_pImpl->m_lastVelocity = velocity;
+		content->ViewportChanged(view, velocity);
+	}
+}
+
+Object* ScrollViewer::OnTouch(const D2D1_POINT_2F&)
+{
+	// Catching a fling stops it
+	StopFling();
+	m_pImpl->m_numSamples = 0;
+	m_pImpl->AddSample(Clock::now());
+	return this;
+}
+
+bool ScrollViewer::OnTouchContinue(const TouchInfo& ti)
+{
+	Clock::time_point now = Clock::now();
+	if(m_pImpl->m_horizontal)
+		m_pImpl->m_x -= ti.currentTouch.x - ti.previousTouch.x;
+	if(m_pImpl->m_vertical)
+		m_pImpl->m_y -= ti.currentTouch.y - ti.previousTouch.y;
+	m_pImpl->Clamp(GetSize());
+
+	m_pImpl->AddSample(now);
+	m_pImpl->EstimateVelocity(now);
+	DirtyLayout();
+	return true;
+}
+
+void ScrollViewer::OnTouchFinish(const TouchInfo&)
+{
+	Clock::time_point now = Clock::now();
+	m_pImpl->EstimateVelocity(now);
+	if(sqrt(m_pImpl->m_vx * m_pImpl->m_vx + m_pImpl->m_vy * m_pImpl->m_vy) >= c_minFlingSpeed)
+	{
+		m_pImpl->m_flinging = true;
+		m_pImpl->m_lastStep = now;
+	}
+	else
+	{
+		StopFling();
+	}
+	DirtyLayout();
+}
+
+void ScrollViewer::OnRenderBackground(ID2D1RenderTarget* /*pTarget*/, const D2D1_RECT_F&, DOUBLE)
+{
+	// Batched, so only the context has the target. Recording contexts have
+	// none to ask.
+	ID2D1RenderTarget* pTarget = GetRenderContext()->GetTarget();
+	if(!pTarget)
+		return;
+
+	FLOAT dpiX, dpiY;
+	pTarget->GetDpi(&dpiX, &dpiY);
+	if(dpiX > 0 && dpiX / 96.0f != m_pImpl->m_pixelsPerDip)
+	{
+		m_pImpl->m_pixelsPerDip = dpiX / 96.0f;
+		DirtyLayout();
+	}
+}
+
+} // end namespace dash
+} // end namespace tjm
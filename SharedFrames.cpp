@@ -0,0 +1,501 @@
+#include "DGui.h"
+#include "RenderContextImpl.h"
+#include "windows.h"
+
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+namespace tjm {
+namespace dash {
+
+namespace {
+	const UINT32 c_sharedMagic = 0x46485344;
+	const UINT32 c_sharedVersion = 2;
+	const LONG c_sharedSlots = 3;
+	// Tries at pinning the latest slot before giving up until the next Update
+	const int c_pinAttempts = 8;
+	// Shared text bigger than this is dropped rather than laid out
+	const FLOAT c_maxTextSize = 1000;
+
+	// At the start of the mapping, followed by the slots. Only the writer
+	// sets m_latest and only the reader sets m_reading; the writer never
+	// touches either of those slots, so each side can go away or hang
+	// without holding the other up.
+	struct SharedHeader
+	{
+		volatile UINT32 m_magic;		// Set last, once the rest is valid
+		UINT32 m_version;
+		UINT32 m_opSize;				// Builds with different layouts refuse each other
+		UINT32 m_groupSize;
+		UINT32 m_textSize;
+		UINT64 m_slotBytes;
+		volatile LONG m_latest;			// Last complete slot, or -1
+		volatile LONG m_reading;		// Slot being copied out, or -1
+		volatile LONG64 m_written;		// Frames published
+		volatile LONG64 m_writeTime;	// steady_clock ticks at the last publish
+	};
+
+	// Followed by the ops, the groups, the text sources, then their chars
+	struct SlotHeader
+	{
+		LONG64 m_frame;
+		UINT32 m_width;
+		UINT32 m_height;
+		UINT64 m_opCount;
+		UINT64 m_groupCount;
+		UINT64 m_textCount;
+		UINT64 m_charCount;
+	};
+
+	size_t HeaderBytes()
+	{
+		return (sizeof(SharedHeader) + 15) & ~(size_t)15;
+	}
+
+	BYTE* SlotAt(SharedHeader* header, size_t slotBytes, LONG slot)
+	{
+		return (BYTE*)header + HeaderBytes() + (size_t)slot * slotBytes;
+	}
+
+	LONG64 SteadyTicks()
+	{
+		return (LONG64)std::chrono::steady_clock::now().time_since_epoch().count();
+	}
+
+	double Seconds(std::chrono::steady_clock::time_point since)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+	}
+
+	bool Finite(FLOAT value)
+	{
+		return value == value && fabs(value) <= FLT_MAX;
+	}
+
+	// Clips and groups must nest, and every index must be in range, before
+	// a frame from another process is replayed. Group extents are cut down
+	// to what a layer can hold.
+	bool ValidSnapshot(SceneSnapshot& snapshot)
+	{
+		for(auto& group : snapshot.m_groups)
+		{
+			D2D1_RECT_F& extent = group.m_extent;
+			if(!Finite(extent.left) || !Finite(extent.top) || !Finite(extent.right) || !Finite(extent.bottom))
+				return false;
+			extent.right = min(extent.right, extent.left + c_maxLayerExtent);
+			extent.bottom = min(extent.bottom, extent.top + c_maxLayerExtent);
+		}
+
+		std::vector<size_t> openGroups;
+		std::vector<int> groupClips;
+		int clips = 0;
+		for(size_t i = 0; i < snapshot.m_ops.size(); ++i)
+		{
+			const SnapshotOp& op = snapshot.m_ops[i];
+			switch(op.m_type)
+			{
+			case SnapshotOpType::FillRectangle:
+			case SnapshotOpType::FillEllipse:
+				break;
+			case SnapshotOpType::DrawText:
+				if(op.m_index >= snapshot.m_textSources.size())
+					return false;
+				break;
+			case SnapshotOpType::PushClip:
+				++clips;
+				break;
+			case SnapshotOpType::PopClip:
+				if(clips == (groupClips.empty() ? 0 : groupClips.back()))
+					return false;
+				--clips;
+				break;
+			case SnapshotOpType::BeginGroup:
+				if(op.m_index >= snapshot.m_groups.size() || snapshot.m_groups[op.m_index].m_end <= i ||
+					snapshot.m_groups[op.m_index].m_end >= snapshot.m_ops.size())
+				{
+					return false;
+				}
+				openGroups.push_back(op.m_index);
+				groupClips.push_back(clips);
+				break;
+			case SnapshotOpType::EndGroup:
+				if(openGroups.empty() || snapshot.m_groups[openGroups.back()].m_end != i || clips != groupClips.back())
+					return false;
+				openGroups.pop_back();
+				groupClips.pop_back();
+				break;
+			default:
+				return false;
+			}
+		}
+		return openGroups.empty() && clips == 0;
+	}
+
+	bool ValidText(const SnapshotText& text, size_t chars)
+	{
+		return (UINT64)text.m_font + text.m_fontLength <= chars && (UINT64)text.m_text + text.m_textLength <= chars &&
+			Finite(text.m_size) && Finite(text.m_max.width) && Finite(text.m_max.height) &&
+			text.m_max.width >= 0 && text.m_max.height >= 0;
+	}
+}
+
+struct SharedFrameSourceImpl
+{
+	HANDLE m_mapping;
+	SharedHeader* m_header;
+	SharedFrameStats m_stats;
+
+	SharedFrameSourceImpl() : m_mapping(nullptr), m_header(nullptr) { m_stats = SharedFrameStats(); }
+};
+
+SharedFrameSource::SharedFrameSource() :
+m_pImpl(new SharedFrameSourceImpl)
+{
+}
+
+SharedFrameSource::~SharedFrameSource()
+{
+	Close();
+	delete m_pImpl;
+}
+
+bool SharedFrameSource::Create(const std::string& name, size_t slotBytes)
+{
+	Close();
+
+	slotBytes = (max(slotBytes, sizeof(SlotHeader)) + 15) & ~(size_t)15;
+	UINT64 total = HeaderBytes() + (UINT64)slotBytes * c_sharedSlots;
+	m_pImpl->m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		(DWORD)(total >> 32), (DWORD)total, name.c_str());
+	if(!m_pImpl->m_mapping)
+		return false;
+
+	m_pImpl->m_header = (SharedHeader*)MapViewOfFile(m_pImpl->m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if(!m_pImpl->m_header)
+	{
+		Close();
+		return false;
+	}
+
+	SharedHeader* header = m_pImpl->m_header;
+	header->m_version = c_sharedVersion;
+	header->m_opSize = sizeof(SnapshotOp);
+	header->m_groupSize = sizeof(SnapshotGroup);
+	header->m_textSize = sizeof(SnapshotText);
+	header->m_slotBytes = slotBytes;
+	header->m_latest = -1;
+	header->m_reading = -1;
+	header->m_written = 0;
+	header->m_writeTime = SteadyTicks();
+	MemoryBarrier();
+	header->m_magic = c_sharedMagic;
+	return true;
+}
+
+void SharedFrameSource::Close()
+{
+	if(m_pImpl->m_header)
+		UnmapViewOfFile(m_pImpl->m_header);
+	if(m_pImpl->m_mapping)
+		CloseHandle(m_pImpl->m_mapping);
+	m_pImpl->m_header = nullptr;
+	m_pImpl->m_mapping = nullptr;
+}
+
+bool SharedFrameSource::IsOpen() const
+{
+	return m_pImpl->m_header != nullptr;
+}
+
+bool SharedFrameSource::Write(const SceneSnapshot& snapshot)
+{
+	SharedHeader* header = m_pImpl->m_header;
+	if(!header)
+		return false;
+
+	auto start = std::chrono::steady_clock::now();
+	size_t opBytes = snapshot.m_ops.size() * sizeof(SnapshotOp);
+	size_t groupBytes = snapshot.m_groups.size() * sizeof(SnapshotGroup);
+	size_t textBytes = snapshot.m_textSources.size() * sizeof(SnapshotText);
+	size_t charBytes = snapshot.m_textChars.size() * sizeof(wchar_t);
+	size_t bytes = sizeof(SlotHeader) + opBytes + groupBytes + textBytes + charBytes;
+	if(bytes > header->m_slotBytes)
+	{
+		++m_pImpl->m_stats.framesRejected;
+		return false;
+	}
+
+	// Of three slots, at least one is neither the latest nor being read
+	LONG latest = header->m_latest;
+	LONG reading = header->m_reading;
+	LONG slot = 0;
+	while(slot == latest || slot == reading)
+		++slot;
+
+	BYTE* p = SlotAt(header, (size_t)header->m_slotBytes, slot);
+	SlotHeader slotHeader;
+	slotHeader.m_frame = header->m_written + 1;
+	slotHeader.m_width = snapshot.m_pixelSize.width;
+	slotHeader.m_height = snapshot.m_pixelSize.height;
+	slotHeader.m_opCount = snapshot.m_ops.size();
+	slotHeader.m_groupCount = snapshot.m_groups.size();
+	slotHeader.m_textCount = snapshot.m_textSources.size();
+	slotHeader.m_charCount = snapshot.m_textChars.size();
+	memcpy(p, &slotHeader, sizeof(slotHeader));
+	p += sizeof(SlotHeader);
+	if(opBytes)
+		memcpy(p, snapshot.m_ops.data(), opBytes);
+	if(groupBytes)
+		memcpy(p + opBytes, snapshot.m_groups.data(), groupBytes);
+	if(textBytes)
+		memcpy(p + opBytes + groupBytes, snapshot.m_textSources.data(), textBytes);
+	if(charBytes)
+		memcpy(p + opBytes + groupBytes + textBytes, snapshot.m_textChars.data(), charBytes);
+
+	// Publishing is a full barrier, so the slot is complete before it's seen
+	InterlockedExchange(&header->m_latest, slot);
+	InterlockedExchange64(&header->m_writeTime, SteadyTicks());
+	InterlockedIncrement64(&header->m_written);
+
+	++m_pImpl->m_stats.frames;
+	m_pImpl->m_stats.bytes += bytes;
+	m_pImpl->m_stats.seconds += Seconds(start);
+	return true;
+}
+
+const SharedFrameStats& SharedFrameSource::GetStats() const
+{
+	return m_pImpl->m_stats;
+}
+
+struct SharedFrameViewImpl
+{
+	HANDLE m_mapping;
+	SharedHeader* m_header;
+	size_t m_slotBytes;		// As checked against the mapping when opened
+	LONG64 m_frame;
+
+	// The frame being presented, and the one being copied in and checked
+	SceneSnapshot m_current;
+	SceneSnapshot m_incoming;
+	bool m_hasFrame;
+
+	SharedFrameStats m_stats;
+
+	// Reused to look up text layouts, so a frame of unchanged text doesn't
+	// allocate
+	std::wstring m_font;
+	std::wstring m_text;
+
+	SharedFrameViewImpl() : m_mapping(nullptr), m_header(nullptr), m_slotBytes(0), m_frame(0), m_hasFrame(false) { m_stats = SharedFrameStats(); }
+	bool CopyIn(LONG slot);
+	void LayOutText();
+};
+
+bool SharedFrameViewImpl::CopyIn(LONG slot)
+{
+	// The writer can be anything, so nothing it wrote is trusted
+	size_t slotBytes = m_slotBytes;
+	SlotHeader slotHeader;
+	memcpy(&slotHeader, SlotAt(m_header, slotBytes, slot), sizeof(slotHeader));
+	if(slotHeader.m_opCount > slotBytes / sizeof(SnapshotOp) || slotHeader.m_groupCount > slotBytes / sizeof(SnapshotGroup) ||
+		slotHeader.m_textCount > slotBytes / sizeof(SnapshotText) || slotHeader.m_charCount > slotBytes / sizeof(wchar_t))
+	{
+		return false;
+	}
+
+	size_t opBytes = (size_t)slotHeader.m_opCount * sizeof(SnapshotOp);
+	size_t groupBytes = (size_t)slotHeader.m_groupCount * sizeof(SnapshotGroup);
+	size_t textBytes = (size_t)slotHeader.m_textCount * sizeof(SnapshotText);
+	size_t charBytes = (size_t)slotHeader.m_charCount * sizeof(wchar_t);
+	size_t bytes = sizeof(SlotHeader) + opBytes + groupBytes + textBytes + charBytes;
+	if(bytes > slotBytes)
+		return false;
+
+	const BYTE* p = SlotAt(m_header, slotBytes, slot) + sizeof(SlotHeader);
+	m_incoming.Clear();
+	m_incoming.m_ops.resize((size_t)slotHeader.m_opCount);
+	m_incoming.m_groups.resize((size_t)slotHeader.m_groupCount);
+	m_incoming.m_textSources.resize((size_t)slotHeader.m_textCount);
+	m_incoming.m_textChars.resize((size_t)slotHeader.m_charCount);
+	if(opBytes)
+		memcpy(m_incoming.m_ops.data(), p, opBytes);
+	if(groupBytes)
+		memcpy(m_incoming.m_groups.data(), p + opBytes, groupBytes);
+	if(textBytes)
+		memcpy(m_incoming.m_textSources.data(), p + opBytes + groupBytes, textBytes);
+	if(charBytes)
+		memcpy(m_incoming.m_textChars.data(), p + opBytes + groupBytes + textBytes, charBytes);
+	m_incoming.m_pixelSize = D2D1::SizeU(slotHeader.m_width, slotHeader.m_height);
+	m_incoming.m_sequence = (unsigned)slotHeader.m_frame;
+	m_stats.bytes += bytes;
+
+	for(auto& text : m_incoming.m_textSources)
+	{
+		if(!ValidText(text, m_incoming.m_textChars.size()))
+			return false;
+	}
+	return true;
+}
+
+void SharedFrameViewImpl::LayOutText()
+{
+	// Laid out here with the host's own DirectWrite, through the same cache
+	// its labels use. Text that came without a source, or too big to lay
+	// out, is left out.
+	std::vector<wchar_t>& chars = m_incoming.m_textChars;
+	m_incoming.m_texts.resize(m_incoming.m_textSources.size());
+	for(size_t i = 0; i < m_incoming.m_textSources.size(); ++i)
+	{
+		const SnapshotText& source = m_incoming.m_textSources[i];
+		if(source.m_fontLength == 0 || source.m_size <= 0 || source.m_size > c_maxTextSize)
+			continue;
+		m_font.assign(chars.data() + source.m_font, source.m_fontLength);
+		m_text.assign(chars.data() + source.m_text, source.m_textLength);
+		m_incoming.m_texts[i] = CachedTextLayout(m_font, m_text, source.m_size, source.m_max);
+	}
+}
+
+SharedFrameView::SharedFrameView() :
+m_pImpl(new SharedFrameViewImpl)
+{
+}
+
+SharedFrameView::~SharedFrameView()
+{
+	Close();
+	delete m_pImpl;
+}
+
+bool SharedFrameView::Open(const std::string& name)
+{
+	Close();
+
+	m_pImpl->m_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if(!m_pImpl->m_mapping)
+		return false;
+
+	m_pImpl->m_header = (SharedHeader*)MapViewOfFile(m_pImpl->m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	MEMORY_BASIC_INFORMATION info;
+	if(!m_pImpl->m_header || !VirtualQuery(m_pImpl->m_header, &info, sizeof(info)))
+	{
+		Close();
+		return false;
+	}
+	size_t mapped = info.RegionSize;
+
+	// Not ready yet, from an incompatible build, or claiming more than was mapped
+	SharedHeader* header = m_pImpl->m_header;
+	UINT64 slotBytes = mapped < HeaderBytes() ? 0 : header->m_slotBytes;
+	if(mapped < HeaderBytes() || header->m_magic != c_sharedMagic ||
+		header->m_version != c_sharedVersion || header->m_opSize != sizeof(SnapshotOp) ||
+		header->m_groupSize != sizeof(SnapshotGroup) || header->m_textSize != sizeof(SnapshotText) || slotBytes < sizeof(SlotHeader) ||
+		slotBytes > (mapped - HeaderBytes()) / c_sharedSlots)
+	{
+		Close();
+		return false;
+	}
+	m_pImpl->m_slotBytes = (size_t)slotBytes;
+	return true;
+}
+
+void SharedFrameView::Close()
+{
+	if(m_pImpl->m_header)
+		UnmapViewOfFile(m_pImpl->m_header);
+	if(m_pImpl->m_mapping)
+		CloseHandle(m_pImpl->m_mapping);
+	m_pImpl->m_header = nullptr;
+	m_pImpl->m_mapping = nullptr;
+	m_pImpl->m_slotBytes = 0;
+	m_pImpl->m_frame = 0;
+}
+
+bool SharedFrameView::IsOpen() const
+{
+	return m_pImpl->m_header != nullptr;
+}
+
+bool SharedFrameView::Update()
+{
+	SharedHeader* header = m_pImpl->m_header;
+	if(!header)
+		return false;
+	LONG64 written = header->m_written;
+	if(written == m_pImpl->m_frame)
+		return false;
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Pin the latest slot, then make sure it was still the latest once
+	// pinned; if not, the writer may already be reusing it
+	LONG slot = -1;
+	for(int attempt = 0; attempt < c_pinAttempts && slot < 0; ++attempt)
+	{
+		LONG latest = header->m_latest;
+		if(latest < 0 || latest >= c_sharedSlots)
+			return false;
+		InterlockedExchange(&header->m_reading, latest);
+		if(header->m_latest == latest)
+			slot = latest;
+	}
+
+	bool copied = slot >= 0 && m_pImpl->CopyIn(slot);
+	InterlockedExchange(&header->m_reading, -1);
+	if(slot < 0)
+		return false;
+
+	m_pImpl->m_frame = written;
+	if(!copied || !ValidSnapshot(m_pImpl->m_incoming))
+	{
+		++m_pImpl->m_stats.framesRejected;
+		return false;
+	}
+
+	m_pImpl->LayOutText();
+	std::swap(m_pImpl->m_current, m_pImpl->m_incoming);
+	m_pImpl->m_hasFrame = true;
+	++m_pImpl->m_stats.frames;
+	m_pImpl->m_stats.seconds += Seconds(start);
+	return true;
+}
+
+bool SharedFrameView::HasFrame() const
+{
+	return m_pImpl->m_hasFrame;
+}
+
+D2D1_SIZE_U SharedFrameView::GetPixelSize() const
+{
+	return m_pImpl->m_current.m_pixelSize;
+}
+
+double SharedFrameView::GetWriterIdle() const
+{
+	if(!m_pImpl->m_header)
+		return 0;
+	LONG64 ticks = SteadyTicks() - m_pImpl->m_header->m_writeTime;
+	return std::chrono::duration<double>(std::chrono::steady_clock::duration(ticks)).count();
+}
+
+bool SharedFrameView::IsAnimating() const
+{
+	return m_pImpl->m_hasFrame && m_pImpl->m_current.IsAnimating(std::chrono::steady_clock::now());
+}
+
+void SharedFrameView::Present(RenderContext& ctx)
+{
+	if(m_pImpl->m_hasFrame)
+		ctx.Replay(m_pImpl->m_current);
+}
+
+const SharedFrameStats& SharedFrameView::GetStats() const
+{
+	return m_pImpl->m_stats;
+}
+
+} // end namespace dash
+} // end namespace tjm
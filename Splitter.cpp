@@ -3,9 +3,12 @@
 #include "utils.h"
 #include "AnimatedVar.h"
 
+#include <chrono>
+
 namespace tjm {
 namespace dash {
 
+typedef std::chrono::steady_clock SplitterClock;
 
 struct SplitterImpl
 {
@@ -29,7 +32,15 @@ struct SplitterImpl
 	DOUBLE m_pos; // always stored as a percent
 	tjm::animation::AnimatedVar m_splitterPos;
 
-	CComPtr<ID2D1SolidColorBrush> m_brush;
+	SplitLiveResize m_liveResize;
+	UINT m_layoutInterval;
+	bool m_dragging;
+	bool m_previewing;			// Set while a drag lays out without resizing
+	SplitterClock::time_point m_lastDragLayout;
+	LayerCaching m_savedCaching[2];
+	bool m_previewClip[2];		// Pane is clipped by the preview, not by us
+	bool m_hadClip[2];			// The pane's own clip, put back after the preview
+	D2D1_RECT_F m_savedClip[2];
 
 	SplitterImpl();
 };
@@ -49,13 +60,23 @@ m_minIsPercent(true),
 m_max(1.0),
 m_maxIsPercent(true),
 m_collapsed(false),
-m_pos(.5)
+m_pos(.5),
+m_liveResize(SplitLiveResize::Immediate),
+m_layoutInterval(100),
+m_dragging(false),
+m_previewing(false)
 {
+	m_savedCaching[0] = m_savedCaching[1] = LayerCaching::None;
+	m_previewClip[0] = m_previewClip[1] = false;
+	m_hadClip[0] = m_hadClip[1] = false;
+	m_savedClip[0] = m_savedClip[1] = D2D1::RectF(0, 0, 0, 0);
 }
 
 Splitter::Splitter() :
 m_pImpl(new SplitterImpl())
 {
+	SetBatchedRendering(true);
+	SetTouchPrediction(true);
 }
 
 Splitter::~Splitter()
@@ -66,6 +87,7 @@ Splitter::~Splitter()
 void Splitter::SetOrientation(Orientation o)
 {
 	m_pImpl->m_orientation = o;
+	Invalidate();
 }
 
 Orientation Splitter::GetOrientation() const
@@ -76,6 +98,7 @@ Orientation Splitter::GetOrientation() const
 void Splitter::SetStyle(SplitterStyle s)
 {
 	m_pImpl->m_style = s;
+	Invalidate();
 }
 
 SplitterStyle Splitter::GetStyle() const
@@ -86,7 +109,7 @@ SplitterStyle Splitter::GetStyle() const
 void Splitter::SetColor(D2D1::ColorF color)
 {
 	m_pImpl->m_color = color;
-	m_pImpl->m_brush.Release();
+	Invalidate();
 }
 
 D2D1::ColorF Splitter::GetColor() const
@@ -104,12 +127,24 @@ bool Splitter::GetMoveable() const
 	return m_pImpl->m_moveable;
 }
 
+void Splitter::SetLiveResize(SplitLiveResize mode, UINT intervalMs)
+{
+	m_pImpl->m_liveResize = mode;
+	m_pImpl->m_layoutInterval = intervalMs;
+}
+
+SplitLiveResize Splitter::GetLiveResize() const
+{
+	return m_pImpl->m_liveResize;
+}
+
 void Splitter::SetLeftTop(Object* obj, SplitLayoutType layout)
 {
 	RemoveChild(GetLeftTop());
 	AddChild(obj);
 	m_pImpl->m_leftTop = obj;
 	m_pImpl->m_leftTopLayoutType = layout;
+	CacheOverlayPane(obj, layout);
 }
 
 Object* Splitter::GetLeftTop() const
@@ -123,6 +158,7 @@ void Splitter::SetRightBottom(Object* obj, SplitLayoutType layout)
 	AddChild(obj);
 	m_pImpl->m_rightBottom = obj;
 	m_pImpl->m_rightBottomLayoutType = layout;
+	CacheOverlayPane(obj, layout);
 }
 
 Object* Splitter::GetRightBottom() const
@@ -227,6 +263,7 @@ void Splitter::OnLayout()
 
 	// Read back bounded value
 	pos = (FLOAT)m_pImpl->m_splitterPos.GetFinalValue();
+	Invalidate();
 
 	// Now position the left and right objects.
 	if(GetOrientation() == Orientation::Horizontal)
@@ -335,10 +372,74 @@ void Splitter::OnLayout()
 			break;
 		}
 	}
-	GetLeftTop()->SetPosition(D2D1::Point2F(left, top));
-	GetLeftTop()->SetSize(D2D1::SizeF(right - left, bottom - top));
-	GetRightBottom()->SetPosition(D2D1::Point2F(secondLeft, secondTop));
-	GetRightBottom()->SetSize(D2D1::SizeF(secondRight - secondLeft, secondBottom - secondTop));
+	PlacePane(0, D2D1::RectF(left, top, right, bottom), m_pImpl->m_leftTopLayoutType);
+	PlacePane(1, D2D1::RectF(secondLeft, secondTop, secondRight, secondBottom), m_pImpl->m_rightBottomLayoutType);
+}
+
+void Splitter::PlacePane(size_t i, const D2D1_RECT_F& rect, SplitLayoutType layout)
+{
+	Object* obj = i == 0 ? GetLeftTop() : GetRightBottom();
+	D2D1_SIZE_F size = D2D1::SizeF(rect.right - rect.left, rect.bottom - rect.top);
+	obj->SetPosition(D2D1::Point2F(rect.left, rect.top));
+
+	// Only variable panes change size with the splitter; while previewing
+	// they keep their layout and their layer stands in at the new size
+	if(m_pImpl->m_previewing && layout == SplitLayoutType::Variable)
+	{
+		if(m_pImpl->m_liveResize == SplitLiveResize::Stretch)
+		{
+			obj->SetLayerStretch(size);
+		}
+		else
+		{
+			if(!m_pImpl->m_previewClip[i])
+			{
+				m_pImpl->m_hadClip[i] = obj->HasClippingRect();
+				if(m_pImpl->m_hadClip[i])
+					m_pImpl->m_savedClip[i] = obj->GetClippingRect();
+				m_pImpl->m_previewClip[i] = true;
+			}
+
+			// Within the pane's own clip, if it has one
+			D2D1_RECT_F clip = D2D1::RectF(0, 0, size.width, size.height);
+			if(m_pImpl->m_hadClip[i])
+			{
+				const D2D1_RECT_F& own = m_pImpl->m_savedClip[i];
+				clip.left = max(clip.left, own.left);
+				clip.top = max(clip.top, own.top);
+				clip.right = max(clip.left, min(clip.right, own.right));
+				clip.bottom = max(clip.top, min(clip.bottom, own.bottom));
+			}
+			obj->SetClippingRect(clip);
+		}
+		return;
+	}
+
+	obj->SetLayerStretch(D2D1::SizeF(0, 0));
+	if(m_pImpl->m_previewClip[i])
+	{
+		if(m_pImpl->m_hadClip[i])
+			obj->SetClippingRect(m_pImpl->m_savedClip[i]);
+		else
+			obj->ClearClippingRect();
+		m_pImpl->m_previewClip[i] = false;
+	}
+	obj->SetSize(size);
+}
+
+void Splitter::EndPreview()
+{
+	if(!m_pImpl->m_dragging)
+		return;
+
+	m_pImpl->m_dragging = false;
+	GetLeftTop()->SetLayerCaching(m_pImpl->m_savedCaching[0]);
+	GetRightBottom()->SetLayerCaching(m_pImpl->m_savedCaching[1]);
+
+	// The real layout replaces whatever was being previewed
+	tjm::animation::AllInstant ai(true);
+	DirtyLayout();
+	Layout();
 }
 
 D2D1_SIZE_F Splitter::GetPreferredSize(D2D1_SIZE_F& max)
@@ -354,6 +455,21 @@ D2D1_SIZE_F Splitter::GetPreferredSize(D2D1_SIZE_F& max)
 	return first;
 }
 
+bool Splitter::IsContentAnimating() const
+{
+	return (DOUBLE)m_pImpl->m_splitterPos != m_pImpl->m_splitterPos.GetFinalValue();
+}
+
+void Splitter::CacheOverlayPane(Object* obj, SplitLayoutType layout)
+{
+	// Moving the splitter only changes an overlay pane's clip, so let it
+	// composite from a cached layer unless the caller chose otherwise.
+	if(obj && layout == SplitLayoutType::Overlay && obj->GetLayerCaching() == LayerCaching::None)
+	{
+		obj->SetLayerCaching(LayerCaching::Auto);
+	}
+}
+
 FLOAT Splitter::SplitLength() const
 {
 	if(GetOrientation() == Orientation::Horizontal)
@@ -407,12 +523,12 @@ void Splitter::SetBounds()
 	m_pImpl->m_splitterPos.SetMax(&max);
 }
 
-void Splitter::OnRenderForeground(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/)
+void Splitter::OnRenderForeground(ID2D1RenderTarget* /*pTarget*/, const D2D1_RECT_F& /*box*/, DOUBLE /*effectiveOpacity*/)
 {
-	if(!m_pImpl->m_brush)
-	{
-		CORt(pTarget->CreateSolidColorBrush(GetColor(), &m_pImpl->m_brush));
-	}
+	// Strokes are drawn as thin fills so every splitter in the tree batches
+	// into a single draw
+	RenderContext* ctx = GetRenderContext();
+	const FLOAT stroke = 1.0f;
 
 	switch(GetStyle())
 	{
@@ -420,25 +536,24 @@ void Splitter::OnRenderForeground(ID2D1RenderTarget* pTarget, const D2D1_RECT_F&
 		return;
 	case SplitterStyle::Box:
 		{
-			D2D1_RECT_F splitterRect = GetSplitterRect();
-			pTarget->DrawRectangle(splitterRect, m_pImpl->m_brush, 2.0f);
+			D2D1_RECT_F r = GetSplitterRect();
+			ctx->FillRectangle(D2D1::RectF(r.left - stroke, r.top - stroke, r.right + stroke, r.top + stroke), GetColor());
+			ctx->FillRectangle(D2D1::RectF(r.left - stroke, r.bottom - stroke, r.right + stroke, r.bottom + stroke), GetColor());
+			ctx->FillRectangle(D2D1::RectF(r.left - stroke, r.top + stroke, r.left + stroke, r.bottom - stroke), GetColor());
+			ctx->FillRectangle(D2D1::RectF(r.right - stroke, r.top + stroke, r.right + stroke, r.bottom - stroke), GetColor());
 		}
 		return;
 	case SplitterStyle::Line:
 		{
-			D2D1_POINT_2F start;
-			D2D1_POINT_2F end;
+			FLOAT pos = (FLOAT)m_pImpl->m_splitterPos;
 			if(GetOrientation() == Orientation::Horizontal)
 			{
-				start = D2D1::Point2F((FLOAT)m_pImpl->m_splitterPos, 0);
-				end = D2D1::Point2F(start.x, SplitHeight());
+				ctx->FillRectangle(D2D1::RectF(pos - stroke, 0, pos + stroke, SplitHeight()), GetColor());
 			}
 			else
 			{
-				start = D2D1::Point2F(0, (FLOAT)m_pImpl->m_splitterPos);
-				end = D2D1::Point2F(SplitHeight(), start.y);
+				ctx->FillRectangle(D2D1::RectF(0, pos - stroke, SplitHeight(), pos + stroke), GetColor());
 			}
-			pTarget->DrawLine(start, end, m_pImpl->m_brush, 2.0f);
 		}
 	case SplitterStyle::Dots:
 		{
@@ -456,7 +571,7 @@ void Splitter::OnRenderForeground(ID2D1RenderTarget* pTarget, const D2D1_RECT_F&
 				{
 					ellipse.point = D2D1::Point2F(circlePos, (FLOAT)m_pImpl->m_splitterPos);
 				}
-				pTarget->FillEllipse(ellipse, m_pImpl->m_brush);
+				ctx->FillEllipse(ellipse, GetColor());
 				circlePos += step;
 			}
 		}
@@ -494,6 +609,17 @@ Object* Splitter::OnTouch(const D2D1_POINT_2F& pos)
 	
 	if(Intersects(GetSplitterRect(), pos))
 	{
+		if(m_pImpl->m_liveResize != SplitLiveResize::Immediate && !m_pImpl->m_dragging)
+		{
+			// Previews are drawn from the panes' layers, so keep them cached
+			// for the length of the drag
+			m_pImpl->m_dragging = true;
+			m_pImpl->m_lastDragLayout = SplitterClock::now();
+			m_pImpl->m_savedCaching[0] = GetLeftTop()->GetLayerCaching();
+			m_pImpl->m_savedCaching[1] = GetRightBottom()->GetLayerCaching();
+			GetLeftTop()->SetLayerCaching(LayerCaching::Always);
+			GetRightBottom()->SetLayerCaching(LayerCaching::Always);
+		}
 		return this;
 	}
 	return nullptr;
@@ -504,15 +630,36 @@ bool Splitter::OnTouchContinue(const TouchInfo& ti)
 	tjm::animation::AllInstant ai(true);
 	if(GetOrientation() == Orientation::Horizontal)
 	{
-		SetSplitterPos(ti.currentTouch.x);
+		SetSplitterPos(ti.predictedTouch.x);
 	}
 	else
 	{
-		SetSplitterPos(ti.currentTouch.y);
+		SetSplitterPos(ti.predictedTouch.y);
+	}
+
+	// Between full layouts only the splitter and the previews move
+	if(m_pImpl->m_dragging)
+	{
+		SplitterClock::time_point now = SplitterClock::now();
+		m_pImpl->m_previewing = now - m_pImpl->m_lastDragLayout < std::chrono::milliseconds(m_pImpl->m_layoutInterval);
+		if(!m_pImpl->m_previewing)
+			m_pImpl->m_lastDragLayout = now;
 	}
 	Layout();
+	m_pImpl->m_previewing = false;
 	return true;
 }
 
+void Splitter::OnTouchFinish(const TouchInfo& ti)
+{
+	// Settle on where the touch really ended, not the last prediction
+	if(GetTouchPrediction())
+	{
+		tjm::animation::AllInstant ai(true);
+		SetSplitterPos(GetOrientation() == Orientation::Horizontal ? ti.currentTouch.x : ti.currentTouch.y);
+	}
+	EndPreview();
+}
+
 } // end namespace dash
 } // end namespace tjm
\ No newline at end of file
@@ -0,0 +1,93 @@
+#ifndef STACKLAYOUT_H
+#define STACKLAYOUT_H
+
+#include "DGui.h"
+
+namespace tjm {
+namespace dash {
+
+// One child of a stack, gathered before layout so the kernels run over
+// plain contiguous data
+struct StackEntry
+{
+	FLOAT m_left;
+	FLOAT m_top;
+	FLOAT m_right;
+	FLOAT m_bottom;
+	D2D1_SIZE_F m_size;
+};
+
+template<Orientation O> struct StackAxis;
+
+template<> struct StackAxis<Orientation::Vertical>
+{
+	static FLOAT Lead(const StackEntry& e) { return e.m_top; }
+	static FLOAT Trail(const StackEntry& e) { return e.m_bottom; }
+	static FLOAT Cross(const StackEntry& e) { return e.m_left; }
+	static FLOAT Length(const D2D1_SIZE_F& size) { return size.height; }
+	static D2D1_POINT_2F Point(FLOAT along, FLOAT cross) { return D2D1::Point2F(cross, along); }
+};
+
+template<> struct StackAxis<Orientation::Horizontal>
+{
+	static FLOAT Lead(const StackEntry& e) { return e.m_left; }
+	static FLOAT Trail(const StackEntry& e) { return e.m_right; }
+	static FLOAT Cross(const StackEntry& e) { return e.m_top; }
+	static FLOAT Length(const D2D1_SIZE_F& size) { return size.width; }
+	static D2D1_POINT_2F Point(FLOAT along, FLOAT cross) { return D2D1::Point2F(along, cross); }
+};
+
+// Place returns where an item starts and advances offset past it.
+// LeftRight and RightLeft share these with TopDown and BottomUp.
+template<Direction D> struct StackDirection;
+
+template<> struct StackDirection<Direction::TopDown>
+{
+	static FLOAT Place(FLOAT& offset, FLOAT lead, FLOAT length, FLOAT trail, FLOAT /*extent*/)
+	{
+		FLOAT start = offset + lead;
+		offset = start + length + trail;
+		return start;
+	}
+};
+
+template<> struct StackDirection<Direction::BottomUp>
+{
+	static FLOAT Place(FLOAT& offset, FLOAT lead, FLOAT length, FLOAT trail, FLOAT extent)
+	{
+		offset += trail + length;
+		FLOAT start = extent - offset;
+		offset += lead;
+		return start;
+	}
+};
+
+// Positions count entries along a stack of the given extent
+template<Orientation O, Direction D>
+void StackLayout(const StackEntry* entries, size_t count, FLOAT extent, D2D1_POINT_2F* positions)
+{
+	typedef StackAxis<O> Axis;
+	typedef StackDirection<D> Dir;
+
+	FLOAT offset = 0;
+	for(size_t i = 0; i < count; ++i)
+	{
+		const StackEntry& e = entries[i];
+		FLOAT along = Dir::Place(offset, Axis::Lead(e), Axis::Length(e.m_size), Axis::Trail(e), extent);
+		positions[i] = Axis::Point(along, Axis::Cross(e));
+	}
+}
+
+typedef void (*StackKernel)(const StackEntry* entries, size_t count, FLOAT extent, D2D1_POINT_2F* positions);
+
+inline StackKernel SelectStackKernel(Orientation o, Direction d)
+{
+	if(o == Orientation::Vertical)
+		return d == Direction::TopDown ? &StackLayout<Orientation::Vertical, Direction::TopDown> : &StackLayout<Orientation::Vertical, Direction::BottomUp>;
+	return d == Direction::LeftRight ? &StackLayout<Orientation::Horizontal, Direction::LeftRight> : &StackLayout<Orientation::Horizontal, Direction::RightLeft>;
+}
+
+} // end namespace dash
+} // end namespace tjm
+
+#endif
@@ -0,0 +1,545 @@
+#include "DGui.h"
+#include "atlbase.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+namespace {
+	const size_t c_chunkSize = 4096;
+	const size_t c_maxChunks = 65536;
+
+	// Min/max summary levels inside a chunk, as log2 of samples per bucket.
+	// The last level summarizes the whole chunk.
+	const size_t c_levels = 3;
+	const size_t c_levelShift[c_levels] = { 4, 8, 12 };
+	const size_t c_levelOffset[c_levels] = { 0, c_chunkSize >> 4, (c_chunkSize >> 4) + (c_chunkSize >> 8) };
+	const size_t c_summaryBuckets = (c_chunkSize >> 4) + (c_chunkSize >> 8) + 1;
+}
+
+struct SampleChunk
+{
+	double m_times[c_chunkSize];
+	FLOAT m_values[c_chunkSize];
+	FLOAT m_min[c_summaryBuckets];
+	FLOAT m_max[c_summaryBuckets];
+};
+
+struct TimeSeriesChartImpl
+{
+	// Written by the feed thread only. A sample, and every summary bucket it
+	// completes, is written before m_count is advanced past it, so readers
+	// only look at what m_count covers and never need a lock. The chunk
+	// table is sized up front so it never moves under a reader.
+	std::vector<std::atomic<SampleChunk*>> m_chunks;
+	std::atomic<size_t> m_count;
+	double m_lastTime;
+	std::thread::id m_feedThread;		// The one thread appending, for the assert
+
+	bool m_follow;
+	double m_span;
+	double m_start;
+	double m_end;
+	double m_valueMin;
+	double m_valueMax;
+	D2D1::ColorF m_lineColor;
+	D2D1::ColorF m_backgroundColor;
+
+	// The plot is kept in a bitmap used as a ring of pixel columns: column c
+	// lives at c mod width. Scrolling moves the start of the ring, and only
+	// columns that weren't drawn before are rasterized.
+	CComPtr<ID2D1BitmapRenderTarget> m_ring;
+	CComPtr<ID2D1SolidColorBrush> m_brush;
+	ID2D1RenderTarget* m_device;		// What m_ring was created from, only compared
+	UINT32 m_ringWidth;
+	FLOAT m_ringHeight;
+	bool m_rasterValid;
+	double m_rasterTimePerColumn;
+	double m_rasterValueMin;
+	double m_rasterValueMax;
+	INT64 m_rasterFirst;
+	INT64 m_rasterEnd;
+	size_t m_drawnCount;
+
+	TimeSeriesChartImpl();
+	~TimeSeriesChartImpl();
+
+	void Write(size_t index, double time, double value);
+	void Release();
+
+	const SampleChunk* Chunk(size_t index) const { return m_chunks[index / c_chunkSize].load(std::memory_order_acquire); }
+	double Time(size_t index) const { return Chunk(index)->m_times[index % c_chunkSize]; }
+	FLOAT Value(size_t index) const { return Chunk(index)->m_values[index % c_chunkSize]; }
+	FLOAT ValueAt(size_t after, double time) const;
+	size_t LowerBound(double time, size_t count) const;
+	bool RangeMinMax(size_t first, size_t last, FLOAT& min, FLOAT& max) const;
+	void Window(size_t count, double& start, double& end) const;
+
+	UINT32 RingX(INT64 column) const;
+	FLOAT ToY(double value) const;
+	void RasterColumns(INT64 begin, INT64 end, size_t count, double timePerColumn);
+};
+
+TimeSeriesChartImpl::TimeSeriesChartImpl() :
+m_chunks(c_maxChunks),
+m_count(0),
+m_lastTime(0),
+m_follow(false),
+m_span(1.0),
+m_start(0),
+m_end(1.0),
+m_valueMin(0),
+m_valueMax(1.0),
+m_lineColor(D2D1::ColorF::SteelBlue),
+m_backgroundColor(D2D1::ColorF::White),
+m_device(nullptr),
+m_ringWidth(0),
+m_ringHeight(0),
+m_rasterValid(false),
+m_rasterTimePerColumn(0),
+m_rasterValueMin(0),
+m_rasterValueMax(0),
+m_rasterFirst(0),
+m_rasterEnd(0),
+m_drawnCount(0)
+{
+}
+
+TimeSeriesChartImpl::~TimeSeriesChartImpl()
+{
+	Release();
+}
+
+void TimeSeriesChartImpl::Release()
+{
+	for(auto& chunk : m_chunks)
+	{
+		delete chunk.exchange(nullptr);
+	}
+	m_count = 0;
+	m_lastTime = 0;
+	m_feedThread = std::thread::id();
+	m_rasterValid = false;
+	m_drawnCount = 0;
+}
+
+void TimeSeriesChartImpl::Write(size_t index, double time, double value)
+{
+	size_t offset = index % c_chunkSize;
+	if(offset == 0)
+		m_chunks[index / c_chunkSize].store(new SampleChunk, std::memory_order_relaxed);
+
+	if(index > 0 && time < m_lastTime)
+		time = m_lastTime;
+	m_lastTime = time;
+
+	SampleChunk* chunk = m_chunks[index / c_chunkSize].load(std::memory_order_relaxed);
+	FLOAT v = (FLOAT)value;
+	chunk->m_times[offset] = time;
+	chunk->m_values[offset] = v;
+
+	for(size_t level = 0; level < c_levels; ++level)
+	{
+		size_t shift = c_levelShift[level];
+		size_t bucket = c_levelOffset[level] + (offset >> shift);
+		if((offset & ((1 << shift) - 1)) == 0)
+		{
+			chunk->m_min[bucket] = chunk->m_max[bucket] = v;
+		}
+		else
+		{
+			chunk->m_min[bucket] = min(chunk->m_min[bucket], v);
+			chunk->m_max[bucket] = max(chunk->m_max[bucket], v);
+		}
+	}
+}
+
+FLOAT TimeSeriesChartImpl::ValueAt(size_t after, double time) const
+{
+	// Linear between the samples either side of time
+	double t0 = Time(after - 1);
+	double t1 = Time(after);
+	FLOAT v0 = Value(after - 1);
+	FLOAT v1 = Value(after);
+	if(t1 <= t0)
+		return v1;
+	return (FLOAT)(v0 + (v1 - v0) * (time - t0) / (t1 - t0));
+}
+
+size_t TimeSeriesChartImpl::LowerBound(double time, size_t count) const
+{
+	// First chunk starting at or after time; the answer is in the one before
+	size_t lo = 0;
+	size_t hi = (count + c_chunkSize - 1) / c_chunkSize;
+	while(lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if(Chunk(mid * c_chunkSize)->m_times[0] < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(lo == 0)
+		return 0;
+
+	size_t first = (lo - 1) * c_chunkSize;
+	size_t last = min(count, lo * c_chunkSize);
+	const double* times = Chunk(first)->m_times;
+	return first + (std::lower_bound(times, times + (last - first), time) - times);
+}
+
+bool TimeSeriesChartImpl::RangeMinMax(size_t first, size_t last, FLOAT& outMin, FLOAT& outMax) const
+{
+	bool any = false;
+	while(first < last)
+	{
+		const SampleChunk* chunk = Chunk(first);
+		size_t offset = first % c_chunkSize;
+
+		// Take the biggest summary bucket that starts here and fits
+		size_t span = 1;
+		FLOAT lo = chunk->m_values[offset];
+		FLOAT hi = lo;
+		for(size_t level = c_levels; level > 0; --level)
+		{
+			size_t shift = c_levelShift[level - 1];
+			size_t size = (size_t)1 << shift;
+			if((offset & (size - 1)) == 0 && first + size <= last)
+			{
+				size_t bucket = c_levelOffset[level - 1] + (offset >> shift);
+				lo = chunk->m_min[bucket];
+				hi = chunk->m_max[bucket];
+				span = size;
+				break;
+			}
+		}
+
+		outMin = any ? min(outMin, lo) : lo;
+		outMax = any ? max(outMax, hi) : hi;
+		any = true;
+		first += span;
+	}
+	return any;
+}
+
+void TimeSeriesChartImpl::Window(size_t count, double& start, double& end) const
+{
+	if(m_follow)
+	{
+		end = count > 0 ? Time(count - 1) : 0;
+		start = end - m_span;
+	}
+	else
+	{
+		start = m_start;
+		end = m_end;
+	}
+}
+
+UINT32 TimeSeriesChartImpl::RingX(INT64 column) const
+{
+	INT64 width = m_ringWidth;
+	return (UINT32)(((column % width) + width) % width);
+}
+
+FLOAT TimeSeriesChartImpl::ToY(double value) const
+{
+	double range = m_valueMax - m_valueMin;
+	double y = range > 0 ? m_ringHeight * (m_valueMax - value) / range : m_ringHeight / 2;
+
+	// Keep way out of range values from making huge rects
+	return (FLOAT)min(max(y, -1.0), (double)m_ringHeight + 1);
+}
+
+void TimeSeriesChartImpl::RasterColumns(INT64 begin, INT64 end, size_t count, double timePerColumn)
+{
+	if(begin >= end)
+		return;
+
+	// Clear the columns, which may wrap around the end of the ring
+	for(INT64 column = begin; column < end;)
+	{
+		UINT32 x = RingX(column);
+		INT64 runEnd = min(end, column + (INT64)(m_ringWidth - x));
+		m_ring->PushAxisAlignedClip(D2D1::RectF((FLOAT)x, 0, (FLOAT)(x + (runEnd - column)), m_ringHeight), D2D1_ANTIALIAS_MODE_ALIASED);
+		m_ring->Clear(m_backgroundColor);
+		m_ring->PopAxisAlignedClip();
+		column = runEnd;
+	}
+
+	size_t first = LowerBound(begin * timePerColumn, count);
+	for(INT64 column = begin; column < end; ++column)
+	{
+		size_t last = LowerBound((column + 1) * timePerColumn, count);
+
+		FLOAT lo = 0, hi = 0;
+		bool any = RangeMinMax(first, last, lo, hi);
+
+		// Join up with the line coming in from the previous sample, and carry
+		// it across columns that have no samples of their own
+		if(first > 0 && first < count)
+		{
+			FLOAT in = ValueAt(first, column * timePerColumn);
+			lo = any ? min(lo, in) : in;
+			hi = any ? max(hi, in) : in;
+			if(!any)
+			{
+				FLOAT out = ValueAt(first, (column + 1) * timePerColumn);
+				lo = min(lo, out);
+				hi = max(hi, out);
+			}
+			any = true;
+		}
+
+		if(any)
+		{
+			FLOAT x = (FLOAT)RingX(column);
+			FLOAT top = ToY(hi);
+			FLOAT bottom = max(ToY(lo), top + 1.0f);
+			m_ring->FillRectangle(D2D1::RectF(x, top, x + 1.0f, bottom), m_brush);
+		}
+		first = last;
+	}
+}
+
+TimeSeriesChart::TimeSeriesChart() :
+m_pImpl(new TimeSeriesChartImpl())
+{
+}
+
+TimeSeriesChart::~TimeSeriesChart()
+{
+	delete m_pImpl;
+}
+
+void TimeSeriesChart::Append(double time, double value)
+{
+	Append(&time, &value, 1);
+}
+
+void TimeSeriesChart::Append(const double* times, const double* values, size_t count)
+{
+	// One producer only; a second would race on m_count and the chunks
+	if(m_pImpl->m_feedThread == std::thread::id())
+		m_pImpl->m_feedThread = std::this_thread::get_id();
+	assert(m_pImpl->m_feedThread == std::this_thread::get_id());
+
+	// Samples past the last chunk are dropped
+	size_t index = m_pImpl->m_count.load(std::memory_order_relaxed);
+	count = min(count, c_maxChunks * c_chunkSize - index);
+	for(size_t i = 0; i < count; ++i)
+	{
+		m_pImpl->Write(index + i, times[i], values[i]);
+	}
+	m_pImpl->m_count.store(index + count, std::memory_order_release);
+}
+
+size_t TimeSeriesChart::NumSamples() const
+{
+	return m_pImpl->m_count.load(std::memory_order_acquire);
+}
+
+void TimeSeriesChart::ClearSamples()
+{
+	m_pImpl->Release();
+	Invalidate();
+}
+
+void TimeSeriesChart::SetTimeRange(double start, double end)
+{
+	m_pImpl->m_follow = false;
+	m_pImpl->m_start = start;
+	m_pImpl->m_end = end;
+	Invalidate();
+}
+
+void TimeSeriesChart::SetFollow(double span)
+{
+	m_pImpl->m_follow = true;
+	m_pImpl->m_span = span;
+	Invalidate();
+}
+
+bool TimeSeriesChart::IsFollowing() const
+{
+	return m_pImpl->m_follow;
+}
+
+double TimeSeriesChart::GetTimeStart() const
+{
+	double start, end;
+	m_pImpl->Window(NumSamples(), start, end);
+	return start;
+}
+
+double TimeSeriesChart::GetTimeEnd() const
+{
+	double start, end;
+	m_pImpl->Window(NumSamples(), start, end);
+	return end;
+}
+
+void TimeSeriesChart::SetValueRange(double min, double max)
+{
+	m_pImpl->m_valueMin = min;
+	m_pImpl->m_valueMax = max;
+	Invalidate();
+}
+
+double TimeSeriesChart::GetValueMin() const
+{
+	return m_pImpl->m_valueMin;
+}
+
+double TimeSeriesChart::GetValueMax() const
+{
+	return m_pImpl->m_valueMax;
+}
+
+void TimeSeriesChart::SetLineColor(D2D1::ColorF color)
+{
+	m_pImpl->m_lineColor = color;
+	m_pImpl->m_brush.Release();
+	m_pImpl->m_rasterValid = false;
+	Invalidate();
+}
+
+void TimeSeriesChart::SetBackgroundColor(D2D1::ColorF color)
+{
+	m_pImpl->m_backgroundColor = color;
+	m_pImpl->m_rasterValid = false;
+	Invalidate();
+}
+
+bool TimeSeriesChart::GetMinMax(double start, double end, double& min, double& max) const
+{
+	size_t count = NumSamples();
+	FLOAT lo, hi;
+	if(!m_pImpl->RangeMinMax(m_pImpl->LowerBound(start, count), m_pImpl->LowerBound(end, count), lo, hi))
+		return false;
+	min = lo;
+	max = hi;
+	return true;
+}
+
+bool TimeSeriesChart::IsContentVolatile() const
+{
+	// Samples arrive from other threads without invalidating anything, so a
+	// layer holding the chart can never be assumed up to date
+	return true;
+}
+
+void TimeSeriesChart::OnRenderBackground(ID2D1RenderTarget* pTarget, const D2D1_RECT_F& /*box*/, DOUBLE effectiveOpacity)
+{
+	TimeSeriesChartImpl* impl = m_pImpl;
+	UINT32 width = (UINT32)ceil(GetSize().width);
+	FLOAT height = GetSize().height;
+	if(width == 0 || height <= 0)
+		return;
+
+	// Everything below works from this snapshot of the sample count
+	size_t count = NumSamples();
+
+	double start, end;
+	impl->Window(count, start, end);
+	if(end <= start)
+		end = start + 1.0;
+	// From the span rather than end - start, which rounds differently as a
+	// followed window moves and would look like a scale change every frame
+	double span = impl->m_follow ? impl->m_span : end - start;
+	if(span <= 0)
+		span = 1.0;
+	double timePerColumn = span / width;
+	INT64 first = (INT64)floor(start / timePerColumn);
+	INT64 visibleEnd = first + width;
+
+	ID2D1RenderTarget* pDevice = GetRenderContext()->GetTarget();
+	if(!impl->m_ring || impl->m_device != pDevice || impl->m_ringWidth != width || impl->m_ringHeight != height)
+	{
+		impl->m_ring.Release();
+		impl->m_brush.Release();
+		CORt(pDevice->CreateCompatibleRenderTarget(D2D1::SizeF((FLOAT)width, height), &impl->m_ring));
+		impl->m_device = pDevice;
+		impl->m_ringWidth = width;
+		impl->m_ringHeight = height;
+		impl->m_rasterValid = false;
+	}
+	if(!impl->m_brush)
+	{
+		CORt(impl->m_ring->CreateSolidColorBrush(impl->m_lineColor, &impl->m_brush));
+	}
+
+	if(timePerColumn != impl->m_rasterTimePerColumn || impl->m_valueMin != impl->m_rasterValueMin || impl->m_valueMax != impl->m_rasterValueMax)
+		impl->m_rasterValid = false;
+
+	// Work out which of the visible columns the ring already holds
+	INT64 validBegin = first;
+	INT64 validEnd = first;
+	if(impl->m_rasterValid)
+	{
+		validBegin = max(first, impl->m_rasterFirst);
+		validEnd = min(visibleEnd, impl->m_rasterEnd);
+		if(count != impl->m_drawnCount)
+		{
+			// Columns from the last sample drawn onwards pick up the new ones
+			size_t from = impl->m_drawnCount > 0 ? impl->m_drawnCount - 1 : 0;
+			validEnd = min(validEnd, (INT64)floor(impl->Time(from) / timePerColumn));
+		}
+		if(validEnd <= validBegin)
+			validBegin = validEnd = first;
+	}
+
+	if(validBegin != first || validEnd != visibleEnd)
+	{
+		impl->m_ring->BeginDraw();
+		impl->RasterColumns(first, validBegin, count, timePerColumn);
+		impl->RasterColumns(validEnd, visibleEnd, count, timePerColumn);
+		if(!SUCCEEDED(impl->m_ring->EndDraw()))
+		{
+			// Most likely the device was lost; start over next frame
+			impl->m_ring.Release();
+			impl->m_brush.Release();
+			GetRenderContext()->RequestFrame();
+			return;
+		}
+	}
+
+	impl->m_rasterValid = true;
+	impl->m_rasterTimePerColumn = timePerColumn;
+	impl->m_rasterValueMin = impl->m_valueMin;
+	impl->m_rasterValueMax = impl->m_valueMax;
+	impl->m_rasterFirst = first;
+	impl->m_rasterEnd = visibleEnd;
+	impl->m_drawnCount = count;
+
+	// Unroll the ring: from the first column to the end of the bitmap, then
+	// whatever wrapped around to the start
+	CComPtr<ID2D1Bitmap> bitmap;
+	CORt(impl->m_ring->GetBitmap(&bitmap));
+	FLOAT split = (FLOAT)impl->RingX(first);
+	FLOAT w = (FLOAT)width;
+	D2D1_RECT_F source = D2D1::RectF(split, 0, w, height);
+	pTarget->DrawBitmap(bitmap, D2D1::RectF(0, 0, w - split, height), (FLOAT)effectiveOpacity,
+		D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, &source);
+	if(split > 0)
+	{
+		source = D2D1::RectF(0, 0, split, height);
+		pTarget->DrawBitmap(bitmap, D2D1::RectF(w - split, 0, w, height), (FLOAT)effectiveOpacity,
+			D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, &source);
+	}
+
+	// Samples that came in while drawing need another frame; otherwise
+	// the feed's Refresh brings the next one
+	if(NumSamples() != count)
+		GetRenderContext()->RequestFrame();
+}
+
+} // end namespace dash
+} // end namespace tjm
@@ -0,0 +1,596 @@
+#include "DGui.h"
+#include "AnimatedVar.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace tjm {
+namespace dash {
+
+namespace {
+	const FLOAT c_defaultRowHeight = 24.0f;
+}
+
+// A node of the model's tree, and also a node of the treap holding the
+// visible rows in order. A collapsed node keeps its descendants' rows as a
+// separate treap, so collapsing cuts out one contiguous run of rows and
+// expanding splices it back, both O(log n).
+struct TreeNode
+{
+	TreeNodeId m_id;
+	TreeNode* m_parent;
+	UINT32 m_depth;
+	bool m_expanded;
+	bool m_fetched;			// Children have been asked for
+	bool m_loaded;			// Children have been supplied
+	TreeNode* m_hidden;		// Descendant rows while collapsed
+
+	// Row treap, implicitly keyed by position
+	TreeNode* m_left;
+	TreeNode* m_right;
+	TreeNode* m_up;
+	UINT32 m_priority;
+	size_t m_size;
+	UINT32 m_minDepth;		// Shallowest row in this treap subtree
+
+	Object* m_row;			// Bound row, while in view
+	bool m_dirty;			// Row needs rebinding
+	UINT64 m_layoutStamp;
+};
+
+struct TreeViewImpl
+{
+	TreeViewModel* m_model;
+	TreeNode* m_rows;			// Treap of every visible row
+	std::unordered_map<TreeNodeId, TreeNode*> m_nodes;
+
+	FLOAT m_rowHeight;
+	double m_scroll;
+
+	std::vector<TreeNode*> m_bound;	// Nodes with rows, as of the last layout
+	std::vector<Object*> m_pool;	// Hidden rows waiting to be rebound
+	std::vector<Object*> m_allRows;
+	UINT64 m_layoutStamp;
+	UINT32 m_seed;
+
+	TreeViewImpl();
+
+	TreeNode* Find(TreeNodeId id) const;
+	TreeNode* NewNode(TreeNodeId id, TreeNode* parent, UINT32 depth);
+	void DeleteRows(TreeNode* t);
+	void ReleaseRow(TreeNode* node);
+	TreeNode* BuildRows(const TreeNodeId* ids, size_t count, TreeNode* parent, UINT32 depth);
+	TreeNode*& Slot(TreeNode* node);
+	TreeNode* CutDescendants(TreeNode* node);
+
+	// Treap operations
+	static size_t Size(const TreeNode* t) { return t ? t->m_size : 0; }
+	static void Update(TreeNode* t);
+	static TreeNode* Merge(TreeNode* a, TreeNode* b);
+	static void Split(TreeNode* t, size_t count, TreeNode*& left, TreeNode*& right);
+	static size_t IndexOf(const TreeNode* t);
+	static TreeNode* At(TreeNode* t, size_t index);
+	static TreeNode* Next(TreeNode* t);
+	static size_t FindShallow(const TreeNode* t, size_t base, size_t start, UINT32 depth);
+};
+
+TreeViewImpl::TreeViewImpl() :
+m_model(nullptr),
+m_rows(nullptr),
+m_rowHeight(c_defaultRowHeight),
+m_scroll(0),
+m_layoutStamp(0),
+m_seed(2463534242u)
+{
+}
+
+TreeNode* TreeViewImpl::Find(TreeNodeId id) const
+{
+	auto it = m_nodes.find(id);
+	return it == m_nodes.end() ? nullptr : it->second;
+}
+
+TreeNode* TreeViewImpl::NewNode(TreeNodeId id, TreeNode* parent, UINT32 depth)
+{
+	// xorshift32 for treap priorities
+	m_seed ^= m_seed << 13;
+	m_seed ^= m_seed >> 17;
+	m_seed ^= m_seed << 5;
+
+	TreeNode* node = new TreeNode();
+	node->m_id = id;
+	node->m_parent = parent;
+	node->m_depth = depth;
+	node->m_priority = m_seed;
+	node->m_size = 1;
+	node->m_minDepth = depth;
+	m_nodes[id] = node;
+	return node;
+}
+
+void TreeViewImpl::ReleaseRow(TreeNode* node)
+{
+	if(node->m_row)
+	{
+		node->m_row->SetVisible(false);
+		m_pool.push_back(node->m_row);
+		node->m_row = nullptr;
+		m_bound.erase(std::remove(m_bound.begin(), m_bound.end(), node), m_bound.end());
+	}
+}
+
+void TreeViewImpl::DeleteRows(TreeNode* t)
+{
+	if(!t)
+		return;
+
+	DeleteRows(t->m_left);
+	DeleteRows(t->m_right);
+	DeleteRows(t->m_hidden);
+	ReleaseRow(t);
+	m_nodes.erase(t->m_id);
+	delete t;
+}
+
+TreeNode* TreeViewImpl::BuildRows(const TreeNodeId* ids, size_t count, TreeNode* parent, UINT32 depth)
+{
+	TreeNode* t = nullptr;
+	for(size_t i = 0; i < count; ++i)
+	{
+		t = Merge(t, NewNode(ids[i], parent, depth));
+	}
+	return t;
+}
+
+TreeNode*& TreeViewImpl::Slot(TreeNode* node)
+{
+	// The treap holding node is either the visible rows or the hidden rows
+	// of its nearest collapsed ancestor
+	TreeNode* top = node;
+	while(top->m_up)
+	{
+		top = top->m_up;
+	}
+	if(top == m_rows)
+		return m_rows;
+	for(TreeNode* p = top->m_parent; p; p = p->m_parent)
+	{
+		if(p->m_hidden == top)
+			return p->m_hidden;
+	}
+	return m_rows;
+}
+
+TreeNode* TreeViewImpl::CutDescendants(TreeNode* node)
+{
+	// Descendants are the rows after node, up to the next one no deeper
+	TreeNode*& slot = Slot(node);
+	size_t index = IndexOf(node);
+	size_t end = FindShallow(slot, 0, index + 1, node->m_depth);
+	if(end == TreeView::NoRow)
+		end = Size(slot);
+	if(end == index + 1)
+		return nullptr;
+
+	TreeNode* before;
+	TreeNode* rest;
+	TreeNode* descendants;
+	TreeNode* after;
+	Split(slot, index + 1, before, rest);
+	Split(rest, end - index - 1, descendants, after);
+	slot = Merge(before, after);
+	return descendants;
+}
+
+void TreeViewImpl::Update(TreeNode* t)
+{
+	t->m_size = 1 + Size(t->m_left) + Size(t->m_right);
+	t->m_minDepth = t->m_depth;
+	if(t->m_left)
+	{
+		t->m_left->m_up = t;
+		t->m_minDepth = min(t->m_minDepth, t->m_left->m_minDepth);
+	}
+	if(t->m_right)
+	{
+		t->m_right->m_up = t;
+		t->m_minDepth = min(t->m_minDepth, t->m_right->m_minDepth);
+	}
+}
+
+TreeNode* TreeViewImpl::Merge(TreeNode* a, TreeNode* b)
+{
+	if(!a || !b)
+	{
+		TreeNode* t = a ? a : b;
+		if(t)
+			t->m_up = nullptr;
+		return t;
+	}
+
+	if(a->m_priority > b->m_priority)
+	{
+		a->m_right = Merge(a->m_right, b);
+		Update(a);
+		a->m_up = nullptr;
+		return a;
+	}
+	b->m_left = Merge(a, b->m_left);
+	Update(b);
+	b->m_up = nullptr;
+	return b;
+}
+
+void TreeViewImpl::Split(TreeNode* t, size_t count, TreeNode*& left, TreeNode*& right)
+{
+	if(!t)
+	{
+		left = right = nullptr;
+		return;
+	}
+
+	if(Size(t->m_left) < count)
+	{
+		Split(t->m_right, count - Size(t->m_left) - 1, t->m_right, right);
+		Update(t);
+		left = t;
+	}
+	else
+	{
+		Split(t->m_left, count, left, t->m_left);
+		Update(t);
+		right = t;
+	}
+	if(left)
+		left->m_up = nullptr;
+	if(right)
+		right->m_up = nullptr;
+}
+
+size_t TreeViewImpl::IndexOf(const TreeNode* t)
+{
+	size_t index = Size(t->m_left);
+	for(; t->m_up; t = t->m_up)
+	{
+		if(t->m_up->m_right == t)
+			index += Size(t->m_up->m_left) + 1;
+	}
+	return index;
+}
+
+TreeNode* TreeViewImpl::At(TreeNode* t, size_t index)
+{
+	while(t)
+	{
+		size_t left = Size(t->m_left);
+		if(index < left)
+		{
+			t = t->m_left;
+		}
+		else if(index == left)
+		{
+			return t;
+		}
+		else
+		{
+			index -= left + 1;
+			t = t->m_right;
+		}
+	}
+	return nullptr;
+}
+
+TreeNode* TreeViewImpl::Next(TreeNode* t)
+{
+	if(t->m_right)
+	{
+		t = t->m_right;
+		while(t->m_left)
+		{
+			t = t->m_left;
+		}
+		return t;
+	}
+	while(t->m_up && t->m_up->m_right == t)
+	{
+		t = t->m_up;
+	}
+	return t->m_up;
+}
+
+size_t TreeViewImpl::FindShallow(const TreeNode* t, size_t base, size_t start, UINT32 depth)
+{
+	// First row at or after start that is no deeper than depth
+	if(!t || t->m_minDepth > depth || base + t->m_size <= start)
+		return TreeView::NoRow;
+
+	size_t found = FindShallow(t->m_left, base, start, depth);
+	if(found != TreeView::NoRow)
+		return found;
+
+	size_t self = base + Size(t->m_left);
+	if(self >= start && t->m_depth <= depth)
+		return self;
+	return FindShallow(t->m_right, self + 1, start, depth);
+}
+
+TreeView::TreeView() :
+m_pImpl(new TreeViewImpl())
+{
+}
+
+TreeView::~TreeView()
+{
+	SetRoots(nullptr, 0);
+	for(auto row : m_pImpl->m_allRows)
+	{
+		RemoveChild(row);
+		m_pImpl->m_model->DestroyRow(row);
+	}
+	delete m_pImpl;
+}
+
+void TreeView::SetModel(TreeViewModel* model)
+{
+	SetRoots(nullptr, 0);
+	for(auto row : m_pImpl->m_allRows)
+	{
+		RemoveChild(row);
+		m_pImpl->m_model->DestroyRow(row);
+	}
+	m_pImpl->m_allRows.clear();
+	m_pImpl->m_pool.clear();
+	m_pImpl->m_model = model;
+}
+
+TreeViewModel* TreeView::GetModel() const
+{
+	return m_pImpl->m_model;
+}
+
+void TreeView::SetRoots(const TreeNodeId* nodes, size_t count)
+{
+	m_pImpl->DeleteRows(m_pImpl->m_rows);
+	m_pImpl->m_rows = m_pImpl->BuildRows(nodes, count, nullptr, 0);
+	DirtyLayout();
+}
+
+void TreeView::SetChildren(TreeNodeId parent, const TreeNodeId* children, size_t count)
+{
+	TreeNode* node = m_pImpl->Find(parent);
+	if(!node)
+		return;
+
+	// Drop whatever was there before
+	if(node->m_expanded)
+		m_pImpl->DeleteRows(m_pImpl->CutDescendants(node));
+	m_pImpl->DeleteRows(node->m_hidden);
+	node->m_hidden = nullptr;
+
+	TreeNode* rows = m_pImpl->BuildRows(children, count, node, node->m_depth + 1);
+	node->m_fetched = true;
+	node->m_loaded = true;
+	node->m_dirty = true;
+
+	if(node->m_expanded)
+	{
+		TreeNode*& slot = m_pImpl->Slot(node);
+		TreeNode* before;
+		TreeNode* after;
+		TreeViewImpl::Split(slot, TreeViewImpl::IndexOf(node) + 1, before, after);
+		slot = TreeViewImpl::Merge(TreeViewImpl::Merge(before, rows), after);
+	}
+	else
+	{
+		node->m_hidden = rows;
+	}
+	DirtyLayout();
+}
+
+void TreeView::Expand(TreeNodeId id)
+{
+	TreeNode* node = m_pImpl->Find(id);
+	if(!node || node->m_expanded)
+		return;
+
+	node->m_expanded = true;
+	node->m_dirty = true;
+	DirtyLayout();
+
+	if(!node->m_fetched)
+	{
+		node->m_fetched = true;
+		m_pImpl->m_model->FetchChildren(this, id);
+		return;
+	}
+
+	if(node->m_hidden)
+	{
+		TreeNode*& slot = m_pImpl->Slot(node);
+		TreeNode* before;
+		TreeNode* after;
+		TreeViewImpl::Split(slot, TreeViewImpl::IndexOf(node) + 1, before, after);
+		slot = TreeViewImpl::Merge(TreeViewImpl::Merge(before, node->m_hidden), after);
+		node->m_hidden = nullptr;
+	}
+}
+
+void TreeView::Collapse(TreeNodeId id)
+{
+	TreeNode* node = m_pImpl->Find(id);
+	if(!node || !node->m_expanded)
+		return;
+
+	node->m_expanded = false;
+	node->m_dirty = true;
+	node->m_hidden = m_pImpl->CutDescendants(node);
+	DirtyLayout();
+}
+
+void TreeView::Toggle(TreeNodeId node)
+{
+	if(IsExpanded(node))
+		Collapse(node);
+	else
+		Expand(node);
+}
+
+bool TreeView::IsExpanded(TreeNodeId id) const
+{
+	TreeNode* node = m_pImpl->Find(id);
+	return node && node->m_expanded;
+}
+
+bool TreeView::IsLoading(TreeNodeId id) const
+{
+	TreeNode* node = m_pImpl->Find(id);
+	return node && node->m_expanded && !node->m_loaded;
+}
+
+void TreeView::ReloadNode(TreeNodeId id)
+{
+	TreeNode* node = m_pImpl->Find(id);
+	if(node && node->m_row)
+	{
+		node->m_dirty = true;
+		DirtyLayout();
+	}
+}
+
+size_t TreeView::NumRows() const
+{
+	return TreeViewImpl::Size(m_pImpl->m_rows);
+}
+
+bool TreeView::GetRowNode(size_t row, TreeNodeId& id) const
+{
+	TreeNode* node = TreeViewImpl::At(m_pImpl->m_rows, row);
+	if(!node)
+		return false;
+	id = node->m_id;
+	return true;
+}
+
+size_t TreeView::GetNodeRow(TreeNodeId id) const
+{
+	TreeNode* node = m_pImpl->Find(id);
+	if(!node || m_pImpl->Slot(node) != m_pImpl->m_rows)
+		return NoRow;
+	return TreeViewImpl::IndexOf(node);
+}
+
+void TreeView::SetRowHeight(FLOAT height)
+{
+	m_pImpl->m_rowHeight = height;
+	DirtyLayout();
+}
+
+FLOAT TreeView::GetRowHeight() const
+{
+	return m_pImpl->m_rowHeight;
+}
+
+void TreeView::SetScrollOffset(FLOAT offset)
+{
+	m_pImpl->m_scroll = offset;
+	DirtyLayout();
+}
+
+FLOAT TreeView::GetScrollOffset() const
+{
+	return (FLOAT)m_pImpl->m_scroll;
+}
+
+bool TreeView::HitTest(const D2D1_POINT_2F& pos, TreeNodeId& node) const
+{
+	if(pos.y < 0 || pos.y >= GetSize().height)
+		return false;
+	return GetRowNode((size_t)floor((pos.y + m_pImpl->m_scroll) / m_pImpl->m_rowHeight), node);
+}
+
+void TreeView::OnLayout()
+{
+	TreeViewImpl* impl = m_pImpl;
+	D2D1_SIZE_F size = GetSize();
+	SetClippingRect(D2D1::RectF(0, 0, size.width, size.height));
+
+	// Rows snap to their places
+	tjm::animation::AllInstant ai(true);
+
+	size_t count = NumRows();
+	double height = impl->m_rowHeight;
+	double maxScroll = count * height - size.height;
+	impl->m_scroll = max(0.0, min(impl->m_scroll, maxScroll));
+
+	size_t first = (size_t)floor(impl->m_scroll / height);
+	size_t end = min(count, (size_t)ceil((impl->m_scroll + size.height) / height));
+
+	// Rows that scrolled out go back to the pool first
+	UINT64 stamp = ++impl->m_layoutStamp;
+	TreeNode* start = first < end ? TreeViewImpl::At(impl->m_rows, first) : nullptr;
+	for(TreeNode* node = start; node && first < end; node = TreeViewImpl::Next(node), ++first)
+	{
+		node->m_layoutStamp = stamp;
+	}
+	std::vector<TreeNode*> bound;
+	bound.swap(impl->m_bound);
+	for(auto node : bound)
+	{
+		if(node->m_layoutStamp != stamp)
+		{
+			node->m_row->SetVisible(false);
+			impl->m_pool.push_back(node->m_row);
+			node->m_row = nullptr;
+		}
+	}
+
+	// Only rows coming into view, or whose node changed, are rebound; the
+	// rest just move
+	first = (size_t)floor(impl->m_scroll / height);
+	for(TreeNode* node = start; node && first < end; node = TreeViewImpl::Next(node), ++first)
+	{
+		if(!node->m_row)
+		{
+			if(!impl->m_pool.empty())
+			{
+				node->m_row = impl->m_pool.back();
+				impl->m_pool.pop_back();
+			}
+			else
+			{
+				node->m_row = impl->m_model->CreateRow();
+				impl->m_allRows.push_back(node->m_row);
+				AddChild(node->m_row);
+			}
+			node->m_dirty = true;
+		}
+
+		if(node->m_dirty)
+		{
+			impl->m_model->BindRow(node->m_row, node->m_id, node->m_depth, node->m_expanded);
+			node->m_dirty = false;
+		}
+
+		node->m_row->SetPosition(D2D1::Point2F(0, (FLOAT)(first * height - impl->m_scroll)));
+		node->m_row->SetSize(D2D1::SizeF(size.width, (FLOAT)height));
+		node->m_row->SetVisible(true);
+		impl->m_bound.push_back(node);
+	}
+}
+
+Object* TreeView::OnTouch(const D2D1_POINT_2F&)
+{
+	return this;
+}
+
+bool TreeView::OnTouchContinue(const TouchInfo& ti)
+{
+	SetScrollOffset(GetScrollOffset() - (ti.currentTouch.y - ti.previousTouch.y));
+	return true;
+}
+
+} // end namespace dash
+} // end namespace tjm